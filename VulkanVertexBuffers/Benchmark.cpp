@@ -0,0 +1,178 @@
+#include "Benchmark.h"
+#include "FrustumCulling.h"
+#include "Mesh.h"
+#include "MeshCodec.h"
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <vector>
+
+template <typename Function>
+static double measureMilliseconds(int iterations, Function function)
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < iterations; ++i)
+	{
+		function();
+	}
+
+	const auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+void runCullingBenchmark(std::ostream& out)
+{
+	const size_t objectCount = 1 << 20;
+	const int iterations = 50;
+
+	BoundingSphereTable table;
+	table.resize(objectCount);
+
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> position(-2.0f, 2.0f);
+	std::uniform_real_distribution<float> radius(0.01f, 0.1f);
+
+	for (size_t i = 0; i < objectCount; ++i)
+	{
+		table.set(i, glm::vec4(position(random), position(random), position(random) * 0.5f + 0.5f, radius(random)));
+	}
+
+	// Planes of the identity view-projection: the [-1, 1] x [-1, 1] x [0, 1] clip volume.
+	const std::array<glm::vec4, 6> planes = {
+		glm::vec4(1.0f, 0.0f, 0.0f, 1.0f),
+		glm::vec4(-1.0f, 0.0f, 0.0f, 1.0f),
+		glm::vec4(0.0f, 1.0f, 0.0f, 1.0f),
+		glm::vec4(0.0f, -1.0f, 0.0f, 1.0f),
+		glm::vec4(0.0f, 0.0f, 1.0f, 0.0f),
+		glm::vec4(0.0f, 0.0f, -1.0f, 1.0f)
+	};
+
+	std::vector<uint32_t> visible(objectCount);
+
+	struct Variant
+	{
+		const char* name;
+		CullingInstructionSet instructionSet;
+	};
+
+	std::vector<Variant> variants = {
+		{ "scalar", CullingInstructionSet::Scalar },
+		{ "sse", CullingInstructionSet::Sse }
+	};
+
+	if (isAvx2Supported())
+	{
+		variants.push_back({ "avx2", CullingInstructionSet::Avx2 });
+	}
+
+	out << "Frustum culling of " << objectCount << " spheres, " << iterations << " iterations" << std::endl;
+
+	for (const Variant& variant : variants)
+	{
+		size_t visibleCount = 0;
+		const double milliseconds = measureMilliseconds(iterations, [&]()
+		{
+			visibleCount = cullSpheres(variant.instructionSet, table, planes, visible.data());
+		});
+
+		out << variant.name << ": " << milliseconds << " ms, "
+			<< static_cast<size_t>(objectCount / milliseconds) << " objects/ms, "
+			<< visibleCount << " visible" << std::endl;
+	}
+}
+
+void runCodecBenchmark(std::ostream& out)
+{
+	const uint32_t gridSize = 1024;
+	const int iterations = 20;
+
+	// The same kind of grid the engine displays, with its colors blended between the corners.
+	std::vector<Vertex> vertices((gridSize + 1) * (gridSize + 1));
+	std::vector<uint32_t> indices;
+
+	for (uint32_t y = 0; y <= gridSize; ++y)
+	{
+		for (uint32_t x = 0; x <= gridSize; ++x)
+		{
+			const float u = static_cast<float>(x) / gridSize;
+			const float v = static_cast<float>(y) / gridSize;
+
+			Vertex& vertex = vertices[y * (gridSize + 1) + x];
+			vertex.position = { u - 0.5f, v - 0.5f, 0.0f };
+			vertex.color = { 1.0f - u, u * (1.0f - v), v };
+		}
+	}
+
+	for (uint32_t y = 0; y < gridSize; ++y)
+	{
+		for (uint32_t x = 0; x < gridSize; ++x)
+		{
+			const uint32_t topLeft = y * (gridSize + 1) + x;
+			const uint32_t topRight = topLeft + 1;
+			const uint32_t bottomLeft = topLeft + gridSize + 1;
+			const uint32_t bottomRight = bottomLeft + 1;
+
+			indices.insert(indices.end(), { topLeft, topRight, bottomRight, topLeft, bottomRight, bottomLeft });
+		}
+	}
+
+	struct Stream
+	{
+		const char* name;
+		const uint32_t* words;
+		size_t recordCount;
+		uint32_t stride;
+	};
+
+	const Stream streams[] = {
+		{ "vertices", reinterpret_cast<const uint32_t*>(vertices.data()), vertices.size(),
+			sizeof(Vertex) / sizeof(uint32_t) },
+		{ "indices", indices.data(), indices.size(), 1 }
+	};
+
+	struct Variant
+	{
+		const char* name;
+		CodecInstructionSet instructionSet;
+	};
+
+	std::vector<Variant> variants = {
+		{ "scalar", CodecInstructionSet::Scalar }
+	};
+
+	if (chooseCodecInstructionSet() != CodecInstructionSet::Scalar)
+	{
+		variants.push_back({ "sse", CodecInstructionSet::Sse });
+	}
+
+	if (isAvx2Supported())
+	{
+		variants.push_back({ "avx2", CodecInstructionSet::Avx2 });
+	}
+
+	out << "Mesh codec on a " << gridSize << " x " << gridSize << " grid, " << iterations << " iterations" << std::endl;
+
+	for (const Stream& stream : streams)
+	{
+		const size_t size = stream.recordCount * stream.stride * sizeof(uint32_t);
+		const std::vector<uint8_t> encoded = encodeWords(stream.words, stream.recordCount, stream.stride);
+		std::vector<uint32_t> decoded(stream.recordCount * stream.stride);
+
+		out << stream.name << ": " << size << " bytes encoded to " << encoded.size() << ", ratio "
+			<< static_cast<double>(size) / encoded.size() << std::endl;
+
+		for (const Variant& variant : variants)
+		{
+			const double milliseconds = measureMilliseconds(iterations, [&]()
+			{
+				decodeWords(variant.instructionSet, encoded, decoded.data());
+			});
+
+			const bool lossless = memcmp(decoded.data(), stream.words, size) == 0;
+
+			out << "  " << variant.name << ": " << milliseconds << " ms, "
+				<< size / (milliseconds * 1000000.0) << " GB/s" << (lossless ? "" : ", MISMATCH") << std::endl;
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <ostream>
+
+void runCullingBenchmark(std::ostream& out);
+void runCodecBenchmark(std::ostream& out);
@@ -0,0 +1,55 @@
+#include "CommandBufferCache.h"
+#include <stdexcept>
+
+CommandBufferCache::CommandBufferCache()
+	: m_vkDevice(VK_NULL_HANDLE),
+	m_vkCommandPool(VK_NULL_HANDLE)
+{
+}
+
+void CommandBufferCache::init(VkDevice device, VkCommandPool commandPool)
+{
+	m_vkDevice = device;
+	m_vkCommandPool = commandPool;
+}
+
+VkCommandBuffer CommandBufferCache::acquire(uint64_t key, uint64_t version, bool* outNeedsRecording)
+{
+	auto found = m_entries.find(key);
+
+	if (found == m_entries.end())
+	{
+		VkCommandBufferAllocateInfo commandBufferInfo = {};
+		commandBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		commandBufferInfo.commandPool = m_vkCommandPool;
+		commandBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		commandBufferInfo.commandBufferCount = 1;
+
+		Entry entry = {};
+		VkResult result = vkAllocateCommandBuffers(m_vkDevice, &commandBufferInfo, &entry.commandBuffer);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to allocate secondary command buffer.");
+		}
+
+		entry.version = version;
+		m_entries[key] = entry;
+		*outNeedsRecording = true;
+		return entry.commandBuffer;
+	}
+
+	Entry& entry = found->second;
+	*outNeedsRecording = entry.version != version;
+	entry.version = version;
+	return entry.commandBuffer;
+}
+
+void CommandBufferCache::destroy()
+{
+	for (const auto& entry : m_entries)
+	{
+		vkFreeCommandBuffers(m_vkDevice, m_vkCommandPool, 1, &entry.second.commandBuffer);
+	}
+
+	m_entries.clear();
+}
\ No newline at end of file
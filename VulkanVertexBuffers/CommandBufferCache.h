@@ -0,0 +1,32 @@
+#pragma once
+
+#include <vulkan.h>
+#include <unordered_map>
+#include <cstdint>
+
+// Keeps secondary command buffers recorded for a key, so they can be replayed unchanged until
+// the version of what they record changes.
+class CommandBufferCache
+{
+private:
+	struct Entry
+	{
+		VkCommandBuffer commandBuffer;
+		uint64_t version;
+	};
+
+	VkDevice m_vkDevice;
+	VkCommandPool m_vkCommandPool;
+	std::unordered_map<uint64_t, Entry> m_entries;
+
+public:
+	CommandBufferCache();
+
+	void init(VkDevice device, VkCommandPool commandPool);
+
+	// Sets outNeedsRecording when the buffer is new or was recorded for another version, the caller
+	// then has to record it before use. A key must not be acquired again while a submission of its
+	// buffer is still pending.
+	VkCommandBuffer acquire(uint64_t key, uint64_t version, bool* outNeedsRecording);
+	void destroy();
+};
\ No newline at end of file
@@ -0,0 +1,124 @@
+#include "Deformation.h"
+#include <algorithm>
+#include <cmath>
+#include "glm/common.hpp"
+#include "glm/geometric.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+ChainRig buildChainRig(const std::vector<Vertex>& vertices, uint32_t boneCount)
+{
+	float minX = vertices.front().position.x;
+	float maxX = minX;
+
+	for (const Vertex& vertex : vertices)
+	{
+		minX = std::min(minX, vertex.position.x);
+		maxX = std::max(maxX, vertex.position.x);
+	}
+
+	ChainRig rig = {};
+	rig.boneCount = std::min(std::max(boneCount, 1u), MAX_BONE_COUNT);
+	rig.rootX = minX;
+	rig.boneLength = (maxX - minX) / rig.boneCount;
+	return rig;
+}
+
+std::vector<SkinnedVertex> skinToChain(const std::vector<Vertex>& vertices, const ChainRig& rig)
+{
+	std::vector<SkinnedVertex> skinnedVertices(vertices.size());
+
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		// Blend linearly between the two bones whose centers surround the vertex.
+		const float bonePosition = (vertices[i].position.x - rig.rootX) / rig.boneLength - 0.5f;
+		const float clampedPosition = glm::clamp(bonePosition, 0.0f, static_cast<float>(rig.boneCount - 1));
+		const uint32_t firstBone = std::min(static_cast<uint32_t>(clampedPosition), rig.boneCount - 1);
+		const uint32_t secondBone = std::min(firstBone + 1, rig.boneCount - 1);
+		const float secondWeight = clampedPosition - firstBone;
+
+		SkinnedVertex& skinnedVertex = skinnedVertices[i];
+		skinnedVertex.position = glm::vec4(vertices[i].position, 1.0f);
+		skinnedVertex.color = glm::vec4(vertices[i].color, 1.0f);
+		skinnedVertex.boneIndices = glm::uvec4(firstBone, secondBone, 0, 0);
+		skinnedVertex.boneWeights = glm::vec4(1.0f - secondWeight, secondWeight, 0.0f, 0.0f);
+	}
+
+	return skinnedVertices;
+}
+
+void computeChainPalette(const ChainRig& rig, float seconds, glm::mat4* outPalette)
+{
+	const float amplitude = 1.2f / rig.boneCount;
+	glm::mat4 joint = glm::translate(glm::mat4(1.0f), glm::vec3(rig.rootX, 0.0f, 0.0f));
+
+	for (uint32_t bone = 0; bone < rig.boneCount; ++bone)
+	{
+		if (bone > 0)
+		{
+			joint = glm::translate(joint, glm::vec3(rig.boneLength, 0.0f, 0.0f));
+		}
+
+		joint = glm::rotate(joint, amplitude * std::sin(2.0f * seconds + 0.8f * bone), glm::vec3(0.0f, 0.0f, 1.0f));
+
+		const glm::vec3 bindPosition(rig.rootX + rig.boneLength * bone, 0.0f, 0.0f);
+		outPalette[bone] = glm::translate(joint, -bindPosition);
+	}
+
+	for (uint32_t bone = rig.boneCount; bone < MAX_BONE_COUNT; ++bone)
+	{
+		outPalette[bone] = glm::mat4(1.0f);
+	}
+}
+
+std::vector<glm::vec4> buildMorphTargets(const std::vector<Vertex>& vertices, uint32_t* outTargetCount)
+{
+	const uint32_t targetCount = 2;
+	std::vector<glm::vec4> deltas(vertices.size() * targetCount, glm::vec4(0.0f));
+
+	float radius = 0.0f;
+	for (const Vertex& vertex : vertices)
+	{
+		radius = std::max(radius, glm::length(vertex.position));
+	}
+
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		const glm::vec3& position = vertices[i].position;
+
+		// Pinch pulls the middle in while keeping the rim, wave ripples the surface along y.
+		const float distance = glm::length(position) / radius;
+		deltas[i] = glm::vec4(-0.4f * position * (1.0f - distance), 0.0f);
+		deltas[vertices.size() + i] = glm::vec4(0.0f, 0.1f * radius * std::sin(position.x * 12.0f / radius), 0.0f, 0.0f);
+	}
+
+	*outTargetCount = targetCount;
+	return deltas;
+}
+
+glm::vec4 computeMorphWeights(float seconds)
+{
+	return glm::vec4(0.5f + 0.5f * std::sin(1.3f * seconds), 0.5f + 0.5f * std::sin(0.7f * seconds + 1.0f),
+		0.0f, 0.0f);
+}
+
+float computeDeformedBoundingRadius(const std::vector<Vertex>& vertices, const ChainRig& rig,
+	const std::vector<glm::vec4>& morphTargets, uint32_t targetCount)
+{
+	// Morph weights stay within [0, 1] and bones only rotate, so every deformed vertex keeps
+	// its morphed distance from the chain root.
+	const glm::vec3 root(rig.rootX, 0.0f, 0.0f);
+	float radius = 0.0f;
+
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		float morphDistance = 0.0f;
+		for (uint32_t target = 0; target < targetCount; ++target)
+		{
+			morphDistance += glm::length(glm::vec3(morphTargets[target * vertices.size() + i]));
+		}
+
+		radius = std::max(radius, glm::length(vertices[i].position - root) + morphDistance);
+	}
+
+	return radius + glm::length(root);
+}
\ No newline at end of file
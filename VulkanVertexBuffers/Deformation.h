@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "glm/vec4.hpp"
+#include "glm/mat4x4.hpp"
+#include "Mesh.h"
+
+constexpr uint32_t MAX_BONE_COUNT = 16;
+constexpr uint32_t MAX_MORPH_TARGET_COUNT = 4;
+
+// Rest pose vertex with up to four bone influences, laid out for std430.
+struct SkinnedVertex
+{
+	glm::vec4 position;
+	glm::vec4 color;
+	glm::uvec4 boneIndices;
+	glm::vec4 boneWeights;
+};
+
+struct DeformParameters
+{
+	glm::mat4 bones[MAX_BONE_COUNT];
+	glm::vec4 morphWeights;
+	uint32_t vertexCount;
+	uint32_t morphTargetCount;
+	VertexFormat outputFormat;
+};
+
+// A straight chain of equally long bones running along the x axis from rootX.
+struct ChainRig
+{
+	uint32_t boneCount;
+	float rootX;
+	float boneLength;
+};
+
+ChainRig buildChainRig(const std::vector<Vertex>& vertices, uint32_t boneCount);
+std::vector<SkinnedVertex> skinToChain(const std::vector<Vertex>& vertices, const ChainRig& rig);
+void computeChainPalette(const ChainRig& rig, float seconds, glm::mat4* outPalette);
+
+// Returns targetCount blocks of one position delta per vertex.
+std::vector<glm::vec4> buildMorphTargets(const std::vector<Vertex>& vertices, uint32_t* outTargetCount);
+glm::vec4 computeMorphWeights(float seconds);
+
+// Radius around the origin that contains every pose the rig and morph targets can produce.
+float computeDeformedBoundingRadius(const std::vector<Vertex>& vertices, const ChainRig& rig,
+	const std::vector<glm::vec4>& morphTargets, uint32_t targetCount);
\ No newline at end of file
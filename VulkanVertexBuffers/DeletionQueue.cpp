@@ -0,0 +1,97 @@
+#include "DeletionQueue.h"
+#include <algorithm>
+
+DeletionQueue::DeletionQueue()
+	: m_vkDevice(VK_NULL_HANDLE),
+	m_vkAllocator(nullptr),
+	m_memoryBudget(nullptr),
+	m_completedFrameCount(0)
+{
+}
+
+void DeletionQueue::init(VkDevice device, const VkAllocationCallbacks* allocator, MemoryBudget* memoryBudget)
+{
+	m_vkDevice = device;
+	m_vkAllocator = allocator;
+	m_memoryBudget = memoryBudget;
+}
+
+void DeletionQueue::destroy(const RetiredResource& resource)
+{
+	if (resource.pipeline != VK_NULL_HANDLE)
+	{
+		vkDestroyPipeline(m_vkDevice, resource.pipeline, m_vkAllocator);
+	}
+
+	if (resource.buffer != VK_NULL_HANDLE)
+	{
+		vkDestroyBuffer(m_vkDevice, resource.buffer, m_vkAllocator);
+	}
+
+	if (resource.memory != VK_NULL_HANDLE)
+	{
+		m_memoryBudget->untrack(resource.memory);
+		vkFreeMemory(m_vkDevice, resource.memory, m_vkAllocator);
+	}
+}
+
+void DeletionQueue::retire(const RetiredResource& resource)
+{
+	if (resource.frame < m_completedFrameCount)
+	{
+		destroy(resource);
+		return;
+	}
+
+	// Evicted resources can carry an older frame than the newest entries, keep the queue sorted.
+	auto position = std::upper_bound(m_resources.begin(), m_resources.end(), resource,
+		[](const RetiredResource& left, const RetiredResource& right)
+	{
+		return left.frame < right.frame;
+	});
+
+	m_resources.insert(position, resource);
+}
+
+void DeletionQueue::retire(uint64_t frame, VkBuffer buffer, VkDeviceMemory memory)
+{
+	RetiredResource resource = {};
+	resource.frame = frame;
+	resource.buffer = buffer;
+	resource.memory = memory;
+	retire(resource);
+}
+
+void DeletionQueue::retire(uint64_t frame, VkPipeline pipeline)
+{
+	RetiredResource resource = {};
+	resource.frame = frame;
+	resource.pipeline = pipeline;
+	retire(resource);
+}
+
+void DeletionQueue::collect(uint64_t completedFrame)
+{
+	m_completedFrameCount = completedFrame + 1;
+
+	while (!m_resources.empty() && m_resources.front().frame <= completedFrame)
+	{
+		destroy(m_resources.front());
+		m_resources.pop_front();
+	}
+}
+
+void DeletionQueue::flush()
+{
+	for (const RetiredResource& resource : m_resources)
+	{
+		destroy(resource);
+	}
+
+	m_resources.clear();
+}
+
+size_t DeletionQueue::size() const
+{
+	return m_resources.size();
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vulkan.h>
+#include <deque>
+#include <cstddef>
+#include <cstdint>
+#include "MemoryBudget.h"
+
+// Holds Vulkan objects that recorded frames may still reference until the GPU has
+// finished the frame they were retired in.
+class DeletionQueue
+{
+private:
+	struct RetiredResource
+	{
+		uint64_t frame;
+		VkBuffer buffer;
+		VkDeviceMemory memory;
+		VkPipeline pipeline;
+	};
+
+	VkDevice m_vkDevice;
+	const VkAllocationCallbacks* m_vkAllocator;
+	MemoryBudget* m_memoryBudget;
+	uint64_t m_completedFrameCount;
+	std::deque<RetiredResource> m_resources;
+
+	void retire(const RetiredResource& resource);
+	void destroy(const RetiredResource& resource);
+
+public:
+	DeletionQueue();
+
+	void init(VkDevice device, const VkAllocationCallbacks* allocator, MemoryBudget* memoryBudget);
+
+	// Resources of frames that already completed are destroyed right away.
+	void retire(uint64_t frame, VkBuffer buffer, VkDeviceMemory memory);
+	void retire(uint64_t frame, VkPipeline pipeline);
+
+	// Destroys everything retired in or before completedFrame.
+	void collect(uint64_t completedFrame);
+	void flush();
+	size_t size() const;
+};
\ No newline at end of file
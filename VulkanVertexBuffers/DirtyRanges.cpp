@@ -0,0 +1,45 @@
+#include "DirtyRanges.h"
+#include <algorithm>
+
+void DirtyRanges::add(VkDeviceSize offset, VkDeviceSize size)
+{
+	if (size == 0)
+	{
+		return;
+	}
+
+	VkDeviceSize end = offset + size;
+
+	// First range that ends at or after the new one starts, anything before it stays separate.
+	auto first = std::lower_bound(m_ranges.begin(), m_ranges.end(), offset,
+		[](const ByteRange& range, VkDeviceSize value)
+	{
+		return range.offset + range.size < value;
+	});
+
+	auto last = first;
+	while (last != m_ranges.end() && last->offset <= end)
+	{
+		offset = std::min(offset, last->offset);
+		end = std::max(end, last->offset + last->size);
+		++last;
+	}
+
+	first = m_ranges.erase(first, last);
+	m_ranges.insert(first, { offset, end - offset });
+}
+
+void DirtyRanges::clear()
+{
+	m_ranges.clear();
+}
+
+bool DirtyRanges::empty() const
+{
+	return m_ranges.empty();
+}
+
+const std::vector<ByteRange>& DirtyRanges::getRanges() const
+{
+	return m_ranges;
+}
\ No newline at end of file
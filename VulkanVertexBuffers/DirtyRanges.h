@@ -0,0 +1,24 @@
+#pragma once
+
+#include <vulkan.h>
+#include <vector>
+
+struct ByteRange
+{
+	VkDeviceSize offset;
+	VkDeviceSize size;
+};
+
+// Sorted set of modified byte ranges. Overlapping and touching ranges are merged as they are
+// added, so flushing issues one region per contiguous edit.
+class DirtyRanges
+{
+private:
+	std::vector<ByteRange> m_ranges;
+
+public:
+	void add(VkDeviceSize offset, VkDeviceSize size);
+	void clear();
+	bool empty() const;
+	const std::vector<ByteRange>& getRanges() const;
+};
\ No newline at end of file
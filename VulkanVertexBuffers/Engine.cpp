@@ -4,6 +4,54 @@
 #include <vector>
 #include <set>
 #include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <limits>
+#include "glm/gtc/matrix_transform.hpp"
+#include "glm/gtc/matrix_access.hpp"
+#include "glm/matrix.hpp"
+
+static const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+static const uint64_t FNV_PRIME = 1099511628211ull;
+
+static const VkMemoryPropertyFlags UNIFIED_MEMORY_PROPERTY_FLAGS = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+	VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+// Geometry blocks are also copy sources and destinations while the pool compacts itself.
+static const VkBufferUsageFlags GEOMETRY_BLOCK_USAGE_FLAGS = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+	VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+	VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+static const char* UPLOAD_STRATEGY_CACHE_PATH = "upload_strategy.cache";
+static const int PROBE_REPEAT_COUNT = 3;
+static const int PROBE_LATENCY_SUBMIT_COUNT = 8;
+
+// FNV-1a over the bytes of value.
+static uint64_t hashValue(uint64_t hash, uint64_t value)
+{
+	for (int i = 0; i < 8; ++i)
+	{
+		hash ^= (value >> (8 * i)) & 0xFF;
+		hash *= FNV_PRIME;
+	}
+
+	return hash;
+}
+
+// A burst of small edits followed by two large buffers, like a frame that also reloads a mesh.
+static std::vector<VkDeviceSize> getProbeUploadSizes()
+{
+	std::vector<VkDeviceSize> sizes(48, 32 * 1024);
+	sizes.insert(sizes.end(), 2, 1024 * 1024);
+	return sizes;
+}
+
+static VkDeviceSize getProbePayloadSize()
+{
+	const std::vector<VkDeviceSize> sizes = getProbeUploadSizes();
+	return std::accumulate(sizes.begin(), sizes.end(), VkDeviceSize(0));
+}
 
 void Engine::initVkInstance()
 {
@@ -20,10 +68,19 @@ void Engine::initVkInstance()
 	std::vector<const char*> extensions(extensionCount);
 	SDL_Vulkan_GetInstanceExtensions(m_sdlWindow, &extensionCount, extensions.data());
 
+	// Needed to query VK_EXT_memory_budget on a Vulkan 1.0 instance.
+	m_physicalDeviceProperties2Supported = checkInstanceExtensionSupport(
+		VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+
+	if (m_physicalDeviceProperties2Supported)
+	{
+		extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+	}
+
 	VkInstanceCreateInfo vkInstanceCreateInfo = {};
 	vkInstanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
 	vkInstanceCreateInfo.pApplicationInfo = &vkApplicationInfo;
-	vkInstanceCreateInfo.enabledExtensionCount = extensionCount;
+	vkInstanceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
 	vkInstanceCreateInfo.ppEnabledExtensionNames = extensions.data();
 
 #ifdef _DEBUG
@@ -34,7 +91,7 @@ void Engine::initVkInstance()
 	vkInstanceCreateInfo.ppEnabledLayerNames = validationLayers.data();
 #endif
 
-	VkResult result = vkCreateInstance(&vkInstanceCreateInfo, nullptr, &m_vkInstance);
+	VkResult result = vkCreateInstance(&vkInstanceCreateInfo, m_vkAllocator, &m_vkInstance);
 
 	if (result != VK_SUCCESS)
 	{
@@ -52,6 +109,22 @@ void Engine::createVkSurface()
 	}
 }
 
+// Discrete GPUs first, but integrated, virtual and CPU implementations are all usable.
+static uint32_t rankPhysicalDeviceType(VkPhysicalDeviceType deviceType)
+{
+	switch (deviceType)
+	{
+	case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+		return 3;
+	case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+		return 2;
+	case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
 void Engine::pickPhysicalDevice()
 {
 	m_deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
@@ -68,50 +141,101 @@ void Engine::pickPhysicalDevice()
 	vkEnumeratePhysicalDevices(m_vkInstance, &deviceCount, availableDevices.data());
 
 	m_vkPhysicalDevice = VK_NULL_HANDLE;
+	uint32_t bestRank = 0;
+
 	for (VkPhysicalDevice availableDevice : availableDevices)
 	{
 		VkPhysicalDeviceProperties properties;
 		vkGetPhysicalDeviceProperties(availableDevice, &properties);
 
-		if (properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU &&
+		const uint32_t rank = rankPhysicalDeviceType(properties.deviceType);
+
+		if ((m_vkPhysicalDevice == VK_NULL_HANDLE || rank > bestRank) &&
 			checkDeviceExtensionSupport(availableDevice) &&
 			checkSwapchainSupport(availableDevice) &&
 			checkQueueFamiliesSupport(availableDevice))
 		{
 			m_vkPhysicalDevice = availableDevice;
-			break;
+			bestRank = rank;
 		}
 	}
 
 	if (m_vkPhysicalDevice == VK_NULL_HANDLE)
 	{
-		throw std::runtime_error("None discrete GPU is available.");
+		throw std::runtime_error("None suitable GPU is available.");
 	}
 }
 
 void Engine::createDevice()
 {
-	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos(2);
+	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 
 	QueueFamilyIndices queueFamilyIndices = findQueueFamilyIndices(m_vkPhysicalDevice);
 	const float queuePriority = 1.0f;
 
-	VkDeviceQueueCreateInfo& graphicsQueueCreateInfo = queueCreateInfos[0];
-	graphicsQueueCreateInfo = {};
+	VkDeviceQueueCreateInfo graphicsQueueCreateInfo = {};
 	graphicsQueueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
 	graphicsQueueCreateInfo.queueFamilyIndex = *queueFamilyIndices.graphics;
 	graphicsQueueCreateInfo.queueCount = 1;
 	graphicsQueueCreateInfo.pQueuePriorities = &queuePriority;
+	queueCreateInfos.push_back(graphicsQueueCreateInfo);
+
+	// A family may only be listed once, a shared one hands out the same queue for both.
+	if (*queueFamilyIndices.presentation != *queueFamilyIndices.graphics)
+	{
+		VkDeviceQueueCreateInfo presentationQueueCreateInfo = {};
+		presentationQueueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+		presentationQueueCreateInfo.queueFamilyIndex = *queueFamilyIndices.presentation;
+		presentationQueueCreateInfo.queueCount = 1;
+		presentationQueueCreateInfo.pQueuePriorities = &queuePriority;
+		queueCreateInfos.push_back(presentationQueueCreateInfo);
+	}
 
-	VkDeviceQueueCreateInfo& presentationQueueCreateInfo = queueCreateInfos[1];
-	presentationQueueCreateInfo = {};
-	presentationQueueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-	presentationQueueCreateInfo.queueFamilyIndex = *queueFamilyIndices.presentation;
-	presentationQueueCreateInfo.queueCount = 1;
-	presentationQueueCreateInfo.pQueuePriorities = &queuePriority;
+	const std::optional<uint32_t> transferQueueFamily = findTransferQueueFamily(m_vkPhysicalDevice);
+
+	if (transferQueueFamily.has_value())
+	{
+		VkDeviceQueueCreateInfo transferQueueCreateInfo = {};
+		transferQueueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+		transferQueueCreateInfo.queueFamilyIndex = *transferQueueFamily;
+		transferQueueCreateInfo.queueCount = 1;
+		transferQueueCreateInfo.pQueuePriorities = &queuePriority;
+		queueCreateInfos.push_back(transferQueueCreateInfo);
+	}
 
 	VkPhysicalDeviceFeatures deviceFeatures = {};
 
+	if (m_gpuDrivenCulling && checkGpuDrivenCullingSupport(m_vkPhysicalDevice))
+	{
+		deviceFeatures.multiDrawIndirect = VK_TRUE;
+		deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+
+		m_drawIndirectCountSupported = checkDeviceExtensionSupport(m_vkPhysicalDevice,
+			VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+
+		if (m_drawIndirectCountSupported)
+		{
+			m_deviceExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+		}
+	}
+	else
+	{
+		m_gpuDrivenCulling = false;
+	}
+
+	// The late phase writes its draws through the same indirect path.
+	m_occlusionCulling = m_occlusionCulling && m_gpuDrivenCulling;
+	// Meshlet bounds are computed from the rest pose, deformation would move geometry out of them.
+	m_clusterCulling = m_clusterCulling && m_gpuDrivenCulling && !m_vertexDeformation;
+
+	const bool memoryBudgetSupported = m_physicalDeviceProperties2Supported &&
+		checkDeviceExtensionSupport(m_vkPhysicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+	if (memoryBudgetSupported)
+	{
+		m_deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+	}
+
 	VkDeviceCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	createInfo.pQueueCreateInfos = queueCreateInfos.data();
@@ -120,7 +244,7 @@ void Engine::createDevice()
 	createInfo.enabledExtensionCount = static_cast<uint32_t>(m_deviceExtensions.size());
 	createInfo.ppEnabledExtensionNames = m_deviceExtensions.data();
 
-	VkResult result = vkCreateDevice(m_vkPhysicalDevice, &createInfo, nullptr, &m_vkDevice);
+	VkResult result = vkCreateDevice(m_vkPhysicalDevice, &createInfo, m_vkAllocator, &m_vkDevice);
 	if (result != VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to create device.");
@@ -128,6 +252,266 @@ void Engine::createDevice()
 
 	vkGetDeviceQueue(m_vkDevice, *queueFamilyIndices.graphics, 0, &m_vkGraphicsQueue);
 	vkGetDeviceQueue(m_vkDevice, *queueFamilyIndices.presentation, 0, &m_vkPresentationQueue);
+	m_uploadQueueFamilies = { *queueFamilyIndices.graphics };
+
+	if (transferQueueFamily.has_value())
+	{
+		vkGetDeviceQueue(m_vkDevice, *transferQueueFamily, 0, &m_vkTransferQueue);
+		m_uploadQueueFamilies.push_back(*transferQueueFamily);
+	}
+
+	if (m_drawIndirectCountSupported)
+	{
+		m_vkCmdDrawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(
+			vkGetDeviceProcAddr(m_vkDevice, "vkCmdDrawIndexedIndirectCountKHR"));
+		m_drawIndirectCountSupported = m_vkCmdDrawIndexedIndirectCount != nullptr;
+	}
+
+	PFN_vkGetPhysicalDeviceMemoryProperties2KHR getPhysicalDeviceMemoryProperties2 = nullptr;
+
+	if (memoryBudgetSupported)
+	{
+		getPhysicalDeviceMemoryProperties2 = reinterpret_cast<PFN_vkGetPhysicalDeviceMemoryProperties2KHR>(
+			vkGetInstanceProcAddr(m_vkInstance, "vkGetPhysicalDeviceMemoryProperties2KHR"));
+	}
+
+	m_memoryBudget.init(m_vkPhysicalDevice, getPhysicalDeviceMemoryProperties2);
+	m_deletionQueue.init(m_vkDevice, m_vkAllocator, &m_memoryBudget);
+	m_unifiedMemory = checkUnifiedMemorySupport(m_vkPhysicalDevice);
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(m_vkPhysicalDevice, &properties);
+
+	// Vertex pulling and deformation bind geometry allocations as storage buffers at their offset.
+	m_geometryPool.init(properties.limits.minStorageBufferOffsetAlignment);
+	m_maxDrawIndirectCount = properties.limits.maxDrawIndirectCount;
+}
+
+void Engine::chooseUploadStrategy()
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(m_vkPhysicalDevice, &properties);
+	const std::string deviceKey = makeDeviceKey(properties);
+
+	m_uploadStrategyCached = loadUploadStrategy(UPLOAD_STRATEGY_CACHE_PATH, deviceKey, &m_uploadStrategy);
+
+	if (!m_uploadStrategyCached)
+	{
+		probeUploadStrategies();
+		// An unwritable cache only means probing again on the next start.
+		saveUploadStrategy(UPLOAD_STRATEGY_CACHE_PATH, deviceKey, m_uploadStrategy);
+	}
+
+	// A cached strategy may rely on something this run turned off or the driver no longer exposes.
+	m_uploadStrategy.directWrite = m_uploadStrategy.directWrite && m_unifiedMemory;
+	m_uploadStrategy.transferQueue = m_uploadStrategy.transferQueue && m_vkTransferQueue != VK_NULL_HANDLE;
+	m_unifiedMemory = m_uploadStrategy.directWrite;
+}
+
+void Engine::probeUploadStrategies()
+{
+	std::vector<char> payload(static_cast<size_t>(getProbePayloadSize()));
+
+	for (size_t i = 0; i < payload.size(); ++i)
+	{
+		payload[i] = static_cast<char>(i * 31);
+	}
+
+	const std::array<VkQueue, 2> queues = { m_vkGraphicsQueue, m_vkTransferQueue };
+	std::array<VkCommandPool, 2> commandPools = { VK_NULL_HANDLE, VK_NULL_HANDLE };
+
+	VkCommandPoolCreateInfo commandPoolCreateInfo = {};
+	commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	for (size_t i = 0; i < m_uploadQueueFamilies.size(); ++i)
+	{
+		commandPoolCreateInfo.queueFamilyIndex = m_uploadQueueFamilies[i];
+
+		VkResult result = vkCreateCommandPool(m_vkDevice, &commandPoolCreateInfo, m_vkAllocator, &commandPools[i]);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create probe command pool.");
+		}
+	}
+
+	const bool transferQueueAvailable = m_vkTransferQueue != VK_NULL_HANDLE;
+	m_graphicsSubmitLatency = measureSubmitLatency(commandPools[0], queues[0]);
+	m_transferSubmitLatency = transferQueueAvailable ? measureSubmitLatency(commandPools[1], queues[1]) : 0.0;
+	m_uploadMeasurements.clear();
+
+	UploadMeasurement fastest = {};
+	fastest.seconds = std::numeric_limits<double>::max();
+
+	for (const UploadStrategy& strategy : listStagedUploadStrategies(transferQueueAvailable))
+	{
+		// Staging and buffer sharing follow the strategy being measured.
+		m_uploadStrategy = strategy;
+		const size_t queue = strategy.transferQueue ? 1 : 0;
+		m_uploadMeasurements.push_back({ strategy, measureStagedUploads(commandPools[queue], queues[queue], payload) });
+
+		if (m_uploadMeasurements.back().seconds < fastest.seconds)
+		{
+			fastest = m_uploadMeasurements.back();
+		}
+	}
+
+	// Direct writes replace staging for geometry only, edits keep the fastest staged path.
+	if (m_unifiedMemory)
+	{
+		UploadStrategy strategy = fastest.strategy;
+		strategy.directWrite = true;
+		m_uploadMeasurements.push_back({ strategy, measureDirectWrites(payload) });
+
+		if (m_uploadMeasurements.back().seconds < fastest.seconds)
+		{
+			fastest = m_uploadMeasurements.back();
+		}
+	}
+
+	m_uploadStrategy = fastest.strategy;
+
+	for (size_t i = 0; i < m_uploadQueueFamilies.size(); ++i)
+	{
+		vkDestroyCommandPool(m_vkDevice, commandPools[i], m_vkAllocator);
+	}
+}
+
+double Engine::measureStagedUploads(VkCommandPool commandPool, VkQueue queue, const std::vector<char>& payload)
+{
+	VkBuffer destination;
+	VkDeviceMemory destinationMemory;
+	createBuffer(payload.size(), VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		&destination, &destinationMemory);
+
+	double fastest = std::numeric_limits<double>::max();
+
+	for (int repeat = 0; repeat < PROBE_REPEAT_COUNT; ++repeat)
+	{
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		VkDeviceSize offset = 0;
+
+		for (VkDeviceSize size : getProbeUploadSizes())
+		{
+			queueUpload(payload.data() + offset, size, destination, offset);
+			offset += size;
+		}
+
+		submitOneTimeCommands(commandPool, queue, [this](VkCommandBuffer commandBuffer)
+		{
+			recordPendingCopies(commandBuffer);
+		});
+
+		fastest = std::min(fastest,
+			std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+		// Every run pays for its own staging, as a frame would once the previous chunk filled up.
+		retireStagingChunk();
+		m_deletionQueue.flush();
+	}
+
+	m_deletionQueue.retire(m_frameNumber, destination, destinationMemory);
+	m_deletionQueue.flush();
+	return fastest;
+}
+
+double Engine::measureDirectWrites(const std::vector<char>& payload)
+{
+	VkBuffer buffer;
+	VkDeviceMemory memory;
+	createBuffer(payload.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, UNIFIED_MEMORY_PROPERTY_FLAGS, &buffer, &memory);
+
+	void* mappedMemory;
+	VkResult result = vkMapMemory(m_vkDevice, memory, 0, payload.size(), 0, &mappedMemory);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to map probe memory.");
+	}
+
+	double fastest = std::numeric_limits<double>::max();
+
+	for (int repeat = 0; repeat < PROBE_REPEAT_COUNT; ++repeat)
+	{
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		VkDeviceSize offset = 0;
+
+		for (VkDeviceSize size : getProbeUploadSizes())
+		{
+			memcpy(static_cast<char*>(mappedMemory) + offset, payload.data() + offset, size);
+			offset += size;
+		}
+
+		fastest = std::min(fastest,
+			std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+
+	vkUnmapMemory(m_vkDevice, memory);
+	m_deletionQueue.retire(m_frameNumber, buffer, memory);
+	m_deletionQueue.flush();
+	return fastest;
+}
+
+double Engine::measureSubmitLatency(VkCommandPool commandPool, VkQueue queue)
+{
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for (int submit = 0; submit < PROBE_LATENCY_SUBMIT_COUNT; ++submit)
+	{
+		submitOneTimeCommands(commandPool, queue, [](VkCommandBuffer) {});
+	}
+
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() /
+		PROBE_LATENCY_SUBMIT_COUNT;
+}
+
+void Engine::submitOneTimeCommands(VkCommandPool commandPool, VkQueue queue,
+	const std::function<void(VkCommandBuffer)>& record)
+{
+	VkCommandBufferAllocateInfo commandBufferInfo = {};
+	commandBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	commandBufferInfo.commandPool = commandPool;
+	commandBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	commandBufferInfo.commandBufferCount = 1;
+
+	VkCommandBuffer commandBuffer;
+	VkResult result = vkAllocateCommandBuffers(m_vkDevice, &commandBufferInfo, &commandBuffer);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate one-time command buffer.");
+	}
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	record(commandBuffer);
+	vkEndCommandBuffer(commandBuffer);
+
+	VkFenceCreateInfo fenceCreateInfo = {};
+	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+	VkFence fence;
+	result = vkCreateFence(m_vkDevice, &fenceCreateInfo, m_vkAllocator, &fence);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create one-time fence.");
+	}
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+
+	result = vkQueueSubmit(queue, 1, &submitInfo, fence);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to submit one-time commands.");
+	}
+
+	vkWaitForFences(m_vkDevice, 1, &fence, VK_TRUE, UINT64_MAX);
+	vkDestroyFence(m_vkDevice, fence, m_vkAllocator);
+	vkFreeCommandBuffers(m_vkDevice, commandPool, 1, &commandBuffer);
 }
 
 void Engine::createSwapChain()
@@ -155,6 +539,19 @@ void Engine::createSwapChain()
 	swapChainCreateInfo.imageArrayLayers = 1;
 	swapChainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 
+	// Capture copies images out as they are, so it only handles the common 8-bit four channel formats.
+	const bool capturableFormat = surfaceFormat.format == VK_FORMAT_B8G8R8A8_UNORM ||
+		surfaceFormat.format == VK_FORMAT_B8G8R8A8_SRGB || surfaceFormat.format == VK_FORMAT_R8G8B8A8_UNORM ||
+		surfaceFormat.format == VK_FORMAT_R8G8B8A8_SRGB;
+
+	m_captureFrames = m_captureFrames && capturableFormat &&
+		(supportDetails.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) != 0;
+
+	if (m_captureFrames)
+	{
+		swapChainCreateInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	}
+
 	QueueFamilyIndices queueFamilyIndices = findQueueFamilyIndices(m_vkPhysicalDevice);
 	std::vector<uint32_t> indices;
 	indices.push_back(queueFamilyIndices.graphics.value());
@@ -177,7 +574,7 @@ void Engine::createSwapChain()
 	swapChainCreateInfo.clipped = VK_TRUE;
 	swapChainCreateInfo.oldSwapchain = VK_NULL_HANDLE;
 
-	VkResult result = vkCreateSwapchainKHR(m_vkDevice, &swapChainCreateInfo, nullptr, &m_vkSwapchain);
+	VkResult result = vkCreateSwapchainKHR(m_vkDevice, &swapChainCreateInfo, m_vkAllocator, &m_vkSwapchain);
 
 	if (result != VK_SUCCESS)
 	{
@@ -215,7 +612,7 @@ void Engine::createSwapChainImageViews()
 	{
 		createInfo.image = m_vkSwapchainImages[i];
 
-		VkResult result = vkCreateImageView(m_vkDevice, &createInfo, nullptr, &m_vkSwapchainImageViews[i]);
+		VkResult result = vkCreateImageView(m_vkDevice, &createInfo, m_vkAllocator, &m_vkSwapchainImageViews[i]);
 		if (result != VK_SUCCESS)
 		{
 			throw std::runtime_error("Failed to create swap chain image view.");
@@ -225,52 +622,126 @@ void Engine::createSwapChainImageViews()
 
 void Engine::createRenderPass()
 {
-	VkAttachmentDescription colorAttachment = {};
+	m_vkDepthFormat = chooseDepthFormat();
+
+	// Attachments enter and leave in their render layouts, the frame graph transitions them around the pass.
+	std::array<VkAttachmentDescription, 2> attachments = {};
+
+	VkAttachmentDescription& colorAttachment = attachments[0];
 	colorAttachment.format = m_vkSwapchainImageFormat;
 	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
 	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
 	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentDescription& depthAttachment = attachments[1];
+	depthAttachment.format = m_vkDepthFormat;
+	depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	// Occlusion culling builds its depth pyramid from what the early phase leaves behind.
+	depthAttachment.storeOp = m_occlusionCulling ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
 	VkAttachmentReference colorAttachmentRef = {};
 	colorAttachmentRef.attachment = 0;
 	colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+	VkAttachmentReference depthAttachmentRef = {};
+	depthAttachmentRef.attachment = 1;
+	depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
 	VkSubpassDescription subpass = {};
 	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
 	subpass.colorAttachmentCount = 1;
 	subpass.pColorAttachments = &colorAttachmentRef;
-
-	VkSubpassDependency dependency = {};
-	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-	dependency.dstSubpass = 0;
-	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.srcAccessMask = 0;
-	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
 	VkRenderPassCreateInfo renderPassCreateInfo = {};
 	renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	renderPassCreateInfo.attachmentCount = 1;
-	renderPassCreateInfo.pAttachments = &colorAttachment;
+	renderPassCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+	renderPassCreateInfo.pAttachments = attachments.data();
 	renderPassCreateInfo.subpassCount = 1;
 	renderPassCreateInfo.pSubpasses = &subpass;
-	renderPassCreateInfo.dependencyCount = 1;
-	renderPassCreateInfo.pDependencies = &dependency;
 
-	VkResult result = vkCreateRenderPass(m_vkDevice, &renderPassCreateInfo, nullptr, &m_vkRenderPass);
+	VkResult result = vkCreateRenderPass(m_vkDevice, &renderPassCreateInfo, m_vkAllocator, &m_vkRenderPass);
 	if (result != VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to create render pass.");
 	}
+
+	if (m_occlusionCulling)
+	{
+		// The late phase draws on top of the early phase. Only the load and store operations differ,
+		// so the pass stays compatible with the framebuffers, pipelines and cached secondaries.
+		colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+		depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+		result = vkCreateRenderPass(m_vkDevice, &renderPassCreateInfo, m_vkAllocator, &m_vkLateRenderPass);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create late render pass.");
+		}
+	}
+}
+
+void Engine::createDescriptorSetLayout()
+{
+	std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+
+	bindings[0].binding = 0;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+	bindings[0].descriptorCount = 1;
+	bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+	bindings[1].binding = 1;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[1].descriptorCount = 1;
+	bindings[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+	VkDescriptorSetLayoutCreateInfo descriptorSetLayoutInfo = {};
+	descriptorSetLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	descriptorSetLayoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	descriptorSetLayoutInfo.pBindings = bindings.data();
+
+	VkResult result = vkCreateDescriptorSetLayout(m_vkDevice, &descriptorSetLayoutInfo, m_vkAllocator,
+		&m_vkDescriptorSetLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create descriptor set layout.");
+	}
+}
+
+void Engine::createPipelineLayout()
+{
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(FramePushConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &m_vkDescriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	VkResult result = vkCreatePipelineLayout(m_vkDevice, &pipelineLayoutInfo, m_vkAllocator, &m_vkPipelineLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create pipeline layout.");
+	}
 }
 
 void Engine::createGraphicsPipeline()
 {
-	VkShaderModule vertexShader = loadShader("vertex.spv");
+	VkShaderModule vertexShader = loadShader(m_vertexPulling ? "pulling.spv" : "vertex.spv");
 	VkShaderModule fragmentShader = loadShader("fragment.spv");
 
 	VkPipelineShaderStageCreateInfo vertexStageCreateInfo = {};
@@ -287,18 +758,30 @@ void Engine::createGraphicsPipeline()
 
 	VkPipelineShaderStageCreateInfo shaderStageInfos[] = { vertexStageCreateInfo, fragmentStageCreateInfo };
 
-	const VkVertexInputBindingDescription vertexBindingDesc =
+	const std::array<VkVertexInputBindingDescription, 2> vertexBindingDesc =
 		buildVertexBindingDescription();
 
-	const std::array<VkVertexInputAttributeDescription, 2> vertexAttributeDesc =
+	const std::array<VkVertexInputAttributeDescription, 3> vertexAttributeDesc =
 		buildVertexAttributeDescription();
 
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
 	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputInfo.pVertexBindingDescriptions = &vertexBindingDesc;
-	vertexInputInfo.vertexBindingDescriptionCount = 1;
-	vertexInputInfo.pVertexAttributeDescriptions = vertexAttributeDesc.data();
-	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(vertexAttributeDesc.size());
+
+	if (m_vertexPulling)
+	{
+		// Vertices are fetched from the storage buffer, only the object index stays fixed-function.
+		vertexInputInfo.pVertexBindingDescriptions = &vertexBindingDesc[1];
+		vertexInputInfo.vertexBindingDescriptionCount = 1;
+		vertexInputInfo.pVertexAttributeDescriptions = &vertexAttributeDesc[2];
+		vertexInputInfo.vertexAttributeDescriptionCount = 1;
+	}
+	else
+	{
+		vertexInputInfo.pVertexBindingDescriptions = vertexBindingDesc.data();
+		vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(vertexBindingDesc.size());
+		vertexInputInfo.pVertexAttributeDescriptions = vertexAttributeDesc.data();
+		vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(vertexAttributeDesc.size());
+	}
 
 	VkPipelineInputAssemblyStateCreateInfo inputAssemblyCreateInfo = {};
 	inputAssemblyCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
@@ -366,14 +849,13 @@ void Engine::createGraphicsPipeline()
 	colorBlendState.blendConstants[2] = 0.0f;
 	colorBlendState.blendConstants[3] = 0.0f;
 
-	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-
-	VkResult result = vkCreatePipelineLayout(m_vkDevice, &pipelineLayoutInfo, nullptr, &m_vkPipelineLayout);
-	if (result != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to create pipeline layout.");
-	}
+	VkPipelineDepthStencilStateCreateInfo depthStencilState = {};
+	depthStencilState.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depthStencilState.depthTestEnable = VK_TRUE;
+	depthStencilState.depthWriteEnable = VK_TRUE;
+	depthStencilState.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+	depthStencilState.depthBoundsTestEnable = VK_FALSE;
+	depthStencilState.stencilTestEnable = VK_FALSE;
 
 	VkGraphicsPipelineCreateInfo pipelineInfo = {};
 	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
@@ -384,7 +866,7 @@ void Engine::createGraphicsPipeline()
 	pipelineInfo.pViewportState = &viewportStateCreateInfo;
 	pipelineInfo.pRasterizationState = &rasterizationStateCreateInfo;
 	pipelineInfo.pMultisampleState = &multisamplingStateCreateInfo;
-	pipelineInfo.pDepthStencilState = nullptr;
+	pipelineInfo.pDepthStencilState = &depthStencilState;
 	pipelineInfo.pColorBlendState = &colorBlendState;
 	pipelineInfo.pDynamicState = nullptr;
 	pipelineInfo.layout = m_vkPipelineLayout;
@@ -393,61 +875,219 @@ void Engine::createGraphicsPipeline()
 	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 	pipelineInfo.basePipelineIndex = -1;
 
-	result = vkCreateGraphicsPipelines(m_vkDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_vkPipeline);
+	VkResult result = vkCreateGraphicsPipelines(m_vkDevice, VK_NULL_HANDLE, 1, &pipelineInfo, m_vkAllocator,
+		&m_vkPipeline);
 	if (result != VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to create graphics pipeline.");
 	}
 
-	vkDestroyShaderModule(m_vkDevice, vertexShader, nullptr);
-	vkDestroyShaderModule(m_vkDevice, fragmentShader, nullptr);
+	vkDestroyShaderModule(m_vkDevice, vertexShader, m_vkAllocator);
+	vkDestroyShaderModule(m_vkDevice, fragmentShader, m_vkAllocator);
 }
 
-void Engine::createFramebuffers()
+void Engine::createFrameGraph()
 {
-	m_vkSwapchainFramebuffers.resize(m_vkSwapchainImageViews.size());
+	m_frameGraph.init(m_vkDevice, m_vkPhysicalDevice, m_vkAllocator, &m_memoryBudget);
+
+	// Uploads and deformation touch buffers all over the pool, one global resource stands for them.
+	m_geometryResource = m_frameGraph.importBuffer("geometry");
+	m_indirectResource = m_frameGraph.importBuffer("indirect draws");
+	m_swapchainResource = m_frameGraph.importImage("swapchain", VK_IMAGE_ASPECT_COLOR_BIT);
+	m_depthResource = m_frameGraph.createTransientImage("depth", m_vkDepthFormat, m_vkSwapchainExtent,
+		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | (m_occlusionCulling ? VK_IMAGE_USAGE_SAMPLED_BIT : 0),
+		VK_IMAGE_ASPECT_DEPTH_BIT);
+	m_frameGraph.markOutput(m_swapchainResource);
+
+	if (m_occlusionCulling)
+	{
+		m_lateIndirectResource = m_frameGraph.importBuffer("late indirect draws");
+		m_visibilityResource = m_frameGraph.importBuffer("visibility");
+		// The pyramid lives as long as the engine, so it is bound once and keeps its state across frames.
+		m_depthPyramidResource = m_frameGraph.importImage("depth pyramid", VK_IMAGE_ASPECT_COLOR_BIT);
+		m_frameGraph.bindImage(m_depthPyramidResource, m_vkDepthPyramidImage, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+	}
 
-	VkFramebufferCreateInfo framebufferCreateInfo = {};
-	framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-	framebufferCreateInfo.renderPass = m_vkRenderPass;
-	framebufferCreateInfo.attachmentCount = 1;
-	framebufferCreateInfo.width = m_vkSwapchainExtent.width;
-	framebufferCreateInfo.height = m_vkSwapchainExtent.height;
-	framebufferCreateInfo.layers = 1;
+	m_uploadPass = m_frameGraph.addPass("upload", [this](VkCommandBuffer commandBuffer)
+	{
+		recordPendingCopies(commandBuffer);
+	});
+	m_frameGraph.write(m_uploadPass, m_geometryResource, { VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED });
 
-	for (int i = 0; i < m_vkSwapchainImageViews.size(); ++i)
+	if (m_vertexDeformation)
 	{
-		VkImageView attachments[] = {
-			m_vkSwapchainImageViews[i]
-		};
+		const uint32_t deformPass = m_frameGraph.addPass("deform", [this](VkCommandBuffer commandBuffer)
+		{
+			recordDeformCommands(commandBuffer);
+		});
+		m_frameGraph.read(deformPass, m_geometryResource, { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED });
+		m_frameGraph.write(deformPass, m_geometryResource, { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED });
+	}
 
-		framebufferCreateInfo.pAttachments = attachments;
+	if (m_gpuDrivenCulling)
+	{
+		const uint32_t cullPass = m_frameGraph.addPass(m_occlusionCulling ? "early cull" : "cull",
+			[this](VkCommandBuffer commandBuffer)
+		{
+			recordCullCommands(commandBuffer, m_currentImage, false);
+		});
+		m_frameGraph.write(cullPass, m_indirectResource, { VK_PIPELINE_STAGE_TRANSFER_BIT |
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT |
+			VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED });
 
-		VkResult result = vkCreateFramebuffer(m_vkDevice, &framebufferCreateInfo, nullptr, &m_vkSwapchainFramebuffers[i]);
-		if (result != VK_SUCCESS)
+		if (m_occlusionCulling)
 		{
-			throw std::runtime_error("Failed to create swap chain frame buffer.");
+			// The early phase only reads last frame's visibility, but clears it on first use. The pyramid
+			// is not sampled yet, it is still bound and has to be in the layout its descriptor names.
+			m_frameGraph.write(cullPass, m_visibilityResource, { VK_PIPELINE_STAGE_TRANSFER_BIT |
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT,
+				VK_IMAGE_LAYOUT_UNDEFINED });
+			m_frameGraph.read(cullPass, m_depthPyramidResource, { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL });
 		}
 	}
-}
-
-void Engine::createBuffer(VkDeviceSize size, VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags propertyFlags,
-	VkBuffer* outBuffer, VkDeviceMemory* outDeviceMemory)
-{
-	VkBufferCreateInfo bufferCreateInfo = {};
-	bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	bufferCreateInfo.size = size;
-	bufferCreateInfo.usage = usageFlags;
-	bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-	VkResult result = vkCreateBuffer(m_vkDevice, &bufferCreateInfo, nullptr, outBuffer);
-	if (result != VK_SUCCESS)
+	auto declareDrawAccesses = [this](uint32_t drawPass, uint32_t indirectResource)
 	{
-		throw std::runtime_error("Failed to create vertex buffer.");
-	}
+		m_frameGraph.read(drawPass, m_geometryResource, { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+			VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT |
+			VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED });
 
-	VkMemoryRequirements vertexBufferMemRequirements;
-	vkGetBufferMemoryRequirements(m_vkDevice, *outBuffer, &vertexBufferMemRequirements);
+		if (m_gpuDrivenCulling)
+		{
+			m_frameGraph.read(drawPass, indirectResource, { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+				VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED });
+		}
+
+		m_frameGraph.write(drawPass, m_swapchainResource, { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+			VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
+		m_frameGraph.write(drawPass, m_depthResource, { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+			VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL });
+	};
+
+	const uint32_t drawPass = m_frameGraph.addPass(m_occlusionCulling ? "early draw" : "draw",
+		[this](VkCommandBuffer commandBuffer)
+	{
+		recordRenderPass(commandBuffer, m_currentImage, false);
+	});
+	declareDrawAccesses(drawPass, m_indirectResource);
+
+	if (m_occlusionCulling)
+	{
+		const uint32_t pyramidPass = m_frameGraph.addPass("depth pyramid", [this](VkCommandBuffer commandBuffer)
+		{
+			recordDepthPyramid(commandBuffer);
+		});
+		m_frameGraph.read(pyramidPass, m_depthResource, { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL });
+		m_frameGraph.write(pyramidPass, m_depthPyramidResource, { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL });
+
+		const uint32_t lateCullPass = m_frameGraph.addPass("late cull", [this](VkCommandBuffer commandBuffer)
+		{
+			recordCullCommands(commandBuffer, m_currentImage, true);
+		});
+		m_frameGraph.read(lateCullPass, m_depthPyramidResource, { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL });
+		m_frameGraph.write(lateCullPass, m_visibilityResource, { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED });
+		m_frameGraph.write(lateCullPass, m_lateIndirectResource, { VK_PIPELINE_STAGE_TRANSFER_BIT |
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT |
+			VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED });
+
+		const uint32_t lateDrawPass = m_frameGraph.addPass("late draw", [this](VkCommandBuffer commandBuffer)
+		{
+			recordRenderPass(commandBuffer, m_currentImage, true);
+		});
+		declareDrawAccesses(lateDrawPass, m_lateIndirectResource);
+	}
+
+	if (m_captureFrames)
+	{
+		// Enabled only for frames that find a free readback buffer.
+		m_capturePass = m_frameGraph.addPass("capture", [this](VkCommandBuffer commandBuffer)
+		{
+			recordCapture(commandBuffer);
+		});
+		m_frameGraph.read(m_capturePass, m_swapchainResource, { VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL });
+	}
+
+	// Records nothing, it only moves the swapchain image into the layout presentation expects.
+	const uint32_t presentPass = m_frameGraph.addPass("present", nullptr);
+	m_frameGraph.read(presentPass, m_swapchainResource, { VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+		VK_IMAGE_LAYOUT_PRESENT_SRC_KHR });
+
+	m_frameGraph.compile();
+}
+
+void Engine::createFramebuffers()
+{
+	m_vkSwapchainFramebuffers.resize(m_vkSwapchainImageViews.size());
+
+	VkFramebufferCreateInfo framebufferCreateInfo = {};
+	framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferCreateInfo.renderPass = m_vkRenderPass;
+	framebufferCreateInfo.attachmentCount = 2;
+	framebufferCreateInfo.width = m_vkSwapchainExtent.width;
+	framebufferCreateInfo.height = m_vkSwapchainExtent.height;
+	framebufferCreateInfo.layers = 1;
+
+	for (int i = 0; i < m_vkSwapchainImageViews.size(); ++i)
+	{
+		VkImageView attachments[] = {
+			m_vkSwapchainImageViews[i],
+			m_frameGraph.getImageView(m_depthResource)
+		};
+
+		framebufferCreateInfo.pAttachments = attachments;
+
+		VkResult result = vkCreateFramebuffer(m_vkDevice, &framebufferCreateInfo, m_vkAllocator, &m_vkSwapchainFramebuffers[i]);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create swap chain frame buffer.");
+		}
+	}
+}
+
+void Engine::createBuffer(VkDeviceSize size, VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags propertyFlags,
+	VkBuffer* outBuffer, VkDeviceMemory* outDeviceMemory)
+{
+	createBuffer(size, usageFlags, propertyFlags, m_vkAllocator, outBuffer, outDeviceMemory);
+}
+
+void Engine::createBuffer(VkDeviceSize size, VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags propertyFlags,
+	const VkAllocationCallbacks* allocator, VkBuffer* outBuffer, VkDeviceMemory* outDeviceMemory)
+{
+	VkBufferCreateInfo bufferCreateInfo = {};
+	bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferCreateInfo.size = size;
+	bufferCreateInfo.usage = usageFlags;
+	bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	// Buffers the transfer queue copies from or into are also used on the graphics queue, sharing them saves
+	// transferring their ownership back and forth.
+	if (m_uploadStrategy.transferQueue &&
+		(usageFlags & (VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT)) != 0)
+	{
+		bufferCreateInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		bufferCreateInfo.queueFamilyIndexCount = static_cast<uint32_t>(m_uploadQueueFamilies.size());
+		bufferCreateInfo.pQueueFamilyIndices = m_uploadQueueFamilies.data();
+	}
+
+	VkResult result = vkCreateBuffer(m_vkDevice, &bufferCreateInfo, allocator, outBuffer);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create vertex buffer.");
+	}
+
+	VkMemoryRequirements vertexBufferMemRequirements;
+	vkGetBufferMemoryRequirements(m_vkDevice, *outBuffer, &vertexBufferMemRequirements);
 
 	VkMemoryAllocateInfo memoryAllocateInfo = {};
 	memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
@@ -455,491 +1095,2966 @@ void Engine::createBuffer(VkDeviceSize size, VkBufferUsageFlags usageFlags, VkMe
 	memoryAllocateInfo.memoryTypeIndex = findMemoryType(vertexBufferMemRequirements.memoryTypeBits,
 		propertyFlags);
 
-	result = vkAllocateMemory(m_vkDevice, &memoryAllocateInfo, nullptr, outDeviceMemory);
+	// Drop cached geometry before the heap runs out instead of letting the driver fail. Evicted memory is
+	// only released once the frames in flight are done with it, so the budget doesn't change here and
+	// evicting stops as soon as the pending releases cover the request.
+	VkDeviceSize evictedBytes = 0;
+
+	while (!m_memoryBudget.fits(memoryAllocateInfo.memoryTypeIndex, memoryAllocateInfo.allocationSize) &&
+		evictedBytes < memoryAllocateInfo.allocationSize)
+	{
+		const VkDeviceSize releasedBytes = evictGeometry();
+
+		if (releasedBytes == 0)
+		{
+			break;
+		}
+
+		evictedBytes += releasedBytes;
+	}
+
+	result = vkAllocateMemory(m_vkDevice, &memoryAllocateInfo, allocator, outDeviceMemory);
+
+	while ((result == VK_ERROR_OUT_OF_DEVICE_MEMORY || result == VK_ERROR_OUT_OF_HOST_MEMORY) &&
+		evictedBytes < memoryAllocateInfo.allocationSize)
+	{
+		const VkDeviceSize releasedBytes = evictGeometry();
+
+		if (releasedBytes == 0)
+		{
+			break;
+		}
+
+		evictedBytes += releasedBytes;
+		result = vkAllocateMemory(m_vkDevice, &memoryAllocateInfo, allocator, outDeviceMemory);
+	}
+
 	if (result != VK_SUCCESS)
 	{
+		vkDestroyBuffer(m_vkDevice, *outBuffer, allocator);
 		throw std::runtime_error("Failed to allocate buffer memory.");
 	}
 
+	m_memoryBudget.track(*outDeviceMemory, memoryAllocateInfo.memoryTypeIndex, memoryAllocateInfo.allocationSize);
+
 	vkBindBufferMemory(m_vkDevice, *outBuffer, *outDeviceMemory, 0);
 }
 
-void Engine::copyBuffer(VkDeviceSize size, VkBuffer srcBuffer, VkBuffer dstBuffer)
+VkDeviceSize Engine::evictGeometry()
 {
-	VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
-	commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	commandBufferAllocateInfo.commandBufferCount = 1;
-	commandBufferAllocateInfo.commandPool = m_vkCommandPool;
-	commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	CachedGeometry* leastRecentlyUsed = nullptr;
 
-	VkCommandBuffer commandBuffer;
-	vkAllocateCommandBuffers(m_vkDevice, &commandBufferAllocateInfo, &commandBuffer);
+	for (std::pair<const uint32_t, CachedGeometry>& cached : m_geometryCache)
+	{
+		CachedGeometry& geometry = cached.second;
 
-	VkCommandBufferBeginInfo commandBufferBeginInfo = {};
-	commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		if (geometry.vertexAllocation != INVALID_GEOMETRY_ALLOCATION &&
+			(leastRecentlyUsed == nullptr || geometry.lastUsedFrame < leastRecentlyUsed->lastUsedFrame))
+		{
+			leastRecentlyUsed = &geometry;
+		}
+	}
 
-	vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo);
-	
-	VkBufferCopy copyRegion = {};
-	copyRegion.size = size;
+	if (leastRecentlyUsed == nullptr)
+	{
+		return 0;
+	}
 
-	vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-	vkEndCommandBuffer(commandBuffer);
+	const VkDeviceSize releasedBytes = m_geometryPool.getSize(leastRecentlyUsed->vertexAllocation) +
+		m_geometryPool.getSize(leastRecentlyUsed->indexAllocation) +
+		m_geometryPool.getSize(leastRecentlyUsed->meshletAllocation);
 
-	VkSubmitInfo submitInfo = {};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
+	m_geometryPool.free(leastRecentlyUsed->vertexAllocation, leastRecentlyUsed->lastUsedFrame);
+	m_geometryPool.free(leastRecentlyUsed->indexAllocation, leastRecentlyUsed->lastUsedFrame);
+	m_geometryPool.free(leastRecentlyUsed->meshletAllocation, leastRecentlyUsed->lastUsedFrame);
+	leastRecentlyUsed->vertexAllocation = INVALID_GEOMETRY_ALLOCATION;
+	leastRecentlyUsed->indexAllocation = INVALID_GEOMETRY_ALLOCATION;
+	leastRecentlyUsed->meshletAllocation = INVALID_GEOMETRY_ALLOCATION;
 
-	vkQueueSubmit(m_vkGraphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-	vkQueueWaitIdle(m_vkGraphicsQueue);
-	vkFreeCommandBuffers(m_vkDevice, m_vkCommandPool, 1, &commandBuffer);
+	releaseEmptyGeometryBlocks();
+	return releasedBytes;
 }
 
-void Engine::createVertexBuffer()
+void Engine::releaseEmptyGeometryBlocks()
 {
-	m_vertices.resize(4);
+	for (const GeometryBlockHandles& block : m_geometryPool.releaseEmptyBlocks())
+	{
+		m_deletionQueue.retire(m_frameNumber, block.buffer, block.memory);
+	}
+}
 
-	m_vertices[0].color = { 1.0f, 0.0f, 0.0f };
-	m_vertices[0].position = { -0.5f, -0.5f, 0.0f };
-	
-	m_vertices[1].color = { 0.0f, 1.0f, 0.0f };
-	m_vertices[1].position = { 0.5f, -0.5f, 0.0f };
-	
-	m_vertices[2].color = { 0.0f, 0.0f, 1.0f };
-	m_vertices[2].position = { 0.5f, 0.5f, 0.0f };
+void Engine::compactGeometry()
+{
+	releaseEmptyGeometryBlocks();
 
-	m_vertices[3].color = { 1.0f, 0.0f, 1.0f };
-	m_vertices[3].position = { -0.5f, 0.5f, 0.0f };
+	// Moved allocations keep their ids, only the descriptors of the displayed mesh need rewriting.
+	for (const GeometryMove& move : m_geometryPool.defragment(DEFRAGMENT_BYTES_PER_FRAME, m_frameNumber))
+	{
+		m_pendingMoves.push_back({ move.sourceBuffer, move.sourceOffset, move.destinationBuffer,
+			move.destinationOffset, move.size });
 
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingMemory;
+		if (move.allocation == m_vertexAllocation || move.allocation == m_indexAllocation ||
+			move.allocation == m_meshletAllocation)
+		{
+			++m_meshVersion;
+		}
+	}
+}
 
-	const VkDeviceSize bufferSize = sizeof(Vertex) * m_vertices.size();
-	const VkBufferUsageFlags stagingBufferUsageFlags = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-	const VkMemoryPropertyFlags stagingMemPropertyFlags = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+void Engine::flushGeometryUpdates()
+{
+	if (m_dirtyVertexRanges.empty() && m_dirtyIndexRanges.empty())
+	{
+		return;
+	}
 
-	createBuffer(bufferSize, stagingBufferUsageFlags, stagingMemPropertyFlags,
-		&stagingBuffer, &stagingMemory);
+	const std::array<const DirtyRanges*, 2> dirtyRanges = { &m_dirtyVertexRanges, &m_dirtyIndexRanges };
+	const std::array<const char*, 2> sources = {
+		reinterpret_cast<const char*>(m_vertices.data()),
+		reinterpret_cast<const char*>(m_indices.data())
+	};
+	const std::array<uint32_t, 2> allocations = { m_vertexAllocation, m_indexAllocation };
 
-	void* mappedMemory;
-	VkResult result = vkMapMemory(m_vkDevice, stagingMemory, 0, bufferSize, 0, &mappedMemory);
-	if (result != VK_SUCCESS)
+	// Tiny ranges are embedded in the command buffer, the rest share one staging buffer.
+	VkDeviceSize stagingSize = 0;
+	for (const DirtyRanges* ranges : dirtyRanges)
 	{
-		throw std::runtime_error("Failed to map vertex memory.");
+		for (const ByteRange& range : ranges->getRanges())
+		{
+			if (range.size > INLINE_UPDATE_MAX_SIZE)
+			{
+				stagingSize += range.size;
+			}
+		}
 	}
 
-	memcpy(mappedMemory, m_vertices.data(), bufferSize);
-	vkUnmapMemory(m_vkDevice, stagingMemory);
+	VkBuffer stagingBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory stagingMemory = VK_NULL_HANDLE;
+	char* stagingData = nullptr;
+
+	if (stagingSize > 0)
+	{
+		const VkMemoryPropertyFlags stagingMemPropertyFlags = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+
+		createBuffer(stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, stagingMemPropertyFlags,
+			m_hostAllocator.getCallbacks(HostArena::Frame), &stagingBuffer, &stagingMemory);
+
+		VkResult result = vkMapMemory(m_vkDevice, stagingMemory, 0, stagingSize, 0,
+			reinterpret_cast<void**>(&stagingData));
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to map staging memory.");
+		}
+	}
+
+	VkDeviceSize stagingOffset = 0;
+
+	for (size_t i = 0; i < dirtyRanges.size(); ++i)
+	{
+		const VkBuffer destination = m_geometryPool.getBuffer(allocations[i]);
+		const VkDeviceSize allocationOffset = m_geometryPool.getOffset(allocations[i]);
+
+		for (const ByteRange& range : dirtyRanges[i]->getRanges())
+		{
+			const char* data = sources[i] + range.offset;
+
+			if (range.size <= INLINE_UPDATE_MAX_SIZE)
+			{
+				m_pendingUpdates.push_back({ destination, allocationOffset + range.offset,
+					std::vector<char>(data, data + range.size) });
+				continue;
+			}
+
+			memcpy(stagingData + stagingOffset, data, range.size);
+			m_pendingCopies.push_back({ stagingBuffer, stagingOffset, destination, allocationOffset + range.offset,
+				range.size });
+			stagingOffset += range.size;
+		}
+	}
+
+	if (stagingBuffer != VK_NULL_HANDLE)
+	{
+		vkUnmapMemory(m_vkDevice, stagingMemory);
+		m_deletionQueue.retire(m_frameNumber, stagingBuffer, stagingMemory);
+	}
+
+	// Edits keep every meshlet's index range, only its bounds change.
+	if (m_clusterCulling)
+	{
+		refreshMeshletBounds(m_vertices, m_indices, &m_mesh);
+		queueUpload(m_mesh.meshlets.data(), sizeof(Meshlet) * m_mesh.meshlets.size(),
+			m_geometryPool.getBuffer(m_meshletAllocation), m_geometryPool.getOffset(m_meshletAllocation));
+	}
 
-	const VkBufferUsageFlags vertexBufferUsageFlags = VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-	const VkMemoryPropertyFlags vertexMemPropertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	m_dirtyVertexRanges.clear();
+	m_dirtyIndexRanges.clear();
+	m_pendingLiveCopies = true;
+}
 
-	createBuffer(bufferSize, vertexBufferUsageFlags, vertexMemPropertyFlags, &m_vkVertexBuffer,
-		&m_vkVertexDeviceMemory);
+void Engine::createMesh()
+{
+	buildGridMesh(m_meshGridSize, &m_vertices, &m_indices);
+	m_mesh = buildMeshLods(m_vertices, m_indices, MAX_LOD_COUNT);
+	buildMeshlets(m_vertices, m_indices, &m_mesh, MESHLET_MAX_VERTICES, MESHLET_MAX_TRIANGLES);
+	m_encodedVertices.clear();
+	m_encodedIndices.clear();
+	m_geometryDecoded = true;
+}
 
-	copyBuffer(bufferSize, stagingBuffer, m_vkVertexBuffer);
+void Engine::decodeGeometry()
+{
+	if (m_geometryDecoded)
+	{
+		return;
+	}
 
-	vkDestroyBuffer(m_vkDevice, stagingBuffer, nullptr);
-	vkFreeMemory(m_vkDevice, stagingMemory, nullptr);
+	m_vertices.resize(getDecodedSize(m_encodedVertices) / sizeof(Vertex));
+	m_indices.resize(getDecodedSize(m_encodedIndices) / sizeof(uint32_t));
+	decodeWords(m_codecInstructionSet, m_encodedVertices, reinterpret_cast<uint32_t*>(m_vertices.data()));
+	decodeWords(m_codecInstructionSet, m_encodedIndices, m_indices.data());
+	m_geometryDecoded = true;
 }
 
-void Engine::createIndexBuffer()
+void Engine::queueUpload(const void* data, VkDeviceSize size, VkBuffer destination, VkDeviceSize destinationOffset)
+{
+	queueUpload(size, [data, size](void* mappedMemory)
+	{
+		memcpy(mappedMemory, data, size);
+	}, destination, destinationOffset);
+}
+
+void Engine::queueUpload(VkDeviceSize size, const std::function<void(void*)>& write, VkBuffer destination,
+	VkDeviceSize destinationOffset)
 {
-	m_indices = { 0, 1, 2, 0, 2, 3 };
 	VkBuffer stagingBuffer;
 	VkDeviceMemory stagingMemory;
 
-	const VkDeviceSize bufferSize = sizeof(uint32_t) * m_indices.size();
 	const VkBufferUsageFlags stagingBufferUsageFlags = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
 	const VkMemoryPropertyFlags stagingMemPropertyFlags = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
 		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+	const VkDeviceSize chunkSize = m_uploadStrategy.stagingChunkSize;
+
+	// Small uploads are packed into a shared chunk, which saves an allocation each and lets their copies batch.
+	if (chunkSize > 0 && size <= chunkSize)
+	{
+		if (m_stagingChunk.buffer == VK_NULL_HANDLE || m_stagingChunk.used + size > chunkSize)
+		{
+			retireStagingChunk();
+
+			// A chunk outlives the frame that opened it until it is full.
+			createBuffer(chunkSize, stagingBufferUsageFlags, stagingMemPropertyFlags,
+				m_hostAllocator.getCallbacks(HostArena::Object), &m_stagingChunk.buffer, &m_stagingChunk.memory);
+
+			VkResult result = vkMapMemory(m_vkDevice, m_stagingChunk.memory, 0, chunkSize, 0,
+				&m_stagingChunk.mappedMemory);
+			if (result != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to map staging memory.");
+			}
+		}
+
+		write(static_cast<char*>(m_stagingChunk.mappedMemory) + m_stagingChunk.used);
+		m_pendingCopies.push_back({ m_stagingChunk.buffer, m_stagingChunk.used, destination, destinationOffset, size });
+		m_stagingChunk.used += size;
+		return;
+	}
 
-	createBuffer(bufferSize, stagingBufferUsageFlags, stagingMemPropertyFlags,
+	// Staging buffers only live until their copy completes.
+	createBuffer(size, stagingBufferUsageFlags, stagingMemPropertyFlags, m_hostAllocator.getCallbacks(HostArena::Frame),
 		&stagingBuffer, &stagingMemory);
 
 	void* mappedMemory;
-	VkResult result = vkMapMemory(m_vkDevice, stagingMemory, 0, bufferSize, 0, &mappedMemory);
+	VkResult result = vkMapMemory(m_vkDevice, stagingMemory, 0, size, 0, &mappedMemory);
 	if (result != VK_SUCCESS)
 	{
-		throw std::runtime_error("Failed to map index memory.");
+		throw std::runtime_error("Failed to map staging memory.");
 	}
 
-	memcpy(mappedMemory, m_indices.data(), bufferSize);
+	write(mappedMemory);
 	vkUnmapMemory(m_vkDevice, stagingMemory);
 
-	const VkBufferUsageFlags indexBufferUsageFlags = VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-		VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
-	const VkMemoryPropertyFlags indexMemPropertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
-
-	createBuffer(bufferSize, indexBufferUsageFlags, indexMemPropertyFlags, &m_vkIndexBuffer,
-		&m_vkIndexDeviceMemory);
+	// The copy is recorded at the start of the next frame, which also keeps the staging buffer alive.
+	m_pendingCopies.push_back({ stagingBuffer, 0, destination, destinationOffset, size });
+	m_deletionQueue.retire(m_frameNumber, stagingBuffer, stagingMemory);
+}
 
-	copyBuffer(bufferSize, stagingBuffer, m_vkIndexBuffer);
+void Engine::retireStagingChunk()
+{
+	if (m_stagingChunk.buffer == VK_NULL_HANDLE)
+	{
+		return;
+	}
 
-	vkDestroyBuffer(m_vkDevice, stagingBuffer, nullptr);
-	vkFreeMemory(m_vkDevice, stagingMemory, nullptr);
+	// Copies out of it were recorded this frame at the latest.
+	vkUnmapMemory(m_vkDevice, m_stagingChunk.memory);
+	m_deletionQueue.retire(m_frameNumber, m_stagingChunk.buffer, m_stagingChunk.memory);
+	m_stagingChunk = {};
 }
 
-void Engine::createCommandPool()
+bool Engine::submitTransfers()
 {
-	QueueFamilyIndices queueFamilyIndices = findQueueFamilyIndices(m_vkPhysicalDevice);
+	// Edits write allocations that earlier frames may still read, and the transfer queue doesn't wait for those
+	// frames, while the graphics queue orders them behind its own work. Vulkan 1.0 transfer queues also can't
+	// update buffers inline, and splitting a frame's uploads would reorder them.
+	if (m_pendingLiveCopies || !m_pendingUpdates.empty() || (m_pendingCopies.empty() && m_pendingMoves.empty()))
+	{
+		return false;
+	}
 
-	VkCommandPoolCreateInfo commandPoolCreateInfo = {};
-	commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-	commandPoolCreateInfo.queueFamilyIndex = queueFamilyIndices.graphics.value();
+	VkCommandBuffer commandBuffer = m_vkTransferCommandBuffers[m_currentFrame];
+	vkResetCommandBuffer(commandBuffer, 0);
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	recordPendingCopies(commandBuffer);
+	vkEndCommandBuffer(commandBuffer);
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &m_vkTransferFinishedSemaphores[m_currentFrame];
 
-	VkResult result = vkCreateCommandPool(m_vkDevice, &commandPoolCreateInfo, nullptr, &m_vkCommandPool);
+	VkResult result = vkQueueSubmit(m_vkTransferQueue, 1, &submitInfo, VK_NULL_HANDLE);
 	if (result != VK_SUCCESS)
 	{
-		throw std::runtime_error("Failed to create command pool.");
+		throw std::runtime_error("Failed to submit transfers.");
 	}
+
+	return true;
 }
 
-void Engine::createCommandBuffers()
+void Engine::writeMemory(VkDeviceMemory memory, const void* data, VkDeviceSize size)
 {
-	m_vkCommandBuffers.resize(m_vkSwapchainFramebuffers.size());
+	void* mappedMemory;
+	VkResult result = vkMapMemory(m_vkDevice, memory, 0, size, 0, &mappedMemory);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to map buffer memory.");
+	}
 
-	VkCommandBufferAllocateInfo commandBufferInfo = {};
-	commandBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	commandBufferInfo.commandPool = m_vkCommandPool;
-	commandBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	commandBufferInfo.commandBufferCount = static_cast<uint32_t>(m_vkCommandBuffers.size());
+	memcpy(mappedMemory, data, size);
+	vkUnmapMemory(m_vkDevice, memory);
+}
 
-	VkResult result = vkAllocateCommandBuffers(m_vkDevice, &commandBufferInfo, m_vkCommandBuffers.data());
-	if (result != VK_SUCCESS)
+void Engine::createDeviceLocalBuffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usageFlags,
+	VkBuffer* outBuffer, VkDeviceMemory* outDeviceMemory)
+{
+	if (m_unifiedMemory)
 	{
-		throw std::runtime_error("Failed to allocate command buffers.");
+		createBuffer(size, usageFlags, UNIFIED_MEMORY_PROPERTY_FLAGS, outBuffer, outDeviceMemory);
+		writeMemory(*outDeviceMemory, data, size);
+		return;
 	}
 
-	for (size_t i = 0; i < m_vkCommandBuffers.size(); ++i)
+	createBuffer(size, usageFlags | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		outBuffer, outDeviceMemory);
+
+	queueUpload(data, size, *outBuffer, 0);
+}
+
+uint32_t Engine::uploadGeometry(const void* data, VkDeviceSize size)
+{
+	return uploadGeometry(size, [data, size](void* mappedMemory)
 	{
-		VkCommandBufferBeginInfo beginInfo = {};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		
-		result = vkBeginCommandBuffer(m_vkCommandBuffers[i], &beginInfo);
-		if (result != VK_SUCCESS)
-		{
-			throw std::runtime_error("Failed to begin command buffer.");
-		}
+		memcpy(mappedMemory, data, size);
+	});
+}
 
-		VkRenderPassBeginInfo renderPassInfo = {};
-		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		renderPassInfo.renderPass = m_vkRenderPass;
-		renderPassInfo.framebuffer = m_vkSwapchainFramebuffers[i];
-		renderPassInfo.renderArea.offset = { 0, 0 };
-		renderPassInfo.renderArea.extent = m_vkSwapchainExtent;
+uint32_t Engine::uploadGeometry(VkDeviceSize size, const std::function<void(void*)>& write)
+{
+	const uint32_t allocation = allocateGeometry(size);
 
-		VkClearValue clearValue = { 0.0f, 0.0f, 0.0f, 1.0f };
+	// Ranges are only handed out again after the GPU finished with them, so they can be written right away.
+	void* mappedMemory = m_geometryPool.getMappedMemory(allocation);
 
-		renderPassInfo.clearValueCount = 1;
-		renderPassInfo.pClearValues = &clearValue;
+	if (mappedMemory != nullptr)
+	{
+		write(mappedMemory);
+	}
+	else
+	{
+		queueUpload(size, write, m_geometryPool.getBuffer(allocation), m_geometryPool.getOffset(allocation));
+	}
 
-		vkCmdBeginRenderPass(m_vkCommandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-		vkCmdBindPipeline(m_vkCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, m_vkPipeline);
+	return allocation;
+}
 
-		VkBuffer buffers[] = { m_vkVertexBuffer };
-		VkDeviceSize bufferOffsets[] = { 0 };
-		vkCmdBindVertexBuffers(m_vkCommandBuffers[i], 0, 1, buffers, bufferOffsets);
+uint32_t Engine::allocateGeometry(VkDeviceSize size)
+{
+	uint32_t allocation = m_geometryPool.allocate(size);
 
-		vkCmdBindIndexBuffer(m_vkCommandBuffers[i], m_vkIndexBuffer, 0, VK_INDEX_TYPE_UINT32);
+	if (allocation == INVALID_GEOMETRY_ALLOCATION)
+	{
+		const VkDeviceSize blockSize = std::max(GEOMETRY_BLOCK_SIZE, m_geometryPool.alignSize(size));
+		const VkMemoryPropertyFlags blockMemPropertyFlags = m_unifiedMemory ? UNIFIED_MEMORY_PROPERTY_FLAGS :
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
 
-		vkCmdDrawIndexed(m_vkCommandBuffers[i], static_cast<uint32_t>(m_indices.size()), 1, 0, 0, 0);
-		vkCmdEndRenderPass(m_vkCommandBuffers[i]);
+		VkBuffer blockBuffer;
+		VkDeviceMemory blockMemory;
+		createBuffer(blockSize, GEOMETRY_BLOCK_USAGE_FLAGS, blockMemPropertyFlags, &blockBuffer, &blockMemory);
 
-		result = vkEndCommandBuffer(m_vkCommandBuffers[i]);
-		if (result != VK_SUCCESS)
+		// Unified blocks stay mapped for their whole life, freeing the memory unmaps them.
+		void* blockMappedMemory = nullptr;
+		if (m_unifiedMemory)
 		{
-			throw std::runtime_error("Failed to record command buffer.");
+			VkResult result = vkMapMemory(m_vkDevice, blockMemory, 0, blockSize, 0, &blockMappedMemory);
+			if (result != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to map geometry block memory.");
+			}
 		}
+
+		m_geometryPool.addBlock(blockBuffer, blockMemory, blockSize, blockMappedMemory);
+		allocation = m_geometryPool.allocate(size);
 	}
 
+	return allocation;
+}
 
+uint32_t Engine::uploadEncodedGeometry(const std::vector<uint8_t>& encoded)
+{
+	// Decoding writes straight into the memory the GPU or the copy reads, skipping an intermediate buffer.
+	return uploadGeometry(getDecodedSize(encoded), [this, &encoded](void* mappedMemory)
+	{
+		decodeWords(m_codecInstructionSet, encoded, static_cast<uint32_t*>(mappedMemory));
+	});
 }
 
-void Engine::createSemaphores()
+void Engine::createUploadQueue()
 {
-	m_vkImageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-	m_vkRenderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+	const VkMemoryPropertyFlags stagingMemPropertyFlags = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
 
-	VkSemaphoreCreateInfo semaphoreCreateInfo = {};
-	semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	createBuffer(UPLOAD_QUEUE_STAGING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, stagingMemPropertyFlags,
+		&m_vkUploadQueueBuffer, &m_vkUploadQueueDeviceMemory);
 
-	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+	// Producers write into it from any thread, so it stays mapped for its whole life.
+	void* mappedMemory;
+	VkResult result = vkMapMemory(m_vkDevice, m_vkUploadQueueDeviceMemory, 0, UPLOAD_QUEUE_STAGING_SIZE, 0,
+		&mappedMemory);
+	if (result != VK_SUCCESS)
 	{
-		VkResult result = vkCreateSemaphore(m_vkDevice, &semaphoreCreateInfo, nullptr, &m_vkImageAvailableSemaphores[i]);
-		if (result != VK_SUCCESS)
-		{
-			throw std::runtime_error("Failed to create image available semaphore.");
-		}
-
-		result = vkCreateSemaphore(m_vkDevice, &semaphoreCreateInfo, nullptr, &m_vkRenderFinishedSemaphores[i]);
-		if (result != VK_SUCCESS)
-		{
-			throw std::runtime_error("Failed to create render finished semaphore.");
-		}
+		throw std::runtime_error("Failed to map upload queue memory.");
 	}
 
+	m_uploadQueue.init(mappedMemory, UPLOAD_QUEUE_STAGING_SIZE, UPLOAD_QUEUE_CELL_COUNT);
 }
 
-void Engine::createFences()
+void Engine::drainUploadQueue()
 {
-	m_vkFences.resize(MAX_FRAMES_IN_FLIGHT);
-	m_vkImagesInFlightFences.resize(m_vkSwapchainImages.size(), VK_NULL_HANDLE);
+	QueuedUpload<QueuedMesh> upload;
 
-	VkFenceCreateInfo fenceCreateInfo = {};
-	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+	while (m_uploadQueue.pop(&upload))
+	{
+		QueuedMesh& queued = upload.payload;
+		auto cached = m_geometryCache.find(queued.gridSize);
 
-	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+		// Another thread or the render thread itself got there first.
+		if (queued.gridSize == m_meshGridSize ||
+			(cached != m_geometryCache.end() && cached->second.vertexAllocation != INVALID_GEOMETRY_ALLOCATION))
+		{
+			m_uploadQueue.retire(m_frameNumber, upload.range);
+			continue;
+		}
+
+		const std::array<VkDeviceSize, 3> sizes = { queued.vertexSize, queued.indexSize,
+			sizeof(Meshlet) * queued.mesh.meshlets.size() };
+		std::array<uint32_t, 3> allocations;
+		VkDeviceSize stagingOffset = upload.range.offset;
+
+		// Copied even into mapped blocks, reading staging memory back on the CPU would be slow.
+		for (size_t i = 0; i < sizes.size(); ++i)
+		{
+			allocations[i] = allocateGeometry(sizes[i]);
+			m_pendingCopies.push_back({ m_vkUploadQueueBuffer, stagingOffset, m_geometryPool.getBuffer(allocations[i]),
+				m_geometryPool.getOffset(allocations[i]), sizes[i] });
+			stagingOffset += sizes[i];
+		}
+
+		CachedGeometry geometry = {};
+		geometry.encodedVertices = std::move(queued.encodedVertices);
+		geometry.encodedIndices = std::move(queued.encodedIndices);
+		geometry.mesh = std::move(queued.mesh);
+		geometry.vertexAllocation = allocations[0];
+		geometry.indexAllocation = allocations[1];
+		geometry.meshletAllocation = allocations[2];
+		geometry.lastUsedFrame = m_frameNumber;
+		m_geometryCache[queued.gridSize] = std::move(geometry);
+
+		// The copies are recorded this frame.
+		m_uploadQueue.retire(m_frameNumber, upload.range);
+	}
+}
+
+void Engine::createVertexBuffer()
+{
+	m_vertexAllocation = uploadGeometry(m_vertices.data(), sizeof(Vertex) * m_vertices.size());
+}
+
+void Engine::createIndexBuffer()
+{
+	m_indexAllocation = uploadGeometry(m_indices.data(), sizeof(uint32_t) * m_indices.size());
+}
+
+void Engine::createMeshletBuffer()
+{
+	m_meshletAllocation = uploadGeometry(m_mesh.meshlets.data(), sizeof(Meshlet) * m_mesh.meshlets.size());
+}
+
+void Engine::createDeformBuffers()
+{
+	decodeGeometry();
+	m_rig = buildChainRig(m_vertices, DEFORM_BONE_COUNT);
+
+	const std::vector<SkinnedVertex> skinnedVertices = skinToChain(m_vertices, m_rig);
+	const std::vector<glm::vec4> morphTargets = buildMorphTargets(m_vertices, &m_morphTargetCount);
+
+	// Culling and LOD selection read the radius, so it has to cover every pose.
+	m_mesh.boundingRadius = computeDeformedBoundingRadius(m_vertices, m_rig, morphTargets, m_morphTargetCount);
+
+	createDeviceLocalBuffer(skinnedVertices.data(), sizeof(SkinnedVertex) * skinnedVertices.size(),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &m_vkSkinnedVertexBuffer, &m_vkSkinnedVertexDeviceMemory);
+	createDeviceLocalBuffer(morphTargets.data(), sizeof(glm::vec4) * morphTargets.size(),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &m_vkMorphTargetBuffer, &m_vkMorphTargetDeviceMemory);
+}
+
+void Engine::createDeformParameterBuffer()
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(m_vkPhysicalDevice, &properties);
+
+	const VkDeviceSize alignment = properties.limits.minStorageBufferOffsetAlignment;
+	m_deformParameterRegionSize = (sizeof(DeformParameters) + alignment - 1) / alignment * alignment;
+
+	const VkDeviceSize bufferSize = m_deformParameterRegionSize * MAX_FRAMES_IN_FLIGHT;
+	const VkMemoryPropertyFlags parameterMemPropertyFlags = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+
+	createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, parameterMemPropertyFlags,
+		&m_vkDeformParameterBuffer, &m_vkDeformParameterDeviceMemory);
+
+	VkResult result = vkMapMemory(m_vkDevice, m_vkDeformParameterDeviceMemory, 0, bufferSize, 0,
+		&m_deformParameterMappedMemory);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to map deform parameter memory.");
+	}
+}
+
+void Engine::createInstances()
+{
+	m_instances.resize(INSTANCE_GRID_SIZE * INSTANCE_GRID_SIZE);
+	m_objectBounds.resize(m_instances.size());
+	m_visibleObjects.resize(m_instances.size());
+	m_instanceDirtyFrames.resize(m_instances.size());
+	m_visibleLods.resize(m_instances.size());
+	m_drawList.resize(m_instances.size());
+	m_visibleObjectCount = 0;
+
+	for (uint32_t y = 0; y < INSTANCE_GRID_SIZE; ++y)
+	{
+		for (uint32_t x = 0; x < INSTANCE_GRID_SIZE; ++x)
+		{
+			const glm::vec4 color(
+				static_cast<float>(x) / INSTANCE_GRID_SIZE,
+				static_cast<float>(y) / INSTANCE_GRID_SIZE,
+				1.0f, 1.0f);
+
+			setInstance(y * INSTANCE_GRID_SIZE + x, glm::mat4(1.0f), color);
+		}
+	}
+
+	FrameSnapshot snapshot;
+	update(&snapshot);
+	applySnapshot(snapshot);
+}
+
+void Engine::createInstanceBuffers()
+{
+	m_vkInstanceBuffers.resize(m_vkSwapchainImages.size());
+	m_vkInstanceDeviceMemories.resize(m_vkSwapchainImages.size());
+	m_instanceMappedMemories.resize(m_vkSwapchainImages.size());
+
+	const VkDeviceSize bufferSize = sizeof(uint32_t) * m_instances.size();
+	const VkBufferUsageFlags instanceBufferUsageFlags = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	const VkMemoryPropertyFlags instanceMemPropertyFlags = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+
+	for (size_t i = 0; i < m_vkInstanceBuffers.size(); ++i)
 	{
-		VkResult result = vkCreateFence(m_vkDevice, &fenceCreateInfo, nullptr, &m_vkFences[i]);
+		createBuffer(bufferSize, instanceBufferUsageFlags, instanceMemPropertyFlags,
+			&m_vkInstanceBuffers[i], &m_vkInstanceDeviceMemories[i]);
+
+		VkResult result = vkMapMemory(m_vkDevice, m_vkInstanceDeviceMemories[i], 0, bufferSize, 0,
+			&m_instanceMappedMemories[i]);
 		if (result != VK_SUCCESS)
 		{
-			throw std::runtime_error("Failed to create fance.");
+			throw std::runtime_error("Failed to map instance memory.");
+		}
+
+		uint32_t* objectIndices = static_cast<uint32_t*>(m_instanceMappedMemories[i]);
+		for (uint32_t objectIndex = 0; objectIndex < getInstanceCount(); ++objectIndex)
+		{
+			objectIndices[objectIndex] = objectIndex;
 		}
 	}
 }
 
-VkVertexInputBindingDescription Engine::buildVertexBindingDescription()
+void Engine::createTransformRing()
 {
-	VkVertexInputBindingDescription bindingDescription = {};
-	bindingDescription.binding = 0;
-	bindingDescription.stride = sizeof(Vertex);
-	bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-	return bindingDescription;
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(m_vkPhysicalDevice, &properties);
+
+	const VkDeviceSize alignment = properties.limits.minStorageBufferOffsetAlignment;
+	const VkDeviceSize transformsSize = sizeof(InstanceData) * m_instances.size();
+	m_transformRingRegionSize = (transformsSize + alignment - 1) / alignment * alignment;
+
+	const VkDeviceSize bufferSize = m_transformRingRegionSize * MAX_FRAMES_IN_FLIGHT;
+	const VkBufferUsageFlags ringUsageFlags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	const VkMemoryPropertyFlags ringMemPropertyFlags = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+
+	createBuffer(bufferSize, ringUsageFlags, ringMemPropertyFlags, &m_vkTransformRingBuffer,
+		&m_vkTransformRingDeviceMemory);
+
+	VkResult result = vkMapMemory(m_vkDevice, m_vkTransformRingDeviceMemory, 0, bufferSize, 0,
+		&m_transformRingMappedMemory);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to map transform ring memory.");
+	}
+
+	for (int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame)
+	{
+		memcpy(static_cast<char*>(m_transformRingMappedMemory) + m_transformRingRegionSize * frame,
+			m_instances.data(), transformsSize);
+	}
+
+	std::fill(m_instanceDirtyFrames.begin(), m_instanceDirtyFrames.end(), 0);
 }
 
-std::array<VkVertexInputAttributeDescription, 2> Engine::buildVertexAttributeDescription()
+void Engine::createDrawDescriptorSets()
 {
-	std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions = {};
+	m_vkDrawDescriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
 
-	attributeDescriptions[0].binding = 0;
-	attributeDescriptions[0].location = 0;
-	attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-	attributeDescriptions[0].offset = offsetof(Vertex, position);
+	std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, m_vkDescriptorSetLayout);
 
-	attributeDescriptions[1].binding = 0;
-	attributeDescriptions[1].location = 1;
-	attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-	attributeDescriptions[1].offset = offsetof(Vertex, color);
+	VkDescriptorSetAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocateInfo.descriptorPool = m_vkDescriptorPool;
+	allocateInfo.descriptorSetCount = static_cast<uint32_t>(layouts.size());
+	allocateInfo.pSetLayouts = layouts.data();
+
+	VkResult result = vkAllocateDescriptorSets(m_vkDevice, &allocateInfo, m_vkDrawDescriptorSets.data());
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate draw descriptor sets.");
+	}
+}
+
+void Engine::writeFrameDescriptorSets(size_t frame)
+{
+	// Each frame slot owns its sets, so they can be rewritten once that slot's fence has signaled.
+	std::array<VkDescriptorBufferInfo, 2> bufferInfos = {};
+	bufferInfos[0].buffer = m_vkTransformRingBuffer;
+	bufferInfos[0].offset = 0;
+	bufferInfos[0].range = sizeof(InstanceData) * m_instances.size();
+	bufferInfos[1].buffer = m_geometryPool.getBuffer(m_vertexAllocation);
+	bufferInfos[1].offset = m_geometryPool.getOffset(m_vertexAllocation);
+	bufferInfos[1].range = m_geometryPool.getSize(m_vertexAllocation);
+
+	std::array<VkWriteDescriptorSet, 2> writes = {};
+
+	writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writes[0].dstSet = m_vkDrawDescriptorSets[frame];
+	writes[0].dstBinding = 0;
+	writes[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+	writes[0].descriptorCount = 1;
+	writes[0].pBufferInfo = &bufferInfos[0];
+
+	writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writes[1].dstSet = m_vkDrawDescriptorSets[frame];
+	writes[1].dstBinding = 1;
+	writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	writes[1].descriptorCount = 1;
+	writes[1].pBufferInfo = &bufferInfos[1];
+
+	vkUpdateDescriptorSets(m_vkDevice, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+
+	if (m_vertexDeformation)
+	{
+		std::array<VkDescriptorBufferInfo, 4> deformBufferInfos = {};
+		deformBufferInfos[0].buffer = m_vkDeformParameterBuffer;
+		deformBufferInfos[0].range = sizeof(DeformParameters);
+		deformBufferInfos[1].buffer = m_vkSkinnedVertexBuffer;
+		deformBufferInfos[1].range = VK_WHOLE_SIZE;
+		deformBufferInfos[2].buffer = m_vkMorphTargetBuffer;
+		deformBufferInfos[2].range = VK_WHOLE_SIZE;
+		deformBufferInfos[3] = bufferInfos[1];
+
+		std::array<VkWriteDescriptorSet, 4> deformWrites = {};
+		for (uint32_t binding = 0; binding < deformWrites.size(); ++binding)
+		{
+			deformWrites[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			deformWrites[binding].dstSet = m_vkDeformDescriptorSets[frame];
+			deformWrites[binding].dstBinding = binding;
+			deformWrites[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			deformWrites[binding].descriptorCount = 1;
+			deformWrites[binding].pBufferInfo = &deformBufferInfos[binding];
+		}
+
+		deformWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+
+		vkUpdateDescriptorSets(m_vkDevice, static_cast<uint32_t>(deformWrites.size()), deformWrites.data(), 0,
+			nullptr);
+	}
+
+	m_descriptorSetMeshVersions[frame] = m_meshVersion;
+
+	// Recorded draws that bound the rewritten sets are invalid now.
+	++m_drawStateVersion;
+}
+
+void Engine::createCullPipeline()
+{
+	std::vector<VkDescriptorSetLayoutBinding> bindings(m_occlusionCulling ? 4 : 2);
+
+	bindings[0].binding = 0;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[0].descriptorCount = 1;
+	bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	bindings[1].binding = 1;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[1].descriptorCount = 1;
+	bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	if (m_occlusionCulling)
+	{
+		bindings[2].binding = 2;
+		bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[2].descriptorCount = 1;
+		bindings[2].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+		bindings[3].binding = 3;
+		bindings[3].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		bindings[3].descriptorCount = 1;
+		bindings[3].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	// Meshlets are tested in world space, against the transforms of the frame being culled.
+	VkDescriptorSetLayoutBinding transformBinding = {};
+	transformBinding.binding = 4;
+	transformBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+	transformBinding.descriptorCount = 1;
+	transformBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	bindings.push_back(transformBinding);
+
+	VkDescriptorSetLayoutBinding meshletBinding = transformBinding;
+	meshletBinding.binding = 5;
+	meshletBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings.push_back(meshletBinding);
+
+	VkDescriptorSetLayoutCreateInfo descriptorSetLayoutInfo = {};
+	descriptorSetLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	descriptorSetLayoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	descriptorSetLayoutInfo.pBindings = bindings.data();
+
+	VkResult result = vkCreateDescriptorSetLayout(m_vkDevice, &descriptorSetLayoutInfo, m_vkAllocator,
+		&m_vkCullDescriptorSetLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create cull descriptor set layout.");
+	}
+
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(CullPushConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &m_vkCullDescriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	result = vkCreatePipelineLayout(m_vkDevice, &pipelineLayoutInfo, m_vkAllocator, &m_vkCullPipelineLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create cull pipeline layout.");
+	}
+
+	// Both variants are built from cull.comp, the occlusion one with OCCLUSION_CULLING defined.
+	VkShaderModule computeShader = loadShader(m_occlusionCulling ? "occlusion.spv" : "cull.spv");
+
+	VkPipelineShaderStageCreateInfo computeStageCreateInfo = {};
+	computeStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	computeStageCreateInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	computeStageCreateInfo.module = computeShader;
+	computeStageCreateInfo.pName = "main";
+
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage = computeStageCreateInfo;
+	pipelineInfo.layout = m_vkCullPipelineLayout;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineInfo.basePipelineIndex = -1;
+
+	result = vkCreateComputePipelines(m_vkDevice, VK_NULL_HANDLE, 1, &pipelineInfo, m_vkAllocator, &m_vkCullPipeline);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create cull pipeline.");
+	}
+
+	vkDestroyShaderModule(m_vkDevice, computeShader, m_vkAllocator);
+}
+
+void Engine::createCullBuffers()
+{
+	m_vkCullInputBuffers.resize(m_vkSwapchainImages.size());
+	m_vkCullInputDeviceMemories.resize(m_vkSwapchainImages.size());
+	m_cullInputMappedMemories.resize(m_vkSwapchainImages.size());
+	m_drawsPerObject = computeDrawsPerObject();
+
+	const VkDeviceSize cullInputSize = sizeof(CullInputHeader) + sizeof(glm::vec4) * m_objectBounds.size();
+	const VkBufferUsageFlags cullInputUsageFlags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	const VkMemoryPropertyFlags cullInputMemPropertyFlags = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+
+	for (size_t i = 0; i < m_vkSwapchainImages.size(); ++i)
+	{
+		createBuffer(cullInputSize, cullInputUsageFlags, cullInputMemPropertyFlags,
+			&m_vkCullInputBuffers[i], &m_vkCullInputDeviceMemories[i]);
+
+		VkResult result = vkMapMemory(m_vkDevice, m_vkCullInputDeviceMemories[i], 0, cullInputSize, 0,
+			&m_cullInputMappedMemories[i]);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to map cull input memory.");
+		}
+
+		writeCullInput(i);
+	}
+
+	createIndirectBuffers();
+
+	if (!m_occlusionCulling)
+	{
+		return;
+	}
+
+	// One flag per object saying whether it was drawn last frame, shared by every frame in flight.
+	createBuffer(sizeof(uint32_t) * m_objectBounds.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		&m_vkVisibilityBuffer, &m_vkVisibilityDeviceMemory);
+	m_visibilityCleared = false;
+}
+
+void Engine::createIndirectBuffers()
+{
+	m_vkIndirectBuffers.resize(m_vkSwapchainImages.size());
+	m_vkIndirectDeviceMemories.resize(m_vkSwapchainImages.size());
+
+	const VkDeviceSize indirectSize = sizeof(IndirectDrawHeader) +
+		sizeof(VkDrawIndexedIndirectCommand) * m_objectBounds.size() * m_drawsPerObject;
+	const VkBufferUsageFlags indirectUsageFlags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+		VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	const VkMemoryPropertyFlags indirectMemPropertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+
+	for (size_t i = 0; i < m_vkSwapchainImages.size(); ++i)
+	{
+		createBuffer(indirectSize, indirectUsageFlags, indirectMemPropertyFlags,
+			&m_vkIndirectBuffers[i], &m_vkIndirectDeviceMemories[i]);
+	}
+
+	if (!m_occlusionCulling)
+	{
+		return;
+	}
+
+	m_vkLateIndirectBuffers.resize(m_vkSwapchainImages.size());
+	m_vkLateIndirectDeviceMemories.resize(m_vkSwapchainImages.size());
+
+	for (size_t i = 0; i < m_vkSwapchainImages.size(); ++i)
+	{
+		createBuffer(indirectSize, indirectUsageFlags, indirectMemPropertyFlags,
+			&m_vkLateIndirectBuffers[i], &m_vkLateIndirectDeviceMemories[i]);
+	}
+}
+
+void Engine::createDescriptorPool()
+{
+	// Occlusion culling doubles the cull sets, an early and a late one per swapchain image.
+	const uint32_t cullSetCount = static_cast<uint32_t>(m_vkSwapchainImages.size()) * (m_occlusionCulling ? 2 : 1);
+
+	std::vector<VkDescriptorPoolSize> poolSizes(2);
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[0].descriptorCount = cullSetCount * (m_occlusionCulling ? 4 : 3) + MAX_FRAMES_IN_FLIGHT * 4;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+	poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT * 2) + cullSetCount;
+
+	uint32_t maxSets = cullSetCount + MAX_FRAMES_IN_FLIGHT * 2;
+
+	if (m_occlusionCulling)
+	{
+		// Every cull set samples the pyramid, every reduction step samples its source and stores one level.
+		poolSizes.push_back({ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, cullSetCount + m_depthPyramidLevelCount });
+		poolSizes.push_back({ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, m_depthPyramidLevelCount });
+		maxSets += m_depthPyramidLevelCount;
+	}
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolInfo.pPoolSizes = poolSizes.data();
+	poolInfo.maxSets = maxSets;
+
+	VkResult result = vkCreateDescriptorPool(m_vkDevice, &poolInfo, m_vkAllocator, &m_vkDescriptorPool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create descriptor pool.");
+	}
+}
+
+void Engine::createCullDescriptorSets()
+{
+	m_vkCullDescriptorSets.resize(m_vkSwapchainImages.size());
+
+	std::vector<VkDescriptorSetLayout> layouts(m_vkSwapchainImages.size(), m_vkCullDescriptorSetLayout);
+
+	VkDescriptorSetAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocateInfo.descriptorPool = m_vkDescriptorPool;
+	allocateInfo.descriptorSetCount = static_cast<uint32_t>(layouts.size());
+	allocateInfo.pSetLayouts = layouts.data();
+
+	VkResult result = vkAllocateDescriptorSets(m_vkDevice, &allocateInfo, m_vkCullDescriptorSets.data());
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate cull descriptor sets.");
+	}
+
+	if (m_occlusionCulling)
+	{
+		m_vkLateCullDescriptorSets.resize(m_vkSwapchainImages.size());
+
+		result = vkAllocateDescriptorSets(m_vkDevice, &allocateInfo, m_vkLateCullDescriptorSets.data());
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to allocate late cull descriptor sets.");
+		}
+	}
+
+	m_cullDescriptorSetMeshVersions.resize(m_vkSwapchainImages.size());
+
+	for (size_t i = 0; i < m_vkCullDescriptorSets.size(); ++i)
+	{
+		writeCullDescriptorSets(i);
+	}
+}
+
+void Engine::writeCullDescriptorSets(size_t imageIndex)
+{
+	// The early and late sets differ only in the indirect buffer they write draws to.
+	auto writeSet = [this, imageIndex](VkDescriptorSet descriptorSet, VkBuffer indirectBuffer)
+	{
+		std::array<VkDescriptorBufferInfo, 6> bufferInfos = {};
+		bufferInfos[0].buffer = m_vkCullInputBuffers[imageIndex];
+		bufferInfos[0].offset = 0;
+		bufferInfos[0].range = VK_WHOLE_SIZE;
+		bufferInfos[1].buffer = indirectBuffer;
+		bufferInfos[1].offset = 0;
+		bufferInfos[1].range = VK_WHOLE_SIZE;
+		bufferInfos[2].buffer = m_vkVisibilityBuffer;
+		bufferInfos[2].offset = 0;
+		bufferInfos[2].range = VK_WHOLE_SIZE;
+		bufferInfos[4].buffer = m_vkTransformRingBuffer;
+		bufferInfos[4].offset = 0;
+		bufferInfos[4].range = sizeof(InstanceData) * m_instances.size();
+		bufferInfos[5].buffer = m_geometryPool.getBuffer(m_meshletAllocation);
+		bufferInfos[5].offset = m_geometryPool.getOffset(m_meshletAllocation);
+		bufferInfos[5].range = m_geometryPool.getSize(m_meshletAllocation);
+
+		VkDescriptorImageInfo pyramidInfo = {};
+		pyramidInfo.sampler = m_vkDepthSampler;
+		pyramidInfo.imageView = m_vkDepthPyramidView;
+		pyramidInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+		std::array<VkWriteDescriptorSet, 6> writes = {};
+		for (uint32_t binding = 0; binding < writes.size(); ++binding)
+		{
+			writes[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[binding].dstSet = descriptorSet;
+			writes[binding].dstBinding = binding;
+			writes[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			writes[binding].descriptorCount = 1;
+			writes[binding].pBufferInfo = &bufferInfos[binding];
+		}
+
+		writes[3].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		writes[3].pBufferInfo = nullptr;
+		writes[3].pImageInfo = &pyramidInfo;
+		writes[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+
+		// Without occlusion culling the visibility and pyramid bindings don't exist.
+		std::vector<VkWriteDescriptorSet> usedWrites = { writes[0], writes[1], writes[4], writes[5] };
+
+		if (m_occlusionCulling)
+		{
+			usedWrites.push_back(writes[2]);
+			usedWrites.push_back(writes[3]);
+		}
+
+		vkUpdateDescriptorSets(m_vkDevice, static_cast<uint32_t>(usedWrites.size()), usedWrites.data(), 0, nullptr);
+	};
+
+	// Only called once the last frame that used this image has completed.
+	writeSet(m_vkCullDescriptorSets[imageIndex], m_vkIndirectBuffers[imageIndex]);
+
+	if (m_occlusionCulling)
+	{
+		writeSet(m_vkLateCullDescriptorSets[imageIndex], m_vkLateIndirectBuffers[imageIndex]);
+	}
+
+	m_cullDescriptorSetMeshVersions[imageIndex] = m_meshVersion;
+}
+
+// Largest power of two not above value, so every pyramid level halves exactly.
+static uint32_t previousPowerOfTwo(uint32_t value)
+{
+	uint32_t result = 1;
+
+	while (result * 2 <= value)
+	{
+		result *= 2;
+	}
+
+	return result;
+}
+
+void Engine::createDepthPyramid()
+{
+	m_depthPyramidExtent.width = previousPowerOfTwo(m_vkSwapchainExtent.width);
+	m_depthPyramidExtent.height = previousPowerOfTwo(m_vkSwapchainExtent.height);
+
+	m_depthPyramidLevelCount = 1;
+	while ((m_depthPyramidExtent.width >> m_depthPyramidLevelCount) > 0 ||
+		(m_depthPyramidExtent.height >> m_depthPyramidLevelCount) > 0)
+	{
+		++m_depthPyramidLevelCount;
+	}
+
+	VkImageCreateInfo imageInfo = {};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = VK_FORMAT_R32_SFLOAT;
+	imageInfo.extent = { m_depthPyramidExtent.width, m_depthPyramidExtent.height, 1 };
+	imageInfo.mipLevels = m_depthPyramidLevelCount;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	VkResult result = vkCreateImage(m_vkDevice, &imageInfo, m_vkAllocator, &m_vkDepthPyramidImage);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create depth pyramid image.");
+	}
+
+	VkMemoryRequirements memoryRequirements;
+	vkGetImageMemoryRequirements(m_vkDevice, m_vkDepthPyramidImage, &memoryRequirements);
+
+	VkMemoryAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocateInfo.allocationSize = memoryRequirements.size;
+	allocateInfo.memoryTypeIndex = findMemoryType(memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	result = vkAllocateMemory(m_vkDevice, &allocateInfo, m_vkAllocator, &m_vkDepthPyramidDeviceMemory);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate depth pyramid memory.");
+	}
+
+	m_memoryBudget.track(m_vkDepthPyramidDeviceMemory, allocateInfo.memoryTypeIndex, allocateInfo.allocationSize);
+	vkBindImageMemory(m_vkDevice, m_vkDepthPyramidImage, m_vkDepthPyramidDeviceMemory, 0);
+
+	VkImageViewCreateInfo viewInfo = {};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = m_vkDepthPyramidImage;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = VK_FORMAT_R32_SFLOAT;
+	viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	viewInfo.subresourceRange.levelCount = m_depthPyramidLevelCount;
+	viewInfo.subresourceRange.layerCount = 1;
+
+	result = vkCreateImageView(m_vkDevice, &viewInfo, m_vkAllocator, &m_vkDepthPyramidView);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create depth pyramid view.");
+	}
+
+	// Storage image views may only cover a single level.
+	m_vkDepthPyramidLevelViews.resize(m_depthPyramidLevelCount);
+	viewInfo.subresourceRange.levelCount = 1;
+
+	for (uint32_t level = 0; level < m_depthPyramidLevelCount; ++level)
+	{
+		viewInfo.subresourceRange.baseMipLevel = level;
+
+		result = vkCreateImageView(m_vkDevice, &viewInfo, m_vkAllocator, &m_vkDepthPyramidLevelViews[level]);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create depth pyramid level view.");
+		}
+	}
+
+	// Only ever read with texelFetch, the sampler is there because the descriptors need one.
+	VkSamplerCreateInfo samplerInfo = {};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_NEAREST;
+	samplerInfo.minFilter = VK_FILTER_NEAREST;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.maxLod = static_cast<float>(m_depthPyramidLevelCount);
+
+	result = vkCreateSampler(m_vkDevice, &samplerInfo, m_vkAllocator, &m_vkDepthSampler);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create depth sampler.");
+	}
+}
+
+void Engine::createDepthReducePipeline()
+{
+	std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+
+	bindings[0].binding = 0;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	bindings[0].descriptorCount = 1;
+	bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	bindings[1].binding = 1;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	bindings[1].descriptorCount = 1;
+	bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkDescriptorSetLayoutCreateInfo descriptorSetLayoutInfo = {};
+	descriptorSetLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	descriptorSetLayoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	descriptorSetLayoutInfo.pBindings = bindings.data();
+
+	VkResult result = vkCreateDescriptorSetLayout(m_vkDevice, &descriptorSetLayoutInfo, m_vkAllocator,
+		&m_vkDepthReduceDescriptorSetLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create depth reduce descriptor set layout.");
+	}
+
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(DepthReducePushConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &m_vkDepthReduceDescriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	result = vkCreatePipelineLayout(m_vkDevice, &pipelineLayoutInfo, m_vkAllocator, &m_vkDepthReducePipelineLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create depth reduce pipeline layout.");
+	}
+
+	VkShaderModule computeShader = loadShader("depthreduce.spv");
+
+	VkPipelineShaderStageCreateInfo computeStageCreateInfo = {};
+	computeStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	computeStageCreateInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	computeStageCreateInfo.module = computeShader;
+	computeStageCreateInfo.pName = "main";
+
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage = computeStageCreateInfo;
+	pipelineInfo.layout = m_vkDepthReducePipelineLayout;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineInfo.basePipelineIndex = -1;
+
+	result = vkCreateComputePipelines(m_vkDevice, VK_NULL_HANDLE, 1, &pipelineInfo, m_vkAllocator,
+		&m_vkDepthReducePipeline);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create depth reduce pipeline.");
+	}
+
+	vkDestroyShaderModule(m_vkDevice, computeShader, m_vkAllocator);
+}
+
+void Engine::createDepthReduceDescriptorSets()
+{
+	m_vkDepthReduceDescriptorSets.resize(m_depthPyramidLevelCount);
+
+	std::vector<VkDescriptorSetLayout> layouts(m_depthPyramidLevelCount, m_vkDepthReduceDescriptorSetLayout);
+
+	VkDescriptorSetAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocateInfo.descriptorPool = m_vkDescriptorPool;
+	allocateInfo.descriptorSetCount = static_cast<uint32_t>(layouts.size());
+	allocateInfo.pSetLayouts = layouts.data();
+
+	VkResult result = vkAllocateDescriptorSets(m_vkDevice, &allocateInfo, m_vkDepthReduceDescriptorSets.data());
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate depth reduce descriptor sets.");
+	}
+
+	for (uint32_t level = 0; level < m_depthPyramidLevelCount; ++level)
+	{
+		// The first level reduces the depth buffer itself, every other one the level above it.
+		VkDescriptorImageInfo sourceInfo = {};
+		sourceInfo.sampler = m_vkDepthSampler;
+		sourceInfo.imageView = level == 0 ? m_frameGraph.getImageView(m_depthResource) :
+			m_vkDepthPyramidLevelViews[level - 1];
+		sourceInfo.imageLayout = level == 0 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+
+		VkDescriptorImageInfo destinationInfo = {};
+		destinationInfo.imageView = m_vkDepthPyramidLevelViews[level];
+		destinationInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+		std::array<VkWriteDescriptorSet, 2> writes = {};
+		writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[0].dstSet = m_vkDepthReduceDescriptorSets[level];
+		writes[0].dstBinding = 0;
+		writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		writes[0].descriptorCount = 1;
+		writes[0].pImageInfo = &sourceInfo;
+		writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[1].dstSet = m_vkDepthReduceDescriptorSets[level];
+		writes[1].dstBinding = 1;
+		writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		writes[1].descriptorCount = 1;
+		writes[1].pImageInfo = &destinationInfo;
+
+		vkUpdateDescriptorSets(m_vkDevice, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+	}
+}
+
+void Engine::createDeformPipeline()
+{
+	std::array<VkDescriptorSetLayoutBinding, 4> bindings = {};
+
+	for (uint32_t binding = 0; binding < bindings.size(); ++binding)
+	{
+		bindings[binding].binding = binding;
+		bindings[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[binding].descriptorCount = 1;
+		bindings[binding].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+
+	VkDescriptorSetLayoutCreateInfo descriptorSetLayoutInfo = {};
+	descriptorSetLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	descriptorSetLayoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	descriptorSetLayoutInfo.pBindings = bindings.data();
+
+	VkResult result = vkCreateDescriptorSetLayout(m_vkDevice, &descriptorSetLayoutInfo, m_vkAllocator,
+		&m_vkDeformDescriptorSetLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create deform descriptor set layout.");
+	}
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &m_vkDeformDescriptorSetLayout;
+
+	result = vkCreatePipelineLayout(m_vkDevice, &pipelineLayoutInfo, m_vkAllocator, &m_vkDeformPipelineLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create deform pipeline layout.");
+	}
+
+	VkShaderModule computeShader = loadShader("deform.spv");
+
+	VkPipelineShaderStageCreateInfo computeStageCreateInfo = {};
+	computeStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	computeStageCreateInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	computeStageCreateInfo.module = computeShader;
+	computeStageCreateInfo.pName = "main";
+
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage = computeStageCreateInfo;
+	pipelineInfo.layout = m_vkDeformPipelineLayout;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineInfo.basePipelineIndex = -1;
+
+	result = vkCreateComputePipelines(m_vkDevice, VK_NULL_HANDLE, 1, &pipelineInfo, m_vkAllocator, &m_vkDeformPipeline);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create deform pipeline.");
+	}
+
+	vkDestroyShaderModule(m_vkDevice, computeShader, m_vkAllocator);
+}
+
+void Engine::createDeformDescriptorSets()
+{
+	m_vkDeformDescriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+
+	std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, m_vkDeformDescriptorSetLayout);
+
+	VkDescriptorSetAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocateInfo.descriptorPool = m_vkDescriptorPool;
+	allocateInfo.descriptorSetCount = static_cast<uint32_t>(layouts.size());
+	allocateInfo.pSetLayouts = layouts.data();
+
+	VkResult result = vkAllocateDescriptorSets(m_vkDevice, &allocateInfo, m_vkDeformDescriptorSets.data());
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate deform descriptor sets.");
+	}
+}
+
+void Engine::createCommandPool()
+{
+	QueueFamilyIndices queueFamilyIndices = findQueueFamilyIndices(m_vkPhysicalDevice);
+
+	VkCommandPoolCreateInfo commandPoolCreateInfo = {};
+	commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	commandPoolCreateInfo.queueFamilyIndex = queueFamilyIndices.graphics.value();
+	commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+	VkResult result = vkCreateCommandPool(m_vkDevice, &commandPoolCreateInfo, m_vkAllocator, &m_vkCommandPool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create command pool.");
+	}
+}
+
+void Engine::createCommandBuffers()
+{
+	m_vkCommandBuffers.resize(m_vkSwapchainFramebuffers.size());
+
+	VkCommandBufferAllocateInfo commandBufferInfo = {};
+	commandBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	commandBufferInfo.commandPool = m_vkCommandPool;
+	commandBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	commandBufferInfo.commandBufferCount = static_cast<uint32_t>(m_vkCommandBuffers.size());
+
+	VkResult result = vkAllocateCommandBuffers(m_vkDevice, &commandBufferInfo, m_vkCommandBuffers.data());
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate command buffers.");
+	}
+
+	m_drawCommandCache.init(m_vkDevice, m_vkCommandPool);
+}
+
+void Engine::createTransferCommandBuffers()
+{
+	VkCommandPoolCreateInfo commandPoolCreateInfo = {};
+	commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	commandPoolCreateInfo.queueFamilyIndex = m_uploadQueueFamilies[1];
+	commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+	VkResult result = vkCreateCommandPool(m_vkDevice, &commandPoolCreateInfo, m_vkAllocator, &m_vkTransferCommandPool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create transfer command pool.");
+	}
+
+	m_vkTransferCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+
+	VkCommandBufferAllocateInfo commandBufferInfo = {};
+	commandBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	commandBufferInfo.commandPool = m_vkTransferCommandPool;
+	commandBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	commandBufferInfo.commandBufferCount = static_cast<uint32_t>(m_vkTransferCommandBuffers.size());
+
+	result = vkAllocateCommandBuffers(m_vkDevice, &commandBufferInfo, m_vkTransferCommandBuffers.data());
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate transfer command buffers.");
+	}
+
+	m_vkTransferFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+
+	VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+	semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+	{
+		result = vkCreateSemaphore(m_vkDevice, &semaphoreCreateInfo, m_vkAllocator, &m_vkTransferFinishedSemaphores[i]);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create transfer finished semaphore.");
+		}
+	}
+}
+
+void Engine::recordCommandBuffer(size_t imageIndex)
+{
+	VkCommandBuffer commandBuffer = m_vkCommandBuffers[imageIndex];
+
+	VkResult result = vkResetCommandBuffer(commandBuffer, 0);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to reset command buffer.");
+	}
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to begin command buffer.");
+	}
+
+	m_currentImage = imageIndex;
+	m_frameGraph.bindImage(m_swapchainResource, m_vkSwapchainImages[imageIndex],
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+	m_frameGraph.setPassEnabled(m_uploadPass, !m_pendingCopies.empty() || !m_pendingUpdates.empty() ||
+		!m_pendingMoves.empty());
+
+	if (m_gpuDrivenCulling)
+	{
+		m_frameGraph.bindBuffer(m_indirectResource, m_vkIndirectBuffers[imageIndex]);
+	}
+
+	if (m_occlusionCulling)
+	{
+		m_frameGraph.bindBuffer(m_lateIndirectResource, m_vkLateIndirectBuffers[imageIndex]);
+		m_frameGraph.bindBuffer(m_visibilityResource, m_vkVisibilityBuffer);
+	}
+
+	if (m_captureFrames)
+	{
+		// A frame never waits for the readback of an older one, it goes uncaptured instead.
+		const bool slotFree = !m_captureSlots[m_nextCaptureSlot].pending;
+		m_frameGraph.setPassEnabled(m_capturePass, slotFree);
+
+		if (!slotFree)
+		{
+			++m_droppedCaptureCount;
+		}
+	}
+
+	m_frameGraph.execute(commandBuffer);
+
+	result = vkEndCommandBuffer(commandBuffer);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to record command buffer.");
+	}
+}
+
+void Engine::recordRenderPass(VkCommandBuffer commandBuffer, size_t imageIndex, bool latePhase)
+{
+	VkRenderPassBeginInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassInfo.renderPass = latePhase ? m_vkLateRenderPass : m_vkRenderPass;
+	renderPassInfo.framebuffer = m_vkSwapchainFramebuffers[imageIndex];
+	renderPassInfo.renderArea.offset = { 0, 0 };
+	renderPassInfo.renderArea.extent = m_vkSwapchainExtent;
+
+	std::array<VkClearValue, 2> clearValues = {};
+	clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
+	clearValues[1].depthStencil = { 1.0f, 0 };
+
+	// The late pass loads both attachments and needs no clear values.
+	if (!latePhase)
+	{
+		renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+		renderPassInfo.pClearValues = clearValues.data();
+	}
+
+	// Keys are per image and frame slot, the image's fence was waited on so none of its buffers is pending.
+	// Late buckets set the top bit of the low byte, levels never get that far.
+	const uint64_t keyBase = ((static_cast<uint64_t>(imageIndex) * MAX_FRAMES_IN_FLIGHT + m_currentFrame) << 8) |
+		(latePhase ? 0x80 : 0);
+	std::vector<VkCommandBuffer> bucketCommandBuffers;
+
+	for (const DrawBucket& bucket : buildDrawBuckets(latePhase))
+	{
+		uint64_t version = hashValue(FNV_OFFSET_BASIS, m_drawStateVersion);
+		version = hashValue(version, bucket.indexCount);
+		version = hashValue(version, bucket.instanceCount);
+		version = hashValue(version, bucket.firstIndex);
+		version = hashValue(version, static_cast<uint32_t>(bucket.vertexOffset));
+		version = hashValue(version, bucket.firstInstance);
+
+		bool needsRecording;
+		VkCommandBuffer bucketCommandBuffer = m_drawCommandCache.acquire(keyBase | bucket.level, version,
+			&needsRecording);
+
+		if (needsRecording)
+		{
+			recordDrawBucket(bucketCommandBuffer, imageIndex, bucket);
+		}
+
+		bucketCommandBuffers.push_back(bucketCommandBuffer);
+	}
+
+	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+	if (!bucketCommandBuffers.empty())
+	{
+		vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(bucketCommandBuffers.size()),
+			bucketCommandBuffers.data());
+	}
+
+	vkCmdEndRenderPass(commandBuffer);
+}
+
+std::vector<DrawBucket> Engine::buildDrawBuckets(bool latePhase)
+{
+	std::vector<DrawBucket> buckets;
+
+	if (m_gpuDrivenCulling)
+	{
+		DrawBucket bucket = {};
+		bucket.indirect = true;
+		bucket.late = latePhase;
+		buckets.push_back(bucket);
+		return buckets;
+	}
+
+	uint32_t firstInstance = 0;
+
+	for (uint32_t level = 0; level < m_mesh.lods.size(); ++level)
+	{
+		if (m_lodInstanceCounts[level] > 0)
+		{
+			DrawBucket bucket = {};
+			bucket.level = level;
+			bucket.indexCount = m_mesh.lods[level].indexCount;
+			bucket.instanceCount = m_lodInstanceCounts[level];
+			bucket.firstIndex = m_mesh.lods[level].firstIndex;
+			bucket.vertexOffset = m_mesh.vertexOffset;
+			bucket.firstInstance = firstInstance;
+			buckets.push_back(bucket);
+		}
+
+		firstInstance += m_lodInstanceCounts[level];
+	}
+
+	return buckets;
+}
+
+void Engine::recordDrawBucket(VkCommandBuffer commandBuffer, size_t imageIndex, const DrawBucket& bucket)
+{
+	VkCommandBufferInheritanceInfo inheritanceInfo = {};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = m_vkRenderPass;
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = m_vkSwapchainFramebuffers[imageIndex];
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+	VkResult result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to begin secondary command buffer.");
+	}
+
+	// Secondary command buffers inherit no state from the render pass they run in.
+	recordDrawState(commandBuffer, imageIndex);
+
+	const VkBuffer indirectBuffer = bucket.late ? m_vkLateIndirectBuffers[imageIndex] : m_vkIndirectBuffers[imageIndex];
+
+	if (!bucket.indirect)
+	{
+		vkCmdDrawIndexed(commandBuffer, bucket.indexCount, bucket.instanceCount, bucket.firstIndex,
+			bucket.vertexOffset, bucket.firstInstance);
+	}
+	else if (m_drawIndirectCountSupported)
+	{
+		m_vkCmdDrawIndexedIndirectCount(commandBuffer, indirectBuffer, sizeof(IndirectDrawHeader), indirectBuffer, 0,
+			static_cast<uint32_t>(m_objectBounds.size()) * m_drawsPerObject, sizeof(VkDrawIndexedIndirectCommand));
+	}
+	else
+	{
+		vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer, sizeof(IndirectDrawHeader),
+			static_cast<uint32_t>(m_objectBounds.size()) * m_drawsPerObject, sizeof(VkDrawIndexedIndirectCommand));
+	}
+
+	result = vkEndCommandBuffer(commandBuffer);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to record secondary command buffer.");
+	}
+}
+
+// Consecutive copies between the same pair of buffers go out as one multi-region copy.
+static void recordCopyBatches(VkCommandBuffer commandBuffer, const std::vector<PendingCopy>& copies)
+{
+	std::vector<VkBufferCopy> regions;
+
+	for (size_t i = 0; i < copies.size(); ++i)
+	{
+		const PendingCopy& copy = copies[i];
+
+		VkBufferCopy region = {};
+		region.srcOffset = copy.sourceOffset;
+		region.dstOffset = copy.destinationOffset;
+		region.size = copy.size;
+		regions.push_back(region);
+
+		const bool lastOfPair = i + 1 == copies.size() || copies[i + 1].source != copy.source ||
+			copies[i + 1].destination != copy.destination;
+
+		if (lastOfPair)
+		{
+			vkCmdCopyBuffer(commandBuffer, copy.source, copy.destination, static_cast<uint32_t>(regions.size()),
+				regions.data());
+			regions.clear();
+		}
+	}
+}
+
+void Engine::recordPendingCopies(VkCommandBuffer commandBuffer)
+{
+	if (m_pendingCopies.empty() && m_pendingUpdates.empty() && m_pendingMoves.empty())
+	{
+		return;
+	}
+
+	recordCopyBatches(commandBuffer, m_pendingCopies);
+	m_pendingCopies.clear();
+	m_pendingLiveCopies = false;
+
+	for (const PendingUpdate& update : m_pendingUpdates)
+	{
+		vkCmdUpdateBuffer(commandBuffer, update.destination, update.destinationOffset, update.data.size(),
+			update.data.data());
+	}
+
+	m_pendingUpdates.clear();
+
+	if (!m_pendingMoves.empty())
+	{
+		// Moves carry this frame's uploads and updates along with the allocation.
+		VkMemoryBarrier moveBarrier = {};
+		moveBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		moveBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		moveBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1,
+			&moveBarrier, 0, nullptr, 0, nullptr);
+
+		recordCopyBatches(commandBuffer, m_pendingMoves);
+		m_pendingMoves.clear();
+	}
+}
+
+void Engine::recordCullCommands(VkCommandBuffer commandBuffer, size_t imageIndex, bool latePhase)
+{
+	const VkBuffer indirectBuffer = latePhase ? m_vkLateIndirectBuffers[imageIndex] : m_vkIndirectBuffers[imageIndex];
+	vkCmdFillBuffer(commandBuffer, indirectBuffer, 0, sizeof(IndirectDrawHeader), 0);
+
+	std::vector<VkBufferMemoryBarrier> clearBarriers(1);
+	clearBarriers[0].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	clearBarriers[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	clearBarriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	clearBarriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	clearBarriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	clearBarriers[0].buffer = indirectBuffer;
+	clearBarriers[0].offset = 0;
+	clearBarriers[0].size = VK_WHOLE_SIZE;
+
+	// Nothing was drawn before the first frame, so the early phase starts out drawing nothing.
+	if (m_occlusionCulling && !m_visibilityCleared)
+	{
+		vkCmdFillBuffer(commandBuffer, m_vkVisibilityBuffer, 0, VK_WHOLE_SIZE, 0);
+		clearBarriers.push_back(clearBarriers[0]);
+		clearBarriers.back().buffer = m_vkVisibilityBuffer;
+		m_visibilityCleared = true;
+	}
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 0, nullptr, static_cast<uint32_t>(clearBarriers.size()), clearBarriers.data(), 0, nullptr);
+
+	CullPushConstants pushConstants = {};
+	pushConstants.compactDraws = m_drawIndirectCountSupported ? 1 : 0;
+	pushConstants.latePhase = latePhase ? 1 : 0;
+
+	const VkDescriptorSet descriptorSet = latePhase ? m_vkLateCullDescriptorSets[imageIndex] :
+		m_vkCullDescriptorSets[imageIndex];
+
+	const uint32_t transformOffset = static_cast<uint32_t>(m_transformRingRegionSize * m_currentFrame);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_vkCullPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_vkCullPipelineLayout, 0, 1,
+		&descriptorSet, 1, &transformOffset);
+	vkCmdPushConstants(commandBuffer, m_vkCullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+		sizeof(CullPushConstants), &pushConstants);
+
+	const uint32_t groupCount = (static_cast<uint32_t>(m_objectBounds.size()) + 63) / 64;
+	vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+}
+
+void Engine::recordDepthPyramid(VkCommandBuffer commandBuffer)
+{
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_vkDepthReducePipeline);
+
+	VkExtent2D sourceExtent = m_vkSwapchainExtent;
+
+	for (uint32_t level = 0; level < m_depthPyramidLevelCount; ++level)
+	{
+		const VkExtent2D destinationExtent = { std::max(m_depthPyramidExtent.width >> level, 1u),
+			std::max(m_depthPyramidExtent.height >> level, 1u) };
+
+		DepthReducePushConstants pushConstants = {};
+		pushConstants.sourceWidth = sourceExtent.width;
+		pushConstants.sourceHeight = sourceExtent.height;
+		pushConstants.destinationWidth = destinationExtent.width;
+		pushConstants.destinationHeight = destinationExtent.height;
+
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_vkDepthReducePipelineLayout, 0, 1,
+			&m_vkDepthReduceDescriptorSets[level], 0, nullptr);
+		vkCmdPushConstants(commandBuffer, m_vkDepthReducePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+			sizeof(DepthReducePushConstants), &pushConstants);
+		vkCmdDispatch(commandBuffer, (destinationExtent.width + 7) / 8, (destinationExtent.height + 7) / 8, 1);
+
+		// The next level reads this one, the frame graph covers whoever reads after the last.
+		if (level + 1 < m_depthPyramidLevelCount)
+		{
+			VkImageMemoryBarrier levelBarrier = {};
+			levelBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			levelBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+			levelBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+			levelBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			levelBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			levelBarrier.image = m_vkDepthPyramidImage;
+			levelBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			levelBarrier.subresourceRange.baseMipLevel = level;
+			levelBarrier.subresourceRange.levelCount = 1;
+			levelBarrier.subresourceRange.layerCount = 1;
+
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &levelBarrier);
+		}
+
+		sourceExtent = destinationExtent;
+	}
+}
+
+void Engine::recordCapture(VkCommandBuffer commandBuffer)
+{
+	CaptureSlot& slot = m_captureSlots[m_nextCaptureSlot];
+
+	VkBufferImageCopy region = {};
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent = { m_vkSwapchainExtent.width, m_vkSwapchainExtent.height, 1 };
+
+	vkCmdCopyImageToBuffer(commandBuffer, m_vkSwapchainImages[m_currentImage], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		slot.buffer, 1, &region);
+
+	// Makes the copy visible to the host once the frame's fence has signaled.
+	VkBufferMemoryBarrier hostBarrier = {};
+	hostBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	hostBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	hostBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	hostBarrier.buffer = slot.buffer;
+	hostBarrier.offset = 0;
+	hostBarrier.size = VK_WHOLE_SIZE;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr,
+		1, &hostBarrier, 0, nullptr);
+
+	// Recording happens right before submission, so the frame number is the one this copy is submitted in.
+	slot.frameNumber = m_frameNumber;
+	slot.pending = true;
+	m_nextCaptureSlot = (m_nextCaptureSlot + 1) % m_captureSlots.size();
+}
+
+void Engine::collectCaptures(bool deviceIdle)
+{
+	const bool bgra = m_vkSwapchainImageFormat == VK_FORMAT_B8G8R8A8_UNORM ||
+		m_vkSwapchainImageFormat == VK_FORMAT_B8G8R8A8_SRGB;
+
+	// Oldest first, so frames reach the writer in order.
+	for (size_t i = 0; i < m_captureSlots.size(); ++i)
+	{
+		CaptureSlot& slot = m_captureSlots[(m_nextCaptureSlot + i) % m_captureSlots.size()];
+
+		if (!slot.pending)
+		{
+			continue;
+		}
+
+		// Frames older than the ones in flight were waited on. A newer frame's fence is not reset
+		// before its slot comes around again, so polling it tells whether that frame is done.
+		const bool complete = deviceIdle || slot.frameNumber + MAX_FRAMES_IN_FLIGHT <= m_frameNumber ||
+			vkGetFenceStatus(m_vkDevice, m_vkFences[slot.frameNumber % MAX_FRAMES_IN_FLIGHT]) == VK_SUCCESS;
+
+		if (!complete)
+		{
+			break;
+		}
+
+		CapturedFrame frame = {};
+		frame.frameNumber = slot.frameNumber;
+		frame.width = m_vkSwapchainExtent.width;
+		frame.height = m_vkSwapchainExtent.height;
+		frame.bgra = bgra;
+		frame.pixels = m_frameCapture.takePixels();
+		frame.pixels.resize(static_cast<size_t>(frame.width) * frame.height * 4);
+		memcpy(frame.pixels.data(), slot.mappedMemory, frame.pixels.size());
+		slot.pending = false;
+
+		if (!m_frameCapture.submit(std::move(frame)))
+		{
+			++m_droppedCaptureCount;
+		}
+	}
+}
+
+void Engine::recordDeformCommands(VkCommandBuffer commandBuffer)
+{
+	const uint32_t parameterOffset = static_cast<uint32_t>(m_deformParameterRegionSize * m_currentFrame);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_vkDeformPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_vkDeformPipelineLayout, 0, 1,
+		&m_vkDeformDescriptorSets[m_currentFrame], 1, &parameterOffset);
+
+	const uint32_t groupCount = (static_cast<uint32_t>(m_vertices.size()) + 63) / 64;
+	vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+}
+
+void Engine::recordDrawState(VkCommandBuffer commandBuffer, size_t imageIndex)
+{
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_vkPipeline);
+
+	const uint32_t transformOffset = static_cast<uint32_t>(m_transformRingRegionSize * m_currentFrame);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_vkPipelineLayout, 0, 1,
+		&m_vkDrawDescriptorSets[m_currentFrame], 1, &transformOffset);
+
+	FramePushConstants pushConstants = {};
+	pushConstants.viewProjection = m_viewProjection;
+	pushConstants.vertexFormat = m_mesh.vertexFormat;
+	vkCmdPushConstants(commandBuffer, m_vkPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+		sizeof(FramePushConstants), &pushConstants);
+
+	if (m_vertexPulling)
+	{
+		VkDeviceSize bufferOffset = 0;
+		vkCmdBindVertexBuffers(commandBuffer, 1, 1, &m_vkInstanceBuffers[imageIndex], &bufferOffset);
+	}
+	else
+	{
+		VkBuffer buffers[] = { m_geometryPool.getBuffer(m_vertexAllocation), m_vkInstanceBuffers[imageIndex] };
+		VkDeviceSize bufferOffsets[] = { m_geometryPool.getOffset(m_vertexAllocation), 0 };
+		vkCmdBindVertexBuffers(commandBuffer, 0, 2, buffers, bufferOffsets);
+	}
+
+	vkCmdBindIndexBuffer(commandBuffer, m_geometryPool.getBuffer(m_indexAllocation),
+		m_geometryPool.getOffset(m_indexAllocation), VK_INDEX_TYPE_UINT32);
+}
+
+void Engine::writeInstances(size_t imageIndex)
+{
+	// The GPU-driven path selects objects through firstInstance, so its buffers keep
+	// the identity mapping written at creation.
+	if (!m_gpuDrivenCulling)
+	{
+		memcpy(m_instanceMappedMemories[imageIndex], m_drawList.data(), sizeof(uint32_t) * m_visibleObjectCount);
+	}
+}
+
+void Engine::writeTransforms()
+{
+	InstanceData* region = reinterpret_cast<InstanceData*>(
+		static_cast<char*>(m_transformRingMappedMemory) + m_transformRingRegionSize * m_currentFrame);
+
+	for (size_t i = 0; i < m_instances.size(); ++i)
+	{
+		if (m_instanceDirtyFrames[i] > 0)
+		{
+			region[i] = m_instances[i];
+			--m_instanceDirtyFrames[i];
+		}
+	}
+}
+
+void Engine::writeCullInput(size_t imageIndex)
+{
+	CullInputHeader header = {};
+	const std::array<glm::vec4, 6> frustumPlanes = computeFrustumPlanes(m_viewProjection);
+	std::copy(frustumPlanes.begin(), frustumPlanes.end(), header.frustumPlanes);
+	header.viewProjectionRow3 = glm::row(m_viewProjection, 3);
+	header.viewProjection = m_viewProjection;
+	header.objectCount = static_cast<uint32_t>(m_objectBounds.size());
+	header.lodCount = static_cast<uint32_t>(m_mesh.lods.size());
+	header.lodErrorScale = computeProjectedRadiusScale() / LOD_ERROR_THRESHOLD_PIXELS;
+	header.drawsPerObject = m_drawsPerObject;
+
+	// The eye is where clip x, y and w all vanish. Its sign is chosen so that a triangle faces the camera
+	// exactly when dot(normal, eye.xyz - eye.w * point) is positive, checked on a triangle that is drawn
+	// clockwise on screen.
+	const glm::mat4 inverseViewProjection = glm::inverse(m_viewProjection);
+	glm::vec4 eye = inverseViewProjection * glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+
+	auto unproject = [&inverseViewProjection](float x, float y)
+	{
+		const glm::vec4 point = inverseViewProjection * glm::vec4(x, y, 0.5f, 1.0f);
+		return glm::vec3(point) / point.w;
+	};
+
+	const glm::vec3 corner = unproject(0.0f, 0.0f);
+	const glm::vec3 frontNormal = glm::cross(unproject(1.0f, 0.0f) - corner, unproject(1.0f, 1.0f) - corner);
+
+	if (glm::dot(frontNormal, glm::vec3(eye) - eye.w * corner) < 0.0f)
+	{
+		eye = -eye;
+	}
+
+	header.eyePosition = eye;
+
+	for (size_t level = 0; level < m_mesh.lods.size(); ++level)
+	{
+		header.lodRanges[level] = glm::uvec4(m_mesh.lods[level].firstIndex, m_mesh.lods[level].indexCount,
+			static_cast<uint32_t>(m_mesh.vertexOffset), 0);
+		header.lodErrors[static_cast<glm::length_t>(level)] = m_mesh.lods[level].error;
+		header.lodMeshlets[level] = glm::uvec4(m_mesh.lods[level].firstMeshlet, m_mesh.lods[level].meshletCount, 0, 0);
+	}
+
+	char* mappedMemory = static_cast<char*>(m_cullInputMappedMemories[imageIndex]);
+	memcpy(mappedMemory, &header, sizeof(CullInputHeader));
+
+	glm::vec4* mappedSpheres = reinterpret_cast<glm::vec4*>(mappedMemory + sizeof(CullInputHeader));
+	for (size_t i = 0; i < m_objectBounds.size(); ++i)
+	{
+		mappedSpheres[i] = m_objectBounds.get(i);
+	}
+}
+
+void Engine::writeDeformParameters()
+{
+	const float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - m_startTime).count();
+
+	DeformParameters* parameters = reinterpret_cast<DeformParameters*>(
+		static_cast<char*>(m_deformParameterMappedMemory) + m_deformParameterRegionSize * m_currentFrame);
+
+	computeChainPalette(m_rig, seconds, parameters->bones);
+	parameters->morphWeights = computeMorphWeights(seconds);
+	parameters->vertexCount = static_cast<uint32_t>(m_vertices.size());
+	parameters->morphTargetCount = m_morphTargetCount;
+	parameters->outputFormat = m_mesh.vertexFormat;
+}
+
+std::array<glm::vec4, 6> Engine::computeFrustumPlanes(const glm::mat4& viewProjection)
+{
+	const glm::vec4 row0 = glm::row(viewProjection, 0);
+	const glm::vec4 row1 = glm::row(viewProjection, 1);
+	const glm::vec4 row2 = glm::row(viewProjection, 2);
+	const glm::vec4 row3 = glm::row(viewProjection, 3);
+
+	// Clip space depth is [0, 1] in Vulkan, so the near plane is row2 alone.
+	std::array<glm::vec4, 6> planes = {
+		row3 + row0,
+		row3 - row0,
+		row3 + row1,
+		row3 - row1,
+		row2,
+		row3 - row2
+	};
+
+	for (glm::vec4& plane : planes)
+	{
+		plane /= glm::length(glm::vec3(plane));
+	}
+
+	return planes;
+}
+
+glm::vec4 Engine::computeBoundingSphere(const glm::mat4& transform)
+{
+	const float scale = glm::max(glm::length(glm::vec3(transform[0])),
+		glm::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+
+	return glm::vec4(glm::vec3(transform[3]), m_mesh.boundingRadius * scale);
+}
+
+float Engine::computeProjectedRadiusScale()
+{
+	return glm::abs(m_viewProjection[1][1]) * m_vkSwapchainExtent.height * 0.5f;
+}
+
+float Engine::computeProjectedRadius(const glm::vec4& sphere)
+{
+	const float clipW = glm::dot(glm::row(m_viewProjection, 3), glm::vec4(glm::vec3(sphere), 1.0f));
+	return sphere.w * computeProjectedRadiusScale() / glm::max(clipW, 0.0001f);
+}
+
+void Engine::buildDrawList()
+{
+	m_lodInstanceCounts.fill(0);
+
+	for (size_t i = 0; i < m_visibleObjectCount; ++i)
+	{
+		const float projectedRadius = computeProjectedRadius(m_objectBounds.get(m_visibleObjects[i]));
+		m_visibleLods[i] = selectLod(m_mesh, projectedRadius, LOD_ERROR_THRESHOLD_PIXELS);
+		++m_lodInstanceCounts[m_visibleLods[i]];
+	}
+
+	std::array<uint32_t, MAX_LOD_COUNT> lodOffsets = {};
+	for (size_t level = 1; level < MAX_LOD_COUNT; ++level)
+	{
+		lodOffsets[level] = lodOffsets[level - 1] + m_lodInstanceCounts[level - 1];
+	}
+
+	for (size_t i = 0; i < m_visibleObjectCount; ++i)
+	{
+		m_drawList[lodOffsets[m_visibleLods[i]]++] = m_visibleObjects[i];
+	}
+}
+
+uint32_t Engine::computeDrawsPerObject()
+{
+	uint32_t meshletCount = 0;
+
+	if (m_clusterCulling)
+	{
+		for (const MeshLod& lod : m_mesh.lods)
+		{
+			meshletCount = std::max(meshletCount, lod.meshletCount);
+		}
+	}
+
+	// Every indirect call draws all slots, which the device may cap as low as 65535. Objects whose level
+	// has more meshlets than their share of slots are drawn whole.
+	const uint32_t objectCount = std::max(static_cast<uint32_t>(m_objectBounds.size()), 1u);
+	const uint32_t maxDrawCount = std::min(MAX_CLUSTER_DRAW_COUNT, m_maxDrawIndirectCount);
+	return std::max(std::min(meshletCount, maxDrawCount / objectCount), 1u);
+}
+
+void Engine::createSemaphores()
+{
+	m_vkImageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+	m_vkRenderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+
+	VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+	semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+	{
+		VkResult result = vkCreateSemaphore(m_vkDevice, &semaphoreCreateInfo, m_vkAllocator, &m_vkImageAvailableSemaphores[i]);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create image available semaphore.");
+		}
+
+		result = vkCreateSemaphore(m_vkDevice, &semaphoreCreateInfo, m_vkAllocator, &m_vkRenderFinishedSemaphores[i]);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create render finished semaphore.");
+		}
+	}
+
+}
+
+void Engine::createFences()
+{
+	m_vkFences.resize(MAX_FRAMES_IN_FLIGHT);
+	m_vkImagesInFlightFences.resize(m_vkSwapchainImages.size(), VK_NULL_HANDLE);
+
+	VkFenceCreateInfo fenceCreateInfo = {};
+	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+	{
+		VkResult result = vkCreateFence(m_vkDevice, &fenceCreateInfo, m_vkAllocator, &m_vkFences[i]);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create fance.");
+		}
+	}
+}
+
+void Engine::createCaptureBuffers()
+{
+	// One more buffer than frames in flight, so a frame can be copied while the oldest is read back.
+	m_captureSlots.resize(MAX_FRAMES_IN_FLIGHT + 1);
+	m_nextCaptureSlot = 0;
+
+	const VkDeviceSize captureSize = static_cast<VkDeviceSize>(m_vkSwapchainExtent.width) *
+		m_vkSwapchainExtent.height * 4;
+
+	// Reading uncached memory from the CPU is very slow, cached memory is used wherever it exists.
+	VkMemoryPropertyFlags propertyFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
+		VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+	uint32_t memoryTypeIndex;
+
+	if (!findMemoryType(m_vkPhysicalDevice, getBufferMemoryTypeBits(VK_BUFFER_USAGE_TRANSFER_DST_BIT), propertyFlags,
+		&memoryTypeIndex))
+	{
+		propertyFlags &= ~VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+	}
+
+	for (CaptureSlot& slot : m_captureSlots)
+	{
+		slot = {};
+		createBuffer(captureSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, propertyFlags, &slot.buffer, &slot.memory);
+
+		VkResult result = vkMapMemory(m_vkDevice, slot.memory, 0, captureSize, 0, &slot.mappedMemory);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to map capture memory.");
+		}
+	}
+
+	m_frameCapture.start(m_captureDirectory, m_captureFormat);
+}
+
+std::array<VkVertexInputBindingDescription, 2> Engine::buildVertexBindingDescription()
+{
+	std::array<VkVertexInputBindingDescription, 2> bindingDescriptions = {};
+
+	bindingDescriptions[0].binding = 0;
+	bindingDescriptions[0].stride = sizeof(Vertex);
+	bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+	bindingDescriptions[1].binding = 1;
+	bindingDescriptions[1].stride = sizeof(uint32_t);
+	bindingDescriptions[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+	return bindingDescriptions;
+}
+
+std::array<VkVertexInputAttributeDescription, 3> Engine::buildVertexAttributeDescription()
+{
+	std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions = {};
+
+	attributeDescriptions[0].binding = 0;
+	attributeDescriptions[0].location = 0;
+	attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+	attributeDescriptions[0].offset = offsetof(Vertex, position);
+
+	attributeDescriptions[1].binding = 0;
+	attributeDescriptions[1].location = 1;
+	attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+	attributeDescriptions[1].offset = offsetof(Vertex, color);
+
+	attributeDescriptions[2].binding = 1;
+	attributeDescriptions[2].location = 2;
+	attributeDescriptions[2].format = VK_FORMAT_R32_UINT;
+	attributeDescriptions[2].offset = 0;
+
+	return attributeDescriptions;
+}
+
+uint32_t Engine::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags propertyFlags)
+{
+	uint32_t typeIndex;
+
+	if (!findMemoryType(m_vkPhysicalDevice, typeFilter, propertyFlags, &typeIndex))
+	{
+		throw std::runtime_error("Can't find memory type.");
+	}
+
+	return typeIndex;
+}
+
+uint32_t Engine::getBufferMemoryTypeBits(VkBufferUsageFlags usageFlags)
+{
+	// Buffers created with the same usage accept the same memory types, a tiny one is enough to ask.
+	VkBufferCreateInfo bufferCreateInfo = {};
+	bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferCreateInfo.size = 1;
+	bufferCreateInfo.usage = usageFlags;
+	bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkBuffer buffer;
+	VkResult result = vkCreateBuffer(m_vkDevice, &bufferCreateInfo, m_vkAllocator, &buffer);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create buffer.");
+	}
+
+	VkMemoryRequirements memoryRequirements;
+	vkGetBufferMemoryRequirements(m_vkDevice, buffer, &memoryRequirements);
+	vkDestroyBuffer(m_vkDevice, buffer, m_vkAllocator);
+
+	return memoryRequirements.memoryTypeBits;
+}
+
+bool Engine::findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags propertyFlags,
+	uint32_t* outTypeIndex)
+{
+	VkPhysicalDeviceMemoryProperties deviceMemoryProperties;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &deviceMemoryProperties);
+
+	for (uint32_t i = 0; i < deviceMemoryProperties.memoryTypeCount; ++i)
+	{
+		if ((typeFilter & (1 << i)) && 
+			(deviceMemoryProperties.memoryTypes[i].propertyFlags & propertyFlags) == propertyFlags)
+		{
+			*outTypeIndex = i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+VkShaderModule Engine::loadShader(const char* fileName)
+{
+	std::ifstream istr(fileName, std::ios::ate | std::ios::binary);
+
+	if (!istr.is_open())
+	{
+		throw std::runtime_error("Failed to open shader file.");
+	}
+
+	size_t fileSize = static_cast<size_t>(istr.tellg());
+	std::vector<char> buffer(fileSize);
+	istr.seekg(0);
+	istr.read(buffer.data(), fileSize);
+	istr.close();
+
+	VkShaderModuleCreateInfo shaderModuleCreateInfo = {};
+	shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	shaderModuleCreateInfo.codeSize = fileSize;
+	shaderModuleCreateInfo.pCode = reinterpret_cast<uint32_t*>(buffer.data());
+
+	VkShaderModule shaderModule;
+	VkResult result = vkCreateShaderModule(m_vkDevice, &shaderModuleCreateInfo, m_vkAllocator, &shaderModule);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create shader module.");
+	}
+
+	return shaderModule;
+}
+
+QueueFamilyIndices Engine::findQueueFamilyIndices(VkPhysicalDevice physicalDevice)
+{
+	QueueFamilyIndices queueFamilyIndices;
+
+	unsigned int familyCount;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+
+	std::vector<VkQueueFamilyProperties> queueFamilies(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, queueFamilies.data());
+
+	for (unsigned int index = 0; index < familyCount; ++index)
+	{
+		const bool graphicsSupport = (queueFamilies[index].queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+
+		VkBool32 presentSupport = false;
+		vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, index, m_vkSurface, &presentSupport);
+
+		// One family doing both, as integrated GPUs and CPU implementations expose, needs no image sharing.
+		if (graphicsSupport && presentSupport)
+		{
+			queueFamilyIndices.graphics = index;
+			queueFamilyIndices.presentation = index;
+			return queueFamilyIndices;
+		}
+
+		if (graphicsSupport && !queueFamilyIndices.graphics.has_value())
+		{
+			queueFamilyIndices.graphics = index;
+		}
+
+		if (presentSupport && !queueFamilyIndices.presentation.has_value())
+		{
+			queueFamilyIndices.presentation = index;
+		}
+	}
+
+	// Either index stays empty when the device has no such family, checkQueueFamiliesSupport rejects it then.
+	return queueFamilyIndices;
+}
+
+SwapChainSupportDetails Engine::querySwapChainSupport(VkPhysicalDevice physicalDevice)
+{
+	SwapChainSupportDetails supportDetails;
+
+	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, m_vkSurface, &supportDetails.capabilities);
+
+	uint32_t formatCount;
+	vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, m_vkSurface, &formatCount, nullptr);
+
+	if (formatCount > 0)
+	{
+		supportDetails.formats.resize(formatCount);
+		vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, m_vkSurface, &formatCount, supportDetails.formats.data());
+	}
+
+	uint32_t presentModeCount;
+	vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, m_vkSurface, &presentModeCount, nullptr);
+
+	if (presentModeCount > 0)
+	{
+		supportDetails.presentModes.resize(presentModeCount);
+		vkGetPhysicalDeviceSurfacePresentModesKHR(
+			physicalDevice, m_vkSurface, &presentModeCount, supportDetails.presentModes.data());
+	}
+
+	return supportDetails;
+}
+
+VkSurfaceFormatKHR Engine::chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& formats)
+{
+	return formats[0];
+}
+
+VkPresentModeKHR Engine::chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& presentModes)
+{
+	return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+VkExtent2D Engine::chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities)
+{
+	VkExtent2D extent;
+
+	if (capabilities.currentExtent.width == UINT32_MAX)
+	{
+		int width, height;
+		SDL_Vulkan_GetDrawableSize(m_sdlWindow, &width, &height);
+
+		glm::clamp(static_cast<uint32_t>(height), capabilities.minImageExtent.height, capabilities.maxImageExtent.height);
+		glm::clamp(static_cast<uint32_t>(width), capabilities.minImageExtent.width, capabilities.maxImageExtent.width);
+	}
+	else
+	{
+		extent = capabilities.currentExtent;
+	}
+
+	return extent;
+}
+
+VkFormat Engine::chooseDepthFormat()
+{
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(m_vkPhysicalDevice, VK_FORMAT_D32_SFLOAT, &formatProperties);
+
+	// D16 is guaranteed to be usable as a depth attachment and to be sampled, D32 only preferred for its precision.
+	VkFormatFeatureFlags requiredFeatures = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT;
+
+	if (m_occlusionCulling)
+	{
+		requiredFeatures |= VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+	}
+
+	if ((formatProperties.optimalTilingFeatures & requiredFeatures) == requiredFeatures)
+	{
+		return VK_FORMAT_D32_SFLOAT;
+	}
+
+	return VK_FORMAT_D16_UNORM;
+}
+
+bool Engine::checkDeviceExtensionSupport(VkPhysicalDevice physicalDevice)
+{
+	uint32_t availableExtensionCount;
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &availableExtensionCount, nullptr);
+	std::vector<VkExtensionProperties> availableExtensions(availableExtensionCount);
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &availableExtensionCount, availableExtensions.data());
+
+	std::set<std::string> unavailableExtensions(m_deviceExtensions.begin(), m_deviceExtensions.end());
+
+	for (VkExtensionProperties& available : availableExtensions)
+	{
+		unavailableExtensions.erase(available.extensionName);
+	}
+
+	return unavailableExtensions.empty();
+}
+
+bool Engine::checkSwapchainSupport(VkPhysicalDevice physicalDevice)
+{
+	SwapChainSupportDetails swapchainSupportDetails = querySwapChainSupport(physicalDevice);
+	return !swapchainSupportDetails.presentModes.empty() &&
+		!swapchainSupportDetails.formats.empty();
+}
+
+bool Engine::checkQueueFamiliesSupport(VkPhysicalDevice physicalDevice)
+{
+	QueueFamilyIndices indices = findQueueFamilyIndices(physicalDevice);
+	return indices.graphics.has_value() && indices.presentation.has_value();
+}
+
+bool Engine::checkDeviceExtensionSupport(VkPhysicalDevice physicalDevice, const char* extensionName)
+{
+	uint32_t availableExtensionCount;
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &availableExtensionCount, nullptr);
+	std::vector<VkExtensionProperties> availableExtensions(availableExtensionCount);
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &availableExtensionCount, availableExtensions.data());
+
+	for (VkExtensionProperties& available : availableExtensions)
+	{
+		if (strcmp(available.extensionName, extensionName) == 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool Engine::checkInstanceExtensionSupport(const char* extensionName)
+{
+	uint32_t availableExtensionCount;
+	vkEnumerateInstanceExtensionProperties(nullptr, &availableExtensionCount, nullptr);
+	std::vector<VkExtensionProperties> availableExtensions(availableExtensionCount);
+	vkEnumerateInstanceExtensionProperties(nullptr, &availableExtensionCount, availableExtensions.data());
+
+	for (VkExtensionProperties& available : availableExtensions)
+	{
+		if (strcmp(available.extensionName, extensionName) == 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool Engine::checkUnifiedMemorySupport(VkPhysicalDevice physicalDevice)
+{
+	uint32_t typeIndex;
+
+	// A unified type the geometry blocks can't be bound to is no use.
+	if (!findMemoryType(physicalDevice, getBufferMemoryTypeBits(GEOMETRY_BLOCK_USAGE_FLAGS),
+		UNIFIED_MEMORY_PROPERTY_FLAGS, &typeIndex))
+	{
+		return false;
+	}
+
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+	VkDeviceSize largestDeviceLocalHeap = 0;
+	for (uint32_t heap = 0; heap < memoryProperties.memoryHeapCount; ++heap)
+	{
+		if (memoryProperties.memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+		{
+			largestDeviceLocalHeap = std::max(largestDeviceLocalHeap, memoryProperties.memoryHeaps[heap].size);
+		}
+	}
+
+	// Discrete GPUs without resizable BAR only expose a small host-visible window of VRAM, which
+	// is too scarce for geometry. Integrated GPUs, CPU implementations and resizable BAR map it all.
+	const uint32_t heapIndex = memoryProperties.memoryTypes[typeIndex].heapIndex;
+	return memoryProperties.memoryHeaps[heapIndex].size == largestDeviceLocalHeap;
+}
+
+std::optional<uint32_t> Engine::findTransferQueueFamily(VkPhysicalDevice physicalDevice)
+{
+	const QueueFamilyIndices queueFamilyIndices = findQueueFamilyIndices(physicalDevice);
+
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+	// Only a family that can't draw or dispatch is backed by a copy engine running beside the frame.
+	for (uint32_t i = 0; i < queueFamilyCount; ++i)
+	{
+		const VkQueueFlags flags = queueFamilies[i].queueFlags;
+
+		if ((flags & VK_QUEUE_TRANSFER_BIT) != 0 && (flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) == 0 &&
+			i != *queueFamilyIndices.presentation)
+		{
+			return i;
+		}
+	}
+
+	return std::nullopt;
+}
+
+bool Engine::checkGpuDrivenCullingSupport(VkPhysicalDevice physicalDevice)
+{
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+
+	uint32_t familyCount;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, queueFamilies.data());
+
+	QueueFamilyIndices indices = findQueueFamilyIndices(physicalDevice);
+
+	return supportedFeatures.multiDrawIndirect &&
+		supportedFeatures.drawIndirectFirstInstance &&
+		(queueFamilies[*indices.graphics].queueFlags & VK_QUEUE_COMPUTE_BIT);
+}
+
+Engine::Engine()
+	: MAX_FRAMES_IN_FLIGHT(2),
+	INSTANCE_GRID_SIZE(64),
+	DEFORM_BONE_COUNT(8),
+	LOD_ERROR_THRESHOLD_PIXELS(2.0f),
+	GEOMETRY_BLOCK_SIZE(256 * 1024),
+	DEFRAGMENT_BYTES_PER_FRAME(64 * 1024),
+	INLINE_UPDATE_MAX_SIZE(256),
+	MAX_CLUSTER_DRAW_COUNT(1024 * 1024),
+	UPLOAD_QUEUE_STAGING_SIZE(4 * 1024 * 1024),
+	UPLOAD_QUEUE_CELL_COUNT(64),
+	m_vkAllocator(m_hostAllocator.getCallbacks(HostArena::Object)),
+	m_vkDevice(VK_NULL_HANDLE),
+	m_vkTransferQueue(VK_NULL_HANDLE),
+	m_uploadStrategy(),
+	m_uploadStrategyCached(false),
+	m_graphicsSubmitLatency(0.0),
+	m_transferSubmitLatency(0.0),
+	m_stagingChunk(),
+	m_vkTransferCommandPool(VK_NULL_HANDLE),
+	m_drawStateVersion(0),
+	m_frameNumber(0),
+	m_currentImage(0),
+	m_physicalDeviceProperties2Supported(false),
+	m_unifiedMemory(false),
+	m_pendingLiveCopies(false),
+	m_meshGridSize(16),
+	m_meshVersion(0),
+	m_geometryDecoded(true),
+	m_viewProjection(1.0f),
+	m_gpuDrivenCulling(true),
+	m_occlusionCulling(false),
+	m_clusterCulling(true),
+	m_drawsPerObject(1),
+	m_maxDrawIndirectCount(1),
+	m_vertexPulling(false),
+	m_vertexDeformation(false),
+	m_onDemandRendering(false),
+	m_sceneVersion(1),
+	m_renderedSceneVersion(0),
+	m_skippedFrameCount(0),
+	m_captureFrames(false),
+	m_captureFormat(CaptureFormat::Raw),
+	m_nextCaptureSlot(0),
+	m_droppedCaptureCount(0),
+	m_drawIndirectCountSupported(false),
+	m_vkCmdDrawIndexedIndirectCount(nullptr)
+{
+}
+
+void Engine::setGpuDrivenCulling(bool enabled)
+{
+	m_gpuDrivenCulling = enabled;
+}
+
+void Engine::setOcclusionCulling(bool enabled)
+{
+	m_occlusionCulling = enabled;
+}
+
+void Engine::setClusterCulling(bool enabled)
+{
+	m_clusterCulling = enabled;
+}
+
+void Engine::setVertexPulling(bool enabled)
+{
+	if (m_vkDevice == VK_NULL_HANDLE || enabled == m_vertexPulling)
+	{
+		m_vertexPulling = enabled;
+		return;
+	}
+
+	// Frames in flight still draw with the old pipeline.
+	m_deletionQueue.retire(m_frameNumber, m_vkPipeline);
+	m_vertexPulling = enabled;
+	createGraphicsPipeline();
+	++m_drawStateVersion;
+	++m_sceneVersion;
+}
+
+void Engine::setVertexDeformation(bool enabled)
+{
+	m_vertexDeformation = enabled;
+}
+
+void Engine::setOnDemandRendering(bool enabled)
+{
+	m_onDemandRendering = enabled;
+}
+
+void Engine::setFrameCapture(const std::string& directory, CaptureFormat format)
+{
+	m_captureFrames = true;
+	m_captureDirectory = directory;
+	m_captureFormat = format;
+}
+
+void Engine::init(SDL_Window* sdlWindow)
+{
+	m_sdlWindow = sdlWindow;
+	m_currentFrame = 0;
+	m_startTime = std::chrono::steady_clock::now();
+	m_cullingInstructionSet = chooseCullingInstructionSet();
+	m_codecInstructionSet = chooseCodecInstructionSet();
+
+	initVkInstance();
+	createVkSurface();
+	pickPhysicalDevice();
+	createDevice();
+	chooseUploadStrategy();
+	createSwapChain();
+	createSwapChainImageViews();
+	createRenderPass();
+	createDescriptorSetLayout();
+	createPipelineLayout();
+	createGraphicsPipeline();
 
-	return attributeDescriptions;
-}
+	if (m_occlusionCulling)
+	{
+		createDepthPyramid();
+	}
 
-uint32_t Engine::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags propertyFlags)
-{
-	VkPhysicalDeviceMemoryProperties deviceMemoryProperties;
-	vkGetPhysicalDeviceMemoryProperties(m_vkPhysicalDevice, &deviceMemoryProperties);
+	createFrameGraph();
+	createFramebuffers();
+	createCommandPool();
+	createMesh();
+	createVertexBuffer();
+	createIndexBuffer();
+	createMeshletBuffer();
+	createUploadQueue();
 
-	for (uint32_t i = 0; i < deviceMemoryProperties.memoryTypeCount; ++i)
+	if (m_vertexDeformation)
 	{
-		if ((typeFilter & (1 << i)) && 
-			(deviceMemoryProperties.memoryTypes[i].propertyFlags & propertyFlags) == propertyFlags)
-		{
-			return i;
-		}
+		createDeformBuffers();
+		createDeformParameterBuffer();
 	}
 
-	throw std::runtime_error("Can't find memory type.");
-}
+	createInstances();
+	createInstanceBuffers();
+	createTransformRing();
+	createDescriptorPool();
+	createDrawDescriptorSets();
 
-VkShaderModule Engine::loadShader(const char* fileName)
-{
-	std::ifstream istr(fileName, std::ios::ate | std::ios::binary);
+	if (m_gpuDrivenCulling)
+	{
+		createCullPipeline();
+		createCullBuffers();
+		createCullDescriptorSets();
+	}
 
-	if (!istr.is_open())
+	if (m_occlusionCulling)
 	{
-		throw std::runtime_error("Failed to open shader file.");
+		createDepthReducePipeline();
+		createDepthReduceDescriptorSets();
 	}
 
-	size_t fileSize = static_cast<size_t>(istr.tellg());
-	std::vector<char> buffer(fileSize);
-	istr.seekg(0);
-	istr.read(buffer.data(), fileSize);
-	istr.close();
+	if (m_vertexDeformation)
+	{
+		createDeformPipeline();
+		createDeformDescriptorSets();
+	}
 
-	VkShaderModuleCreateInfo shaderModuleCreateInfo = {};
-	shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	shaderModuleCreateInfo.codeSize = fileSize;
-	shaderModuleCreateInfo.pCode = reinterpret_cast<uint32_t*>(buffer.data());
+	m_descriptorSetMeshVersions.resize(MAX_FRAMES_IN_FLIGHT);
+	for (size_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame)
+	{
+		writeFrameDescriptorSets(frame);
+	}
 
-	VkShaderModule shaderModule;
-	VkResult result = vkCreateShaderModule(m_vkDevice, &shaderModuleCreateInfo, nullptr, &shaderModule);
-	if (result != VK_SUCCESS)
+	createCommandBuffers();
+	createSemaphores();
+	createFences();
+
+	if (m_uploadStrategy.transferQueue)
 	{
-		throw std::runtime_error("Failed to create shader module.");
+		createTransferCommandBuffers();
 	}
 
-	return shaderModule;
+	if (m_captureFrames)
+	{
+		createCaptureBuffers();
+	}
 }
 
-QueueFamilyIndices Engine::findQueueFamilyIndices(VkPhysicalDevice physicalDevice)
+void Engine::reloadMesh(uint32_t gridSize)
 {
-	QueueFamilyIndices queueFamilyIndices;
+	if (gridSize == m_meshGridSize)
+	{
+		return;
+	}
 
-	unsigned int familyCount;
-	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+	// Edits still waiting for the next frame belong to the outgoing geometry.
+	flushGeometryUpdates();
+	// Another thread may have built the requested mesh already.
+	drainUploadQueue();
+
+	// Frames already submitted keep drawing the old geometry, which stays resident until
+	// memory pressure evicts it. Its compressed streams stay cached either way.
+	CachedGeometry previous = {};
+	// Streams the mesh was restored from are still exact unless an edit dropped them.
+	previous.encodedVertices = !m_encodedVertices.empty() ? std::move(m_encodedVertices) :
+		encodeWords(reinterpret_cast<const uint32_t*>(m_vertices.data()), m_vertices.size(),
+			sizeof(Vertex) / sizeof(uint32_t));
+	previous.encodedIndices = !m_encodedIndices.empty() ? std::move(m_encodedIndices) :
+		encodeWords(m_indices.data(), m_indices.size(), 1);
+	previous.mesh = m_mesh;
+	previous.vertexAllocation = m_vertexAllocation;
+	previous.indexAllocation = m_indexAllocation;
+	previous.meshletAllocation = m_meshletAllocation;
+	previous.lastUsedFrame = m_frameNumber;
+
+	const uint32_t previousGridSize = m_meshGridSize;
+	m_meshGridSize = gridSize;
+
+	if (m_vertexDeformation)
+	{
+		m_deletionQueue.retire(m_frameNumber, m_vkSkinnedVertexBuffer, m_vkSkinnedVertexDeviceMemory);
+		m_deletionQueue.retire(m_frameNumber, m_vkMorphTargetBuffer, m_vkMorphTargetDeviceMemory);
+	}
 
-	std::vector<VkQueueFamilyProperties> queueFamilies(familyCount);
-	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, queueFamilies.data());
+	auto cached = m_geometryCache.find(gridSize);
 
-	unsigned int index = 0;
-	for (VkQueueFamilyProperties queueFamily : queueFamilies)
+	if (cached != m_geometryCache.end())
 	{
-		if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+		CachedGeometry geometry = std::move(cached->second);
+		m_geometryCache.erase(cached);
+
+		// Nothing on the CPU reads the vertices or indices until an edit or deformation asks for them.
+		m_encodedVertices = std::move(geometry.encodedVertices);
+		m_encodedIndices = std::move(geometry.encodedIndices);
+		m_vertices.clear();
+		m_indices.clear();
+		m_geometryDecoded = false;
+		m_mesh = geometry.mesh;
+
+		if (geometry.vertexAllocation != INVALID_GEOMETRY_ALLOCATION)
 		{
-			if (!queueFamilyIndices.graphics.has_value())
-			{
-				queueFamilyIndices.graphics = index;
-			}
+			m_vertexAllocation = geometry.vertexAllocation;
+			m_indexAllocation = geometry.indexAllocation;
+			m_meshletAllocation = geometry.meshletAllocation;
 		}
-		else if (!queueFamilyIndices.presentation.has_value())
+		else
 		{
-			VkBool32 presentSupport = false;
-			vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, index, m_vkSurface, &presentSupport);
+			m_vertexAllocation = uploadEncodedGeometry(m_encodedVertices);
+			m_indexAllocation = uploadEncodedGeometry(m_encodedIndices);
+			createMeshletBuffer();
+		}
+	}
+	else
+	{
+		createMesh();
+		createVertexBuffer();
+		createIndexBuffer();
+		createMeshletBuffer();
+	}
 
-			if (presentSupport)
-			{
-				queueFamilyIndices.presentation = index;
-			}
+	m_geometryCache[previousGridSize] = std::move(previous);
+
+	if (m_vertexDeformation)
+	{
+		createDeformBuffers();
+	}
+
+	// Frames in flight keep drawing from the old indirect buffers, the cull sets of each swapchain
+	// image move to the new ones once the mesh version change reaches it. Smaller meshes shrink them again.
+	if (m_gpuDrivenCulling && computeDrawsPerObject() != m_drawsPerObject)
+	{
+		for (size_t i = 0; i < m_vkIndirectBuffers.size(); ++i)
+		{
+			m_deletionQueue.retire(m_frameNumber, m_vkIndirectBuffers[i], m_vkIndirectDeviceMemories[i]);
 		}
 
-		if (queueFamilyIndices.graphics.has_value() && queueFamilyIndices.presentation.has_value())
+		for (size_t i = 0; i < m_vkLateIndirectBuffers.size(); ++i)
 		{
-			return queueFamilyIndices;
+			m_deletionQueue.retire(m_frameNumber, m_vkLateIndirectBuffers[i], m_vkLateIndirectDeviceMemories[i]);
 		}
 
-		++index;
+		m_drawsPerObject = computeDrawsPerObject();
+		createIndirectBuffers();
+		++m_drawStateVersion;
 	}
 
-	throw std::runtime_error("Graphics with presentation queue family not found.");
+	++m_meshVersion;
+	++m_sceneVersion;
 }
 
-SwapChainSupportDetails Engine::querySwapChainSupport(VkPhysicalDevice physicalDevice)
+bool Engine::queueMesh(uint32_t gridSize, std::vector<Vertex> vertices, std::vector<uint32_t> indices)
 {
-	SwapChainSupportDetails supportDetails;
+	QueuedMesh queued = {};
+	queued.gridSize = gridSize;
+	queued.mesh = buildMeshLods(vertices, indices, MAX_LOD_COUNT);
+	buildMeshlets(vertices, indices, &queued.mesh, MESHLET_MAX_VERTICES, MESHLET_MAX_TRIANGLES);
+	queued.encodedVertices = encodeWords(reinterpret_cast<const uint32_t*>(vertices.data()), vertices.size(),
+		sizeof(Vertex) / sizeof(uint32_t));
+	queued.encodedIndices = encodeWords(indices.data(), indices.size(), 1);
+	queued.vertexSize = sizeof(Vertex) * vertices.size();
+	queued.indexSize = sizeof(uint32_t) * indices.size();
+
+	const VkDeviceSize meshletSize = sizeof(Meshlet) * queued.mesh.meshlets.size();
+	const Meshlet* meshlets = queued.mesh.meshlets.data();
+
+	return m_uploadQueue.push(queued.vertexSize + queued.indexSize + meshletSize,
+		[&vertices, &indices, meshlets, meshletSize](void* stagingMemory)
+	{
+		char* destination = static_cast<char*>(stagingMemory);
+		memcpy(destination, vertices.data(), sizeof(Vertex) * vertices.size());
+		destination += sizeof(Vertex) * vertices.size();
+		memcpy(destination, indices.data(), sizeof(uint32_t) * indices.size());
+		destination += sizeof(uint32_t) * indices.size();
+		memcpy(destination, meshlets, meshletSize);
+	}, std::move(queued));
+}
 
-	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, m_vkSurface, &supportDetails.capabilities);
+void Engine::update(FrameSnapshot* outSnapshot) const
+{
+	const float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - m_startTime).count();
+	const float cellSize = 2.0f / INSTANCE_GRID_SIZE;
 
-	uint32_t formatCount;
-	vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, m_vkSurface, &formatCount, nullptr);
+	// Runs on the simulation thread, so it reads nothing the render thread modifies.
+	outSnapshot->transforms.resize(INSTANCE_GRID_SIZE * INSTANCE_GRID_SIZE);
 
-	if (formatCount > 0)
+	for (uint32_t i = 0; i < outSnapshot->transforms.size(); ++i)
 	{
-		supportDetails.formats.resize(formatCount);
-		vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, m_vkSurface, &formatCount, supportDetails.formats.data());
-	}
+		const uint32_t x = i % INSTANCE_GRID_SIZE;
+		const uint32_t y = i / INSTANCE_GRID_SIZE;
+		const glm::vec3 position(-1.0f + (x + 0.5f) * cellSize, -1.0f + (y + 0.5f) * cellSize, 0.0f);
 
-	uint32_t presentModeCount;
-	vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, m_vkSurface, &presentModeCount, nullptr);
+		glm::mat4 transform = glm::translate(glm::mat4(1.0f), position);
+		transform = glm::rotate(transform, seconds + 0.1f * (x + y), glm::vec3(0.0f, 0.0f, 1.0f));
+		transform = glm::scale(transform, glm::vec3(cellSize * 0.8f));
 
-	if (presentModeCount > 0)
-	{
-		supportDetails.presentModes.resize(presentModeCount);
-		vkGetPhysicalDeviceSurfacePresentModesKHR(
-			physicalDevice, m_vkSurface, &presentModeCount, supportDetails.presentModes.data());
+		outSnapshot->transforms[i] = transform;
 	}
-
-	return supportDetails;
 }
 
-VkSurfaceFormatKHR Engine::chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& formats)
+void Engine::applySnapshot(const FrameSnapshot& snapshot)
 {
-	return formats[0];
+	for (uint32_t i = 0; i < getInstanceCount(); ++i)
+	{
+		setInstance(i, snapshot.transforms[i], m_instances[i].color);
+	}
+
+	if (!m_gpuDrivenCulling)
+	{
+		m_visibleObjectCount = cullSpheres(m_cullingInstructionSet, m_objectBounds,
+			computeFrustumPlanes(m_viewProjection), m_visibleObjects.data());
+		buildDrawList();
+	}
 }
 
-VkPresentModeKHR Engine::chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& presentModes)
+void Engine::setInstance(uint32_t index, const glm::mat4& transform, const glm::vec4& color)
 {
-	return VK_PRESENT_MODE_FIFO_KHR;
+	m_instances[index].transform = transform;
+	m_instances[index].color = color;
+	m_instanceDirtyFrames[index] = static_cast<uint8_t>(MAX_FRAMES_IN_FLIGHT);
+	m_objectBounds.set(index, computeBoundingSphere(transform));
+	++m_sceneVersion;
 }
 
-VkExtent2D Engine::chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities)
+void Engine::updateVertices(uint32_t firstVertex, const Vertex* vertices, uint32_t count)
 {
-	VkExtent2D extent;
+	decodeGeometry();
 
-	if (capabilities.currentExtent.width == UINT32_MAX)
+	// Compared without adding, so a large firstVertex can't wrap around the check.
+	if (firstVertex > m_vertices.size() || count > m_vertices.size() - firstVertex)
 	{
-		int width, height;
-		SDL_Vulkan_GetDrawableSize(m_sdlWindow, &width, &height);
-
-		glm::clamp(static_cast<uint32_t>(height), capabilities.minImageExtent.height, capabilities.maxImageExtent.height);
-		glm::clamp(static_cast<uint32_t>(width), capabilities.minImageExtent.width, capabilities.maxImageExtent.width);
+		throw std::runtime_error("Vertex update is out of range.");
 	}
-	else
+
+	// Only the rest pose is edited, with deformation enabled the compute pass keeps overwriting it.
+	std::copy(vertices, vertices + count, m_vertices.begin() + firstVertex);
+	m_encodedVertices.clear();
+	m_dirtyVertexRanges.add(sizeof(Vertex) * firstVertex, sizeof(Vertex) * count);
+	++m_sceneVersion;
+
+	for (uint32_t i = 0; i < count; ++i)
 	{
-		extent = capabilities.currentExtent;
+		m_mesh.boundingRadius = std::max(m_mesh.boundingRadius, glm::length(vertices[i].position));
 	}
-
-	return extent;
 }
 
-bool Engine::checkDeviceExtensionSupport(VkPhysicalDevice physicalDevice)
+void Engine::updateIndices(uint32_t firstIndex, const uint32_t* indices, uint32_t count)
 {
-	uint32_t availableExtensionCount;
-	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &availableExtensionCount, nullptr);
-	std::vector<VkExtensionProperties> availableExtensions(availableExtensionCount);
-	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &availableExtensionCount, availableExtensions.data());
-
-	std::set<std::string> unavailableExtensions(m_deviceExtensions.begin(), m_deviceExtensions.end());
+	// Simplified levels were built from the original triangles and follow the full detail level in the
+	// index buffer, editing them would corrupt their ranges.
+	const uint32_t fullDetailIndexCount = m_mesh.lods[0].indexCount;
 
-	for (VkExtensionProperties& available : availableExtensions)
+	if (firstIndex > fullDetailIndexCount || count > fullDetailIndexCount - firstIndex)
 	{
-		unavailableExtensions.erase(available.extensionName);
+		throw std::runtime_error("Index update is outside the full detail level.");
 	}
 
-	return unavailableExtensions.empty();
+	decodeGeometry();
+	std::copy(indices, indices + count, m_indices.begin() + firstIndex);
+	m_encodedIndices.clear();
+	m_dirtyIndexRanges.add(sizeof(uint32_t) * firstIndex, sizeof(uint32_t) * count);
+	++m_sceneVersion;
 }
 
-bool Engine::checkSwapchainSupport(VkPhysicalDevice physicalDevice)
+const std::vector<Vertex>& Engine::getVertices()
 {
-	SwapChainSupportDetails swapchainSupportDetails = querySwapChainSupport(physicalDevice);
-	return !swapchainSupportDetails.presentModes.empty() &&
-		!swapchainSupportDetails.formats.empty();
+	decodeGeometry();
+	return m_vertices;
 }
 
-bool Engine::checkQueueFamiliesSupport(VkPhysicalDevice physicalDevice)
+std::vector<uint32_t> Engine::getFullDetailIndices()
 {
-	QueueFamilyIndices indices = findQueueFamilyIndices(physicalDevice);
-	return indices.graphics.has_value() && indices.presentation.has_value();
+	decodeGeometry();
+	return std::vector<uint32_t>(m_indices.begin(), m_indices.begin() + m_mesh.lods[0].indexCount);
 }
 
-Engine::Engine()
-	: MAX_FRAMES_IN_FLIGHT(2)
+uint32_t Engine::getInstanceCount() const
 {
+	return static_cast<uint32_t>(m_instances.size());
 }
 
-void Engine::init(SDL_Window* sdlWindow)
+void Engine::setViewProjection(const glm::mat4& viewProjection)
 {
-	m_sdlWindow = sdlWindow;
-	m_currentFrame = 0;
-
-	initVkInstance();
-	createVkSurface();
-	pickPhysicalDevice();
-	createDevice();
-	createSwapChain();
-	createSwapChainImageViews();
-	createRenderPass();
-	createGraphicsPipeline();
-	createFramebuffers();
-	createCommandPool();
-	createVertexBuffer();
-	createIndexBuffer();
-	createCommandBuffers();
-	createSemaphores();
-	createFences();
+	m_viewProjection = viewProjection;
+	++m_drawStateVersion;
+	++m_sceneVersion;
 }
 
-void Engine::update()
+void Engine::invalidateSwapchain()
 {
+	// The window system may have discarded what was last presented.
+	++m_sceneVersion;
 }
 
-void Engine::render()
+bool Engine::render()
 {
+	// Deformation animates on the GPU, so only without it can an unchanged scene keep its last image.
+	const bool pendingGeometry = !m_pendingCopies.empty() || !m_pendingUpdates.empty() || !m_pendingMoves.empty();
+
+	if (m_onDemandRendering && !m_vertexDeformation && !pendingGeometry && m_sceneVersion == m_renderedSceneVersion)
+	{
+		++m_skippedFrameCount;
+		return false;
+	}
+
+	m_renderedSceneVersion = m_sceneVersion;
+
 	vkWaitForFences(m_vkDevice, 1, &m_vkFences[m_currentFrame], VK_TRUE, UINT64_MAX);
 
 	uint32_t imageIndex;
@@ -956,13 +4071,72 @@ void Engine::render()
 		vkWaitForFences(m_vkDevice, 1, &m_vkImagesInFlightFences[imageIndex], VK_TRUE, UINT64_MAX);
 	}
 
-	VkSemaphore waitSemaphores[] = { m_vkImageAvailableSemaphores[m_currentFrame] };
+	m_vkImagesInFlightFences[imageIndex] = m_vkFences[m_currentFrame];
+
+	// Waiting on this slot's fence completes the frame submitted MAX_FRAMES_IN_FLIGHT frames ago,
+	// and every older frame was waited on before its slot was reused.
+	if (m_frameNumber >= static_cast<uint64_t>(MAX_FRAMES_IN_FLIGHT))
+	{
+		m_deletionQueue.collect(m_frameNumber - MAX_FRAMES_IN_FLIGHT);
+		m_geometryPool.collect(m_frameNumber - MAX_FRAMES_IN_FLIGHT);
+		m_uploadQueue.collect(m_frameNumber - MAX_FRAMES_IN_FLIGHT);
+		// After the deletion queue, whose destroys free blocks on these pages.
+		m_hostAllocator.collect(m_frameNumber - MAX_FRAMES_IN_FLIGHT);
+	}
+
+	if (m_captureFrames)
+	{
+		collectCaptures(false);
+	}
+
+	drainUploadQueue();
+
+	// Updates land before compaction, so a move of the edited allocation carries them along.
+	flushGeometryUpdates();
+	compactGeometry();
+	m_memoryBudget.refresh();
+
+	if (m_descriptorSetMeshVersions[m_currentFrame] != m_meshVersion)
+	{
+		writeFrameDescriptorSets(m_currentFrame);
+	}
+
+	if (m_gpuDrivenCulling && m_cullDescriptorSetMeshVersions[imageIndex] != m_meshVersion)
+	{
+		writeCullDescriptorSets(imageIndex);
+	}
+
+	writeInstances(imageIndex);
+	writeTransforms();
+
+	if (m_gpuDrivenCulling)
+	{
+		writeCullInput(imageIndex);
+	}
+
+	if (m_vertexDeformation)
+	{
+		writeDeformParameters();
+	}
+
+	// Uploads submitted to the transfer queue leave the frame's upload pass empty.
+	const bool transfersSubmitted = m_uploadStrategy.transferQueue && submitTransfers();
+	recordCommandBuffer(imageIndex);
+
+	VkSemaphore waitSemaphores[] = { m_vkImageAvailableSemaphores[m_currentFrame], VK_NULL_HANDLE };
 	VkSemaphore signalSemaphores[] = { m_vkRenderFinishedSemaphores[m_currentFrame] };
-	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+	// Any pass may read what was uploaded.
+	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		VK_PIPELINE_STAGE_ALL_COMMANDS_BIT };
+
+	if (transfersSubmitted)
+	{
+		waitSemaphores[1] = m_vkTransferFinishedSemaphores[m_currentFrame];
+	}
 
 	VkSubmitInfo submitInfo = {};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.waitSemaphoreCount = 1;
+	submitInfo.waitSemaphoreCount = transfersSubmitted ? 2 : 1;
 	submitInfo.pWaitSemaphores = waitSemaphores;
 	submitInfo.pWaitDstStageMask = waitStages;
 	submitInfo.commandBufferCount = 1;
@@ -994,50 +4168,201 @@ void Engine::render()
 		throw std::runtime_error("Failed to queue presentation.");
 	}
 
-	vkQueueWaitIdle(m_vkPresentationQueue);
-
+	// No wait for the GPU here, the slot and image fences above keep at most MAX_FRAMES_IN_FLIGHT frames
+	// queued and the frame graph carries each resource's last access into the next frame's barriers.
+	++m_frameNumber;
 	m_currentFrame = (m_currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+	// Staging made before the next render, by a mesh reload for instance, is already retired in the next frame.
+	m_hostAllocator.beginFrame(m_frameNumber);
+	return true;
+}
+
+uint64_t Engine::getSkippedFrameCount() const
+{
+	return m_skippedFrameCount;
+}
+
+uint64_t Engine::getCapturedFrameCount()
+{
+	return m_frameCapture.getWrittenFrameCount();
+}
+
+uint64_t Engine::getDroppedCaptureCount()
+{
+	return m_droppedCaptureCount + m_frameCapture.getFailedFrameCount();
+}
+
+void Engine::reportHostAllocations(std::ostream& out)
+{
+	m_hostAllocator.report(out);
+}
+
+void Engine::reportUploadStrategy(std::ostream& out)
+{
+	out << "Upload strategy (" << (m_uploadStrategyCached ? "cached" : "probed") << "): ";
+	printUploadStrategy(out, m_uploadStrategy);
+	out << std::endl;
+
+	if (m_uploadStrategyCached)
+	{
+		return;
+	}
+
+	out << "  submit latency: " << m_graphicsSubmitLatency * 1000.0 << " ms graphics";
+
+	if (m_vkTransferQueue != VK_NULL_HANDLE)
+	{
+		out << ", " << m_transferSubmitLatency * 1000.0 << " ms transfer";
+	}
+
+	out << std::endl;
+
+	for (const UploadMeasurement& measurement : m_uploadMeasurements)
+	{
+		out << "  ";
+		printUploadStrategy(out, measurement.strategy);
+		out << ": " << getProbePayloadSize() / measurement.seconds / (1024.0 * 1024.0) << " MiB/s" << std::endl;
+	}
 }
 
 void Engine::cleanUp()
 {
 	vkDeviceWaitIdle(m_vkDevice);
 
-	vkDestroyBuffer(m_vkDevice, m_vkVertexBuffer, nullptr);
-	vkFreeMemory(m_vkDevice, m_vkVertexDeviceMemory, nullptr);
+	if (m_captureFrames)
+	{
+		collectCaptures(true);
+		m_frameCapture.stop();
+
+		for (const CaptureSlot& slot : m_captureSlots)
+		{
+			vkUnmapMemory(m_vkDevice, slot.memory);
+			vkDestroyBuffer(m_vkDevice, slot.buffer, m_vkAllocator);
+			vkFreeMemory(m_vkDevice, slot.memory, m_vkAllocator);
+		}
+	}
+
+	// Cached and displayed geometry all live in pool blocks.
+	for (const GeometryBlockHandles& block : m_geometryPool.releaseAllBlocks())
+	{
+		m_deletionQueue.retire(m_frameNumber, block.buffer, block.memory);
+	}
+
+	retireStagingChunk();
+	vkUnmapMemory(m_vkDevice, m_vkUploadQueueDeviceMemory);
+	m_deletionQueue.retire(m_frameNumber, m_vkUploadQueueBuffer, m_vkUploadQueueDeviceMemory);
+	m_deletionQueue.flush();
+
+	for (size_t i = 0; i < m_vkInstanceBuffers.size(); ++i)
+	{
+		vkUnmapMemory(m_vkDevice, m_vkInstanceDeviceMemories[i]);
+		vkDestroyBuffer(m_vkDevice, m_vkInstanceBuffers[i], m_vkAllocator);
+		vkFreeMemory(m_vkDevice, m_vkInstanceDeviceMemories[i], m_vkAllocator);
+	}
+
+	vkUnmapMemory(m_vkDevice, m_vkTransformRingDeviceMemory);
+	vkDestroyBuffer(m_vkDevice, m_vkTransformRingBuffer, m_vkAllocator);
+	vkFreeMemory(m_vkDevice, m_vkTransformRingDeviceMemory, m_vkAllocator);
+
+	if (m_gpuDrivenCulling)
+	{
+		for (size_t i = 0; i < m_vkCullInputBuffers.size(); ++i)
+		{
+			vkUnmapMemory(m_vkDevice, m_vkCullInputDeviceMemories[i]);
+			vkDestroyBuffer(m_vkDevice, m_vkCullInputBuffers[i], m_vkAllocator);
+			vkFreeMemory(m_vkDevice, m_vkCullInputDeviceMemories[i], m_vkAllocator);
+			vkDestroyBuffer(m_vkDevice, m_vkIndirectBuffers[i], m_vkAllocator);
+			vkFreeMemory(m_vkDevice, m_vkIndirectDeviceMemories[i], m_vkAllocator);
+		}
+
+		vkDestroyPipeline(m_vkDevice, m_vkCullPipeline, m_vkAllocator);
+		vkDestroyPipelineLayout(m_vkDevice, m_vkCullPipelineLayout, m_vkAllocator);
+		vkDestroyDescriptorSetLayout(m_vkDevice, m_vkCullDescriptorSetLayout, m_vkAllocator);
+	}
+
+	if (m_occlusionCulling)
+	{
+		for (size_t i = 0; i < m_vkLateIndirectBuffers.size(); ++i)
+		{
+			vkDestroyBuffer(m_vkDevice, m_vkLateIndirectBuffers[i], m_vkAllocator);
+			vkFreeMemory(m_vkDevice, m_vkLateIndirectDeviceMemories[i], m_vkAllocator);
+		}
+
+		vkDestroyBuffer(m_vkDevice, m_vkVisibilityBuffer, m_vkAllocator);
+		vkFreeMemory(m_vkDevice, m_vkVisibilityDeviceMemory, m_vkAllocator);
+
+		for (VkImageView levelView : m_vkDepthPyramidLevelViews)
+		{
+			vkDestroyImageView(m_vkDevice, levelView, m_vkAllocator);
+		}
+
+		vkDestroyImageView(m_vkDevice, m_vkDepthPyramidView, m_vkAllocator);
+		vkDestroyImage(m_vkDevice, m_vkDepthPyramidImage, m_vkAllocator);
+		vkFreeMemory(m_vkDevice, m_vkDepthPyramidDeviceMemory, m_vkAllocator);
+		vkDestroySampler(m_vkDevice, m_vkDepthSampler, m_vkAllocator);
 
-	vkDestroyBuffer(m_vkDevice, m_vkIndexBuffer, nullptr);
-	vkFreeMemory(m_vkDevice, m_vkIndexDeviceMemory, nullptr);
+		vkDestroyPipeline(m_vkDevice, m_vkDepthReducePipeline, m_vkAllocator);
+		vkDestroyPipelineLayout(m_vkDevice, m_vkDepthReducePipelineLayout, m_vkAllocator);
+		vkDestroyDescriptorSetLayout(m_vkDevice, m_vkDepthReduceDescriptorSetLayout, m_vkAllocator);
+		vkDestroyRenderPass(m_vkDevice, m_vkLateRenderPass, m_vkAllocator);
+	}
+
+	if (m_vertexDeformation)
+	{
+		vkDestroyBuffer(m_vkDevice, m_vkSkinnedVertexBuffer, m_vkAllocator);
+		vkFreeMemory(m_vkDevice, m_vkSkinnedVertexDeviceMemory, m_vkAllocator);
+		vkDestroyBuffer(m_vkDevice, m_vkMorphTargetBuffer, m_vkAllocator);
+		vkFreeMemory(m_vkDevice, m_vkMorphTargetDeviceMemory, m_vkAllocator);
+
+		vkUnmapMemory(m_vkDevice, m_vkDeformParameterDeviceMemory);
+		vkDestroyBuffer(m_vkDevice, m_vkDeformParameterBuffer, m_vkAllocator);
+		vkFreeMemory(m_vkDevice, m_vkDeformParameterDeviceMemory, m_vkAllocator);
+
+		vkDestroyPipeline(m_vkDevice, m_vkDeformPipeline, m_vkAllocator);
+		vkDestroyPipelineLayout(m_vkDevice, m_vkDeformPipelineLayout, m_vkAllocator);
+		vkDestroyDescriptorSetLayout(m_vkDevice, m_vkDeformDescriptorSetLayout, m_vkAllocator);
+	}
 
 	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
 	{
-		vkDestroySemaphore(m_vkDevice, m_vkImageAvailableSemaphores[i], nullptr);
-		vkDestroySemaphore(m_vkDevice, m_vkRenderFinishedSemaphores[i], nullptr);
-		vkDestroyFence(m_vkDevice, m_vkFences[i], nullptr);
+		vkDestroySemaphore(m_vkDevice, m_vkImageAvailableSemaphores[i], m_vkAllocator);
+		vkDestroySemaphore(m_vkDevice, m_vkRenderFinishedSemaphores[i], m_vkAllocator);
+		vkDestroyFence(m_vkDevice, m_vkFences[i], m_vkAllocator);
 	}
 
-	for (VkFence imagesInFlightFence : m_vkImagesInFlightFences)
+	if (m_uploadStrategy.transferQueue)
 	{
-		vkDestroyFence(m_vkDevice, imagesInFlightFence, nullptr);
+		for (VkSemaphore semaphore : m_vkTransferFinishedSemaphores)
+		{
+			vkDestroySemaphore(m_vkDevice, semaphore, m_vkAllocator);
+		}
+
+		vkDestroyCommandPool(m_vkDevice, m_vkTransferCommandPool, m_vkAllocator);
 	}
 
-	vkDestroyCommandPool(m_vkDevice, m_vkCommandPool, nullptr);
-	vkDestroyPipeline(m_vkDevice, m_vkPipeline, nullptr);
-	vkDestroyPipelineLayout(m_vkDevice, m_vkPipelineLayout, nullptr);
-	vkDestroyRenderPass(m_vkDevice, m_vkRenderPass, nullptr);
-	vkDestroySwapchainKHR(m_vkDevice, m_vkSwapchain, nullptr);
+	m_drawCommandCache.destroy();
+	vkDestroyCommandPool(m_vkDevice, m_vkCommandPool, m_vkAllocator);
+	vkDestroyDescriptorPool(m_vkDevice, m_vkDescriptorPool, m_vkAllocator);
+	vkDestroyPipeline(m_vkDevice, m_vkPipeline, m_vkAllocator);
+	vkDestroyPipelineLayout(m_vkDevice, m_vkPipelineLayout, m_vkAllocator);
+	vkDestroyDescriptorSetLayout(m_vkDevice, m_vkDescriptorSetLayout, m_vkAllocator);
+	vkDestroyRenderPass(m_vkDevice, m_vkRenderPass, m_vkAllocator);
+	vkDestroySwapchainKHR(m_vkDevice, m_vkSwapchain, m_vkAllocator);
 
 	for (VkFramebuffer framebuffer : m_vkSwapchainFramebuffers)
 	{
-		vkDestroyFramebuffer(m_vkDevice, framebuffer, nullptr);
+		vkDestroyFramebuffer(m_vkDevice, framebuffer, m_vkAllocator);
 	}
 
+	m_frameGraph.destroy();
+
 	for (VkImageView swapchainImageView : m_vkSwapchainImageViews)
 	{
-		vkDestroyImageView(m_vkDevice, swapchainImageView, nullptr);
+		vkDestroyImageView(m_vkDevice, swapchainImageView, m_vkAllocator);
 	}
 
+	// SDL creates the surface without allocation callbacks.
 	vkDestroySurfaceKHR(m_vkInstance, m_vkSurface, nullptr);
-	vkDestroyDevice(m_vkDevice, nullptr);
-	vkDestroyInstance(m_vkInstance, nullptr);
+	vkDestroyDevice(m_vkDevice, m_vkAllocator);
+	vkDestroyInstance(m_vkInstance, m_vkAllocator);
 }
@@ -4,8 +4,27 @@
 #include <optional>
 #include <vector>
 #include <array>
+#include <map>
+#include <chrono>
+#include <functional>
 #include "glm/common.hpp"
 #include "glm/vec3.hpp"
+#include "glm/vec4.hpp"
+#include "glm/mat4x4.hpp"
+#include "DeletionQueue.h"
+#include "CommandBufferCache.h"
+#include "DirtyRanges.h"
+#include "FrameGraph.h"
+#include "GeometryPool.h"
+#include "HostAllocator.h"
+#include "MemoryBudget.h"
+#include "Deformation.h"
+#include "FrustumCulling.h"
+#include "Mesh.h"
+#include "MeshCodec.h"
+#include "FrameCapture.h"
+#include "UploadStrategy.h"
+#include "UploadQueue.h"
 
 struct QueueFamilyIndices
 {
@@ -20,23 +39,172 @@ struct SwapChainSupportDetails
 	std::vector<VkPresentModeKHR> presentModes;
 };
 
-struct Vertex
+struct InstanceData
 {
-	glm::vec3 position;
-	glm::vec3 color;
+	glm::mat4 transform;
+	glm::vec4 color;
+};
+
+struct CullInputHeader
+{
+	glm::vec4 frustumPlanes[6];
+	glm::vec4 viewProjectionRow3;
+	glm::uvec4 lodRanges[MAX_LOD_COUNT];
+	glm::vec4 lodErrors;
+	uint32_t objectCount;
+	uint32_t lodCount;
+	float lodErrorScale;
+	uint32_t padding0;
+	glm::mat4 viewProjection;
+	// Homogeneous, so orthographic projections put it at infinity.
+	glm::vec4 eyePosition;
+	// First meshlet and meshlet count of every level.
+	glm::uvec4 lodMeshlets[MAX_LOD_COUNT];
+	uint32_t drawsPerObject;
+	uint32_t padding1[3];
+};
+
+static_assert(MAX_LOD_COUNT == 4, "CullInputHeader packs one error per level into lodErrors.");
+
+struct IndirectDrawHeader
+{
+	uint32_t drawCount;
+	uint32_t padding[3];
+};
+
+struct CullPushConstants
+{
+	uint32_t compactDraws;
+	uint32_t latePhase;
+};
+
+struct DepthReducePushConstants
+{
+	uint32_t sourceWidth;
+	uint32_t sourceHeight;
+	uint32_t destinationWidth;
+	uint32_t destinationHeight;
+};
+
+struct PendingCopy
+{
+	VkBuffer source;
+	VkDeviceSize sourceOffset;
+	VkBuffer destination;
+	VkDeviceSize destinationOffset;
+	VkDeviceSize size;
+};
+
+struct PendingUpdate
+{
+	VkBuffer destination;
+	VkDeviceSize destinationOffset;
+	std::vector<char> data;
+};
+
+// Geometry of a mesh resolution that is not displayed but kept resident for a quick switch back.
+// Eviction only releases the allocations, the compressed streams stay to restore them without a rebuild.
+struct CachedGeometry
+{
+	std::vector<uint8_t> encodedVertices;
+	std::vector<uint8_t> encodedIndices;
+	Mesh mesh;
+	uint32_t vertexAllocation;
+	uint32_t indexAllocation;
+	uint32_t meshletAllocation;
+	uint64_t lastUsedFrame;
+};
+
+// A mesh built on another thread. Its vertices, indices and meshlets follow each other in staging memory.
+struct QueuedMesh
+{
+	uint32_t gridSize;
+	Mesh mesh;
+	std::vector<uint8_t> encodedVertices;
+	std::vector<uint8_t> encodedIndices;
+	VkDeviceSize vertexSize;
+	VkDeviceSize indexSize;
+};
+
+// Simulation state for one frame, never modified once handed to the render thread.
+struct FrameSnapshot
+{
+	std::vector<glm::mat4> transforms;
+};
+
+// A draw call recorded into its own secondary command buffer and replayed while it stays the same.
+struct DrawBucket
+{
+	uint32_t level;
+	uint32_t indexCount;
+	uint32_t instanceCount;
+	uint32_t firstIndex;
+	int32_t vertexOffset;
+	uint32_t firstInstance;
+	bool indirect;
+	bool late;
+};
+
+// Host-visible buffer a frame is copied into and read back from once its fence has signaled.
+struct CaptureSlot
+{
+	VkBuffer buffer;
+	VkDeviceMemory memory;
+	void* mappedMemory;
+	uint64_t frameNumber;
+	bool pending;
+};
+
+// Host-visible buffer small uploads are packed into until it is full.
+struct StagingChunk
+{
+	VkBuffer buffer;
+	VkDeviceMemory memory;
+	void* mappedMemory;
+	VkDeviceSize used;
+};
+
+struct FramePushConstants
+{
+	glm::mat4 viewProjection;
+	VertexFormat vertexFormat;
 };
 
 class Engine
 {
 private:
 	const int MAX_FRAMES_IN_FLIGHT;
+	const uint32_t INSTANCE_GRID_SIZE;
+	const uint32_t DEFORM_BONE_COUNT;
+	const float LOD_ERROR_THRESHOLD_PIXELS;
+	const VkDeviceSize GEOMETRY_BLOCK_SIZE;
+	const VkDeviceSize DEFRAGMENT_BYTES_PER_FRAME;
+	const VkDeviceSize INLINE_UPDATE_MAX_SIZE;
+	// Bounds the indirect buffers, objects whose level has more meshlets than fit are drawn whole.
+	const uint32_t MAX_CLUSTER_DRAW_COUNT;
+	const VkDeviceSize UPLOAD_QUEUE_STAGING_SIZE;
+	const size_t UPLOAD_QUEUE_CELL_COUNT;
 
+	HostAllocator m_hostAllocator;
+	const VkAllocationCallbacks* m_vkAllocator;
 	struct SDL_Window* m_sdlWindow;
 	VkInstance m_vkInstance;
 	VkPhysicalDevice m_vkPhysicalDevice;
 	VkDevice m_vkDevice;
 	VkQueue m_vkGraphicsQueue;
 	VkQueue m_vkPresentationQueue;
+	VkQueue m_vkTransferQueue;
+	// The graphics family, then the transfer family when the device has one.
+	std::vector<uint32_t> m_uploadQueueFamilies;
+	UploadStrategy m_uploadStrategy;
+	bool m_uploadStrategyCached;
+	std::vector<UploadMeasurement> m_uploadMeasurements;
+	double m_graphicsSubmitLatency;
+	double m_transferSubmitLatency;
+	StagingChunk m_stagingChunk;
+	VkCommandPool m_vkTransferCommandPool;
+	std::vector<VkCommandBuffer> m_vkTransferCommandBuffers;
+	std::vector<VkSemaphore> m_vkTransferFinishedSemaphores;
 	VkSurfaceKHR m_vkSurface;
 	VkSwapchainKHR m_vkSwapchain;
 	std::vector<VkImage> m_vkSwapchainImages;
@@ -44,45 +212,247 @@ private:
 	VkFormat m_vkSwapchainImageFormat;
 	VkExtent2D m_vkSwapchainExtent;
 	std::vector<const char*> m_deviceExtensions;
+	VkFormat m_vkDepthFormat;
 	VkRenderPass m_vkRenderPass;
+	VkRenderPass m_vkLateRenderPass;
+	VkDescriptorSetLayout m_vkDescriptorSetLayout;
 	VkPipelineLayout m_vkPipelineLayout;
 	VkPipeline m_vkPipeline;
 	std::vector<VkFramebuffer> m_vkSwapchainFramebuffers;
 	VkCommandPool m_vkCommandPool;
 	std::vector<VkCommandBuffer> m_vkCommandBuffers;
+	CommandBufferCache m_drawCommandCache;
+	uint64_t m_drawStateVersion;
 	std::vector<VkSemaphore> m_vkImageAvailableSemaphores;
 	std::vector<VkSemaphore> m_vkRenderFinishedSemaphores;
 	std::vector<VkFence> m_vkFences;
 	std::vector<VkFence> m_vkImagesInFlightFences;
 	int m_currentFrame;
+	uint64_t m_frameNumber;
+	MemoryBudget m_memoryBudget;
+	DeletionQueue m_deletionQueue;
+	GeometryPool m_geometryPool;
+	FrameGraph m_frameGraph;
+	uint32_t m_geometryResource;
+	uint32_t m_indirectResource;
+	uint32_t m_lateIndirectResource;
+	uint32_t m_visibilityResource;
+	uint32_t m_depthPyramidResource;
+	uint32_t m_swapchainResource;
+	uint32_t m_depthResource;
+	uint32_t m_uploadPass;
+	uint32_t m_capturePass;
+	size_t m_currentImage;
+	bool m_physicalDeviceProperties2Supported;
+	bool m_unifiedMemory;
+	std::map<uint32_t, CachedGeometry> m_geometryCache;
+	UploadQueue<QueuedMesh> m_uploadQueue;
+	VkBuffer m_vkUploadQueueBuffer;
+	VkDeviceMemory m_vkUploadQueueDeviceMemory;
+	std::vector<PendingCopy> m_pendingCopies;
+	std::vector<PendingUpdate> m_pendingUpdates;
+	std::vector<PendingCopy> m_pendingMoves;
+	// Some pending copies overwrite allocations that frames in flight may still read.
+	bool m_pendingLiveCopies;
+	uint32_t m_meshGridSize;
+	uint32_t m_meshVersion;
+	std::vector<uint32_t> m_descriptorSetMeshVersions;
 	std::vector<Vertex> m_vertices;
-	VkBuffer m_vkVertexBuffer;
-	VkDeviceMemory m_vkVertexDeviceMemory;
+	uint32_t m_vertexAllocation;
+	DirtyRanges m_dirtyVertexRanges;
 	std::vector<uint32_t> m_indices;
-	VkBuffer m_vkIndexBuffer;
-	VkDeviceMemory m_vkIndexDeviceMemory;
+	Mesh m_mesh;
+	uint32_t m_indexAllocation;
+	DirtyRanges m_dirtyIndexRanges;
+	// A mesh restored from the cache keeps its compressed streams and is only decoded into m_vertices and
+	// m_indices once the CPU needs them. Edits make the streams stale and drop them.
+	std::vector<uint8_t> m_encodedVertices;
+	std::vector<uint8_t> m_encodedIndices;
+	bool m_geometryDecoded;
+	uint32_t m_meshletAllocation;
+	std::vector<InstanceData> m_instances;
+	std::vector<VkBuffer> m_vkInstanceBuffers;
+	std::vector<VkDeviceMemory> m_vkInstanceDeviceMemories;
+	std::vector<void*> m_instanceMappedMemories;
+	std::vector<uint8_t> m_instanceDirtyFrames;
+	VkBuffer m_vkTransformRingBuffer;
+	VkDeviceMemory m_vkTransformRingDeviceMemory;
+	void* m_transformRingMappedMemory;
+	VkDeviceSize m_transformRingRegionSize;
+	std::vector<VkDescriptorSet> m_vkDrawDescriptorSets;
+	std::chrono::steady_clock::time_point m_startTime;
+	glm::mat4 m_viewProjection;
+	BoundingSphereTable m_objectBounds;
+	CullingInstructionSet m_cullingInstructionSet;
+	CodecInstructionSet m_codecInstructionSet;
+	std::vector<uint32_t> m_visibleObjects;
+	size_t m_visibleObjectCount;
+	std::vector<uint32_t> m_visibleLods;
+	std::vector<uint32_t> m_drawList;
+	std::array<uint32_t, MAX_LOD_COUNT> m_lodInstanceCounts;
+	bool m_gpuDrivenCulling;
+	bool m_occlusionCulling;
+	bool m_clusterCulling;
+	// Indirect draw slots per object, one per meshlet of the largest level when clusters are culled.
+	uint32_t m_drawsPerObject;
+	uint32_t m_maxDrawIndirectCount;
+	bool m_vertexPulling;
+	bool m_vertexDeformation;
+	bool m_onDemandRendering;
+	uint64_t m_sceneVersion;
+	uint64_t m_renderedSceneVersion;
+	uint64_t m_skippedFrameCount;
+	bool m_captureFrames;
+	std::string m_captureDirectory;
+	CaptureFormat m_captureFormat;
+	FrameCapture m_frameCapture;
+	std::vector<CaptureSlot> m_captureSlots;
+	size_t m_nextCaptureSlot;
+	uint64_t m_droppedCaptureCount;
+	bool m_drawIndirectCountSupported;
+	PFN_vkCmdDrawIndexedIndirectCountKHR m_vkCmdDrawIndexedIndirectCount;
+	VkDescriptorSetLayout m_vkCullDescriptorSetLayout;
+	VkPipelineLayout m_vkCullPipelineLayout;
+	VkPipeline m_vkCullPipeline;
+	VkDescriptorPool m_vkDescriptorPool;
+	std::vector<VkDescriptorSet> m_vkCullDescriptorSets;
+	std::vector<uint32_t> m_cullDescriptorSetMeshVersions;
+	std::vector<VkBuffer> m_vkCullInputBuffers;
+	std::vector<VkDeviceMemory> m_vkCullInputDeviceMemories;
+	std::vector<void*> m_cullInputMappedMemories;
+	std::vector<VkBuffer> m_vkIndirectBuffers;
+	std::vector<VkDeviceMemory> m_vkIndirectDeviceMemories;
+	std::vector<VkDescriptorSet> m_vkLateCullDescriptorSets;
+	std::vector<VkBuffer> m_vkLateIndirectBuffers;
+	std::vector<VkDeviceMemory> m_vkLateIndirectDeviceMemories;
+	VkBuffer m_vkVisibilityBuffer;
+	VkDeviceMemory m_vkVisibilityDeviceMemory;
+	bool m_visibilityCleared;
+	VkImage m_vkDepthPyramidImage;
+	VkDeviceMemory m_vkDepthPyramidDeviceMemory;
+	VkImageView m_vkDepthPyramidView;
+	std::vector<VkImageView> m_vkDepthPyramidLevelViews;
+	VkExtent2D m_depthPyramidExtent;
+	uint32_t m_depthPyramidLevelCount;
+	VkSampler m_vkDepthSampler;
+	VkDescriptorSetLayout m_vkDepthReduceDescriptorSetLayout;
+	VkPipelineLayout m_vkDepthReducePipelineLayout;
+	VkPipeline m_vkDepthReducePipeline;
+	std::vector<VkDescriptorSet> m_vkDepthReduceDescriptorSets;
+	ChainRig m_rig;
+	uint32_t m_morphTargetCount;
+	VkBuffer m_vkSkinnedVertexBuffer;
+	VkDeviceMemory m_vkSkinnedVertexDeviceMemory;
+	VkBuffer m_vkMorphTargetBuffer;
+	VkDeviceMemory m_vkMorphTargetDeviceMemory;
+	VkBuffer m_vkDeformParameterBuffer;
+	VkDeviceMemory m_vkDeformParameterDeviceMemory;
+	void* m_deformParameterMappedMemory;
+	VkDeviceSize m_deformParameterRegionSize;
+	VkDescriptorSetLayout m_vkDeformDescriptorSetLayout;
+	VkPipelineLayout m_vkDeformPipelineLayout;
+	VkPipeline m_vkDeformPipeline;
+	std::vector<VkDescriptorSet> m_vkDeformDescriptorSets;
 
 	void initVkInstance();
 	void createVkSurface();
 	void pickPhysicalDevice();
 	void createDevice();
+	void chooseUploadStrategy();
+	void probeUploadStrategies();
+	double measureStagedUploads(VkCommandPool commandPool, VkQueue queue, const std::vector<char>& payload);
+	double measureDirectWrites(const std::vector<char>& payload);
+	double measureSubmitLatency(VkCommandPool commandPool, VkQueue queue);
+	void submitOneTimeCommands(VkCommandPool commandPool, VkQueue queue,
+		const std::function<void(VkCommandBuffer)>& record);
 	void createSwapChain();
 	void createSwapChainImageViews();
 	void createRenderPass();
+	void createDescriptorSetLayout();
+	void createPipelineLayout();
 	void createGraphicsPipeline();
+	void createFrameGraph();
 	void createFramebuffers();
 
 	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags propertyFlags,
 		VkBuffer* outBuffer, VkDeviceMemory* outDeviceMemory);
+	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags propertyFlags,
+		const VkAllocationCallbacks* allocator, VkBuffer* outBuffer, VkDeviceMemory* outDeviceMemory);
+
+	void createDeviceLocalBuffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usageFlags,
+		VkBuffer* outBuffer, VkDeviceMemory* outDeviceMemory);
 
-	void copyBuffer(VkDeviceSize size, VkBuffer source, VkBuffer destination);
+	void writeMemory(VkDeviceMemory memory, const void* data, VkDeviceSize size);
+	void queueUpload(const void* data, VkDeviceSize size, VkBuffer destination, VkDeviceSize destinationOffset);
+	void queueUpload(VkDeviceSize size, const std::function<void(void*)>& write, VkBuffer destination,
+		VkDeviceSize destinationOffset);
+	void retireStagingChunk();
+	bool submitTransfers();
+	void createUploadQueue();
+	void drainUploadQueue();
+	uint32_t allocateGeometry(VkDeviceSize size);
+	uint32_t uploadGeometry(const void* data, VkDeviceSize size);
+	// Write receives the mapped memory the GPU reads from, or the staging memory copied there.
+	uint32_t uploadGeometry(VkDeviceSize size, const std::function<void(void*)>& write);
+	uint32_t uploadEncodedGeometry(const std::vector<uint8_t>& encoded);
 
+	// Frees the least recently used cached geometry, returns the bytes it held or 0 when nothing is left.
+	VkDeviceSize evictGeometry();
+	void releaseEmptyGeometryBlocks();
+	void compactGeometry();
+	void flushGeometryUpdates();
+
+	void createMesh();
+	void decodeGeometry();
 	void createVertexBuffer();
 	void createIndexBuffer();
+	void createMeshletBuffer();
+	void createDeformBuffers();
+	void createDeformParameterBuffer();
+	void createInstances();
+	void createInstanceBuffers();
+	void createTransformRing();
+	void createDrawDescriptorSets();
+	void createCullPipeline();
+	void createCullBuffers();
+	void createIndirectBuffers();
+	void createDescriptorPool();
+	void createCullDescriptorSets();
+	void writeCullDescriptorSets(size_t imageIndex);
+	void createDepthPyramid();
+	void createDepthReducePipeline();
+	void createDepthReduceDescriptorSets();
+	void createDeformPipeline();
+	void createDeformDescriptorSets();
+	void writeFrameDescriptorSets(size_t frame);
 	void createCommandPool();
 	void createCommandBuffers();
+	void createTransferCommandBuffers();
 	void createSemaphores();
 	void createFences();
+	void createCaptureBuffers();
+
+	void recordCommandBuffer(size_t imageIndex);
+	void recordRenderPass(VkCommandBuffer commandBuffer, size_t imageIndex, bool latePhase);
+	void recordPendingCopies(VkCommandBuffer commandBuffer);
+	void recordCullCommands(VkCommandBuffer commandBuffer, size_t imageIndex, bool latePhase);
+	void recordDepthPyramid(VkCommandBuffer commandBuffer);
+	void recordCapture(VkCommandBuffer commandBuffer);
+	void collectCaptures(bool deviceIdle);
+	void recordDeformCommands(VkCommandBuffer commandBuffer);
+	void recordDrawState(VkCommandBuffer commandBuffer, size_t imageIndex);
+	void recordDrawBucket(VkCommandBuffer commandBuffer, size_t imageIndex, const DrawBucket& bucket);
+	std::vector<DrawBucket> buildDrawBuckets(bool latePhase);
+	void writeInstances(size_t imageIndex);
+	void writeTransforms();
+	void writeCullInput(size_t imageIndex);
+	void writeDeformParameters();
+	std::array<glm::vec4, 6> computeFrustumPlanes(const glm::mat4& viewProjection);
+	glm::vec4 computeBoundingSphere(const glm::mat4& transform);
+	float computeProjectedRadiusScale();
+	float computeProjectedRadius(const glm::vec4& sphere);
+	void buildDrawList();
+	uint32_t computeDrawsPerObject();
 
 	VkShaderModule loadShader(const char* fileName);
 	QueueFamilyIndices findQueueFamilyIndices(VkPhysicalDevice physicalDevice);
@@ -90,20 +460,65 @@ private:
 	VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& formats);
 	VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& presentModes);
 	VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities);
-	VkVertexInputBindingDescription buildVertexBindingDescription();
-	std::array<VkVertexInputAttributeDescription, 2> buildVertexAttributeDescription();
+	VkFormat chooseDepthFormat();
+	std::array<VkVertexInputBindingDescription, 2> buildVertexBindingDescription();
+	std::array<VkVertexInputAttributeDescription, 3> buildVertexAttributeDescription();
 	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
+	// Memory types a buffer with these usage flags can be bound to, whatever its size.
+	uint32_t getBufferMemoryTypeBits(VkBufferUsageFlags usageFlags);
+	bool findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties,
+		uint32_t* outTypeIndex);
 
 	bool checkDeviceExtensionSupport(VkPhysicalDevice physicalDevice);
 	bool checkSwapchainSupport(VkPhysicalDevice physicalDevice);
 	bool checkQueueFamiliesSupport(VkPhysicalDevice physicalDevice);
+	bool checkDeviceExtensionSupport(VkPhysicalDevice physicalDevice, const char* extensionName);
+	bool checkInstanceExtensionSupport(const char* extensionName);
+	bool checkUnifiedMemorySupport(VkPhysicalDevice physicalDevice);
+	std::optional<uint32_t> findTransferQueueFamily(VkPhysicalDevice physicalDevice);
+	bool checkGpuDrivenCullingSupport(VkPhysicalDevice physicalDevice);
 	
 public:
 	Engine();
 
+	void setGpuDrivenCulling(bool enabled);
+	// Two-phase culling against a depth pyramid, only available with GPU-driven culling.
+	void setOcclusionCulling(bool enabled);
+	// Draws the meshlets of every object separately, skipping those outside the frustum or facing away.
+	// Only available with GPU-driven culling and without vertex deformation.
+	void setClusterCulling(bool enabled);
+	void setVertexPulling(bool enabled);
+	void setVertexDeformation(bool enabled);
+	void setOnDemandRendering(bool enabled);
+	// Reads every rendered frame back without stalling and writes it to directory on a background thread.
+	void setFrameCapture(const std::string& directory, CaptureFormat format);
 	void init(struct SDL_Window* sdlWindow);
-	void update();
-	void render();
+	void reloadMesh(uint32_t gridSize);
+	// Safe to call from any thread between init and cleanUp. Builds the levels and meshlets of a mesh for
+	// gridSize on the calling thread and stages it for the render thread, which makes it resident in the
+	// geometry cache on its next frame. Returns false when the upload queue is full, try again later.
+	bool queueMesh(uint32_t gridSize, std::vector<Vertex> vertices, std::vector<uint32_t> indices);
+	void update(FrameSnapshot* outSnapshot) const;
+	void applySnapshot(const FrameSnapshot& snapshot);
+	void setInstance(uint32_t index, const glm::mat4& transform, const glm::vec4& color);
+	// Edits the rest pose, every level indexes the same vertices so all of them follow.
+	void updateVertices(uint32_t firstVertex, const Vertex* vertices, uint32_t count);
+	// Edits the triangles of the full detail level only and throws for anything past it. Simplified levels
+	// keep the triangles they were built from, so an edit isn't visible while one of them is selected.
+	void updateIndices(uint32_t firstIndex, const uint32_t* indices, uint32_t count);
+	// Decode the displayed mesh first if it was restored from the cache.
+	const std::vector<Vertex>& getVertices();
+	std::vector<uint32_t> getFullDetailIndices();
+	uint32_t getInstanceCount() const;
+	void setViewProjection(const glm::mat4& viewProjection);
+	void invalidateSwapchain();
+	bool render();
+	uint64_t getSkippedFrameCount() const;
+	// Final only after cleanUp, which writes out the frames still in flight.
+	uint64_t getCapturedFrameCount();
+	uint64_t getDroppedCaptureCount();
+	void reportHostAllocations(std::ostream& out);
+	void reportUploadStrategy(std::ostream& out);
 	void cleanUp();
 };
 
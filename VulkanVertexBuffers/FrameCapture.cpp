@@ -0,0 +1,293 @@
+#include "FrameCapture.h"
+#include <fstream>
+#include <algorithm>
+#include <array>
+#include <cstdio>
+
+static const uint32_t ADLER_MODULUS = 65521;
+// Largest run of bytes after which the Adler-32 sums still fit in 32 bits before reducing them.
+static const size_t ADLER_BLOCK_SIZE = 5552;
+static const size_t STORED_BLOCK_SIZE = 65535;
+
+static std::array<uint32_t, 256> buildCrcTable()
+{
+	std::array<uint32_t, 256> table = {};
+
+	for (uint32_t i = 0; i < 256; ++i)
+	{
+		uint32_t crc = i;
+
+		for (int bit = 0; bit < 8; ++bit)
+		{
+			crc = (crc & 1) != 0 ? 0xEDB88320u ^ (crc >> 1) : crc >> 1;
+		}
+
+		table[i] = crc;
+	}
+
+	return table;
+}
+
+static uint32_t computeCrc(const uint8_t* data, size_t size)
+{
+	static const std::array<uint32_t, 256> table = buildCrcTable();
+	uint32_t crc = 0xFFFFFFFFu;
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+
+	return crc ^ 0xFFFFFFFFu;
+}
+
+static uint32_t computeAdler(const uint8_t* data, size_t size)
+{
+	uint32_t a = 1;
+	uint32_t b = 0;
+
+	while (size > 0)
+	{
+		const size_t blockSize = std::min(size, ADLER_BLOCK_SIZE);
+
+		for (size_t i = 0; i < blockSize; ++i)
+		{
+			a += data[i];
+			b += a;
+		}
+
+		a %= ADLER_MODULUS;
+		b %= ADLER_MODULUS;
+		data += blockSize;
+		size -= blockSize;
+	}
+
+	return (b << 16) | a;
+}
+
+static void appendBigEndian(std::vector<uint8_t>& out, uint32_t value)
+{
+	out.push_back(static_cast<uint8_t>(value >> 24));
+	out.push_back(static_cast<uint8_t>(value >> 16));
+	out.push_back(static_cast<uint8_t>(value >> 8));
+	out.push_back(static_cast<uint8_t>(value));
+}
+
+static void appendChunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data)
+{
+	appendBigEndian(out, static_cast<uint32_t>(data.size()));
+
+	// The checksum covers the type and the data but not the length.
+	const size_t typeOffset = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data.begin(), data.end());
+	appendBigEndian(out, computeCrc(out.data() + typeOffset, out.size() - typeOffset));
+}
+
+std::vector<uint8_t> encodePng(const uint8_t* rgba, uint32_t width, uint32_t height)
+{
+	static const uint8_t SIGNATURE[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+	std::vector<uint8_t> header;
+	appendBigEndian(header, width);
+	appendBigEndian(header, height);
+	header.push_back(8);	// bit depth
+	header.push_back(6);	// RGBA
+	header.push_back(0);	// deflate
+	header.push_back(0);	// adaptive filtering
+	header.push_back(0);	// no interlacing
+
+	// Every row starts with its filter type, none of them is filtered.
+	const size_t rowSize = static_cast<size_t>(width) * 4;
+	std::vector<uint8_t> scanlines((rowSize + 1) * height);
+
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		uint8_t* row = &scanlines[(rowSize + 1) * y];
+		row[0] = 0;
+		std::copy(rgba + rowSize * y, rgba + rowSize * (y + 1), row + 1);
+	}
+
+	const size_t blockCount = std::max<size_t>((scanlines.size() + STORED_BLOCK_SIZE - 1) / STORED_BLOCK_SIZE, 1);
+	std::vector<uint8_t> compressed;
+	compressed.reserve(scanlines.size() + blockCount * 5 + 6);
+	compressed.push_back(0x78);
+	compressed.push_back(0x01);
+
+	for (size_t block = 0; block < blockCount; ++block)
+	{
+		const size_t offset = block * STORED_BLOCK_SIZE;
+		const uint16_t size = static_cast<uint16_t>(std::min(scanlines.size() - offset, STORED_BLOCK_SIZE));
+
+		compressed.push_back(block + 1 == blockCount ? 1 : 0);
+		compressed.push_back(static_cast<uint8_t>(size));
+		compressed.push_back(static_cast<uint8_t>(size >> 8));
+		compressed.push_back(static_cast<uint8_t>(~size));
+		compressed.push_back(static_cast<uint8_t>(~size >> 8));
+		compressed.insert(compressed.end(), scanlines.begin() + offset, scanlines.begin() + offset + size);
+	}
+
+	appendBigEndian(compressed, computeAdler(scanlines.data(), scanlines.size()));
+
+	std::vector<uint8_t> png(SIGNATURE, SIGNATURE + sizeof(SIGNATURE));
+	appendChunk(png, "IHDR", header);
+	appendChunk(png, "IDAT", compressed);
+	appendChunk(png, "IEND", std::vector<uint8_t>());
+	return png;
+}
+
+FrameCapture::FrameCapture()
+	: MAX_QUEUED_FRAMES(8),
+	m_format(CaptureFormat::Raw),
+	m_stopping(false),
+	m_writtenFrameCount(0),
+	m_failedFrameCount(0)
+{
+}
+
+FrameCapture::~FrameCapture()
+{
+	stop();
+}
+
+void FrameCapture::start(const std::string& directory, CaptureFormat format)
+{
+	m_directory = directory;
+	m_format = format;
+	m_stopping = false;
+	m_thread = std::thread(&FrameCapture::run, this);
+}
+
+void FrameCapture::stop()
+{
+	if (!m_thread.joinable())
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+
+	m_condition.notify_one();
+	m_thread.join();
+}
+
+bool FrameCapture::isRunning() const
+{
+	return m_thread.joinable();
+}
+
+std::vector<uint8_t> FrameCapture::takePixels()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (m_freePixels.empty())
+	{
+		return std::vector<uint8_t>();
+	}
+
+	std::vector<uint8_t> pixels = std::move(m_freePixels.back());
+	m_freePixels.pop_back();
+	return pixels;
+}
+
+bool FrameCapture::submit(CapturedFrame&& frame)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (m_queuedFrames.size() >= MAX_QUEUED_FRAMES)
+		{
+			m_freePixels.push_back(std::move(frame.pixels));
+			return false;
+		}
+
+		m_queuedFrames.push_back(std::move(frame));
+	}
+
+	m_condition.notify_one();
+	return true;
+}
+
+uint64_t FrameCapture::getWrittenFrameCount()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_writtenFrameCount;
+}
+
+uint64_t FrameCapture::getFailedFrameCount()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_failedFrameCount;
+}
+
+void FrameCapture::run()
+{
+	std::ofstream rawStream;
+
+	if (m_format == CaptureFormat::Raw)
+	{
+		rawStream.open(m_directory + "/capture.rgba", std::ios::binary);
+	}
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (true)
+	{
+		m_condition.wait(lock, [this]() { return m_stopping || !m_queuedFrames.empty(); });
+
+		// Stopping still drains the queue.
+		if (m_queuedFrames.empty())
+		{
+			break;
+		}
+
+		CapturedFrame frame = std::move(m_queuedFrames.front());
+		m_queuedFrames.pop_front();
+
+		lock.unlock();
+		const bool written = write(frame, rawStream);
+		lock.lock();
+
+		if (written)
+		{
+			++m_writtenFrameCount;
+		}
+		else
+		{
+			++m_failedFrameCount;
+		}
+
+		m_freePixels.push_back(std::move(frame.pixels));
+	}
+}
+
+bool FrameCapture::write(CapturedFrame& frame, std::ofstream& rawStream)
+{
+	// Swapchain alpha means nothing once the image leaves the window, so frames are stored opaque.
+	for (size_t i = 0; i < frame.pixels.size(); i += 4)
+	{
+		if (frame.bgra)
+		{
+			std::swap(frame.pixels[i], frame.pixels[i + 2]);
+		}
+
+		frame.pixels[i + 3] = 0xFF;
+	}
+
+	if (m_format == CaptureFormat::Raw)
+	{
+		rawStream.write(reinterpret_cast<const char*>(frame.pixels.data()), frame.pixels.size());
+		return rawStream.good();
+	}
+
+	char fileName[32];
+	snprintf(fileName, sizeof(fileName), "/frame_%06llu.png", static_cast<unsigned long long>(frame.frameNumber));
+
+	const std::vector<uint8_t> png = encodePng(frame.pixels.data(), frame.width, frame.height);
+	std::ofstream file(m_directory + fileName, std::ios::binary);
+	file.write(reinterpret_cast<const char*>(png.data()), png.size());
+	return file.good();
+}
\ No newline at end of file
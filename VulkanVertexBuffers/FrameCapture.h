@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <iosfwd>
+#include <cstddef>
+#include <cstdint>
+
+enum class CaptureFormat
+{
+	// Every frame appended to one capture.rgba stream.
+	Raw,
+	// One frame_<number>.png per frame.
+	Png
+};
+
+struct CapturedFrame
+{
+	uint64_t frameNumber;
+	uint32_t width;
+	uint32_t height;
+	bool bgra;
+	// Tightly packed rows of four bytes per pixel.
+	std::vector<uint8_t> pixels;
+};
+
+// Writes captured frames out on a background thread, so the render loop only pays for copying them
+// out of readback memory. Pixel vectors are handed back and forth instead of being reallocated.
+class FrameCapture
+{
+private:
+	const size_t MAX_QUEUED_FRAMES;
+
+	std::string m_directory;
+	CaptureFormat m_format;
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	std::deque<CapturedFrame> m_queuedFrames;
+	std::vector<std::vector<uint8_t>> m_freePixels;
+	bool m_stopping;
+	uint64_t m_writtenFrameCount;
+	uint64_t m_failedFrameCount;
+
+	void run();
+	bool write(CapturedFrame& frame, std::ofstream& rawStream);
+
+public:
+	FrameCapture();
+	~FrameCapture();
+
+	void start(const std::string& directory, CaptureFormat format);
+	// Writes everything still queued before returning.
+	void stop();
+	bool isRunning() const;
+
+	// Returns a recycled vector when one is free, its contents are undefined.
+	std::vector<uint8_t> takePixels();
+	// Returns false and drops the frame when the writer has fallen too far behind.
+	bool submit(CapturedFrame&& frame);
+
+	uint64_t getWrittenFrameCount();
+	uint64_t getFailedFrameCount();
+};
+
+// Encodes tightly packed RGBA rows as an 8-bit RGBA PNG. Deflate blocks are stored uncompressed,
+// trading file size for an encoder that keeps up with the frame rate.
+std::vector<uint8_t> encodePng(const uint8_t* rgba, uint32_t width, uint32_t height);
\ No newline at end of file
@@ -0,0 +1,515 @@
+#include "FrameGraph.h"
+#include <algorithm>
+#include <stdexcept>
+
+static const VkAccessFlags WRITE_ACCESS_MASK = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+	VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT |
+	VK_ACCESS_MEMORY_WRITE_BIT;
+static const uint32_t UNUSED_PASS = 0xFFFFFFFF;
+
+FrameGraph::FrameGraph()
+	: m_vkDevice(VK_NULL_HANDLE),
+	m_vkPhysicalDevice(VK_NULL_HANDLE),
+	m_vkAllocator(nullptr),
+	m_memoryBudget(nullptr),
+	m_vkTransientMemory(VK_NULL_HANDLE)
+{
+}
+
+void FrameGraph::init(VkDevice device, VkPhysicalDevice physicalDevice, const VkAllocationCallbacks* allocator,
+	MemoryBudget* memoryBudget)
+{
+	m_vkDevice = device;
+	m_vkPhysicalDevice = physicalDevice;
+	m_vkAllocator = allocator;
+	m_memoryBudget = memoryBudget;
+}
+
+uint32_t FrameGraph::addResource(const char* name, bool image)
+{
+	Resource resource = {};
+	resource.name = name;
+	resource.image = image;
+	resource.firstPass = UNUSED_PASS;
+	resource.lastPass = UNUSED_PASS;
+	resource.state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	m_resources.push_back(resource);
+	return static_cast<uint32_t>(m_resources.size() - 1);
+}
+
+uint32_t FrameGraph::importBuffer(const char* name)
+{
+	return addResource(name, false);
+}
+
+uint32_t FrameGraph::importImage(const char* name, VkImageAspectFlags aspect)
+{
+	const uint32_t resource = addResource(name, true);
+	m_resources[resource].aspect = aspect;
+	return resource;
+}
+
+uint32_t FrameGraph::createTransientImage(const char* name, VkFormat format, VkExtent2D extent,
+	VkImageUsageFlags usage, VkImageAspectFlags aspect)
+{
+	const uint32_t resource = addResource(name, true);
+
+	VkImageCreateInfo& imageInfo = m_resources[resource].imageInfo;
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = format;
+	imageInfo.extent = { extent.width, extent.height, 1 };
+	imageInfo.mipLevels = 1;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = usage;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	m_resources[resource].transient = true;
+	m_resources[resource].aspect = aspect;
+	return resource;
+}
+
+void FrameGraph::markOutput(uint32_t resource)
+{
+	m_resources[resource].output = true;
+}
+
+uint32_t FrameGraph::addPass(const char* name, std::function<void(VkCommandBuffer)> record)
+{
+	Pass pass;
+	pass.name = name;
+	pass.record = std::move(record);
+	pass.enabled = true;
+	pass.culled = false;
+
+	m_passes.push_back(std::move(pass));
+	return static_cast<uint32_t>(m_passes.size() - 1);
+}
+
+void FrameGraph::addAccess(uint32_t pass, uint32_t resource, const FrameAccess& access)
+{
+	// A pass that both reads and writes a resource is synchronized once for the union.
+	for (PassAccess& existing : m_passes[pass].accesses)
+	{
+		if (existing.resource == resource)
+		{
+			existing.access.stages |= access.stages;
+			existing.access.access |= access.access;
+			existing.access.layout = access.layout;
+			return;
+		}
+	}
+
+	m_passes[pass].accesses.push_back({ resource, access });
+}
+
+void FrameGraph::read(uint32_t pass, uint32_t resource, const FrameAccess& access)
+{
+	addAccess(pass, resource, access);
+}
+
+void FrameGraph::write(uint32_t pass, uint32_t resource, const FrameAccess& access)
+{
+	if ((access.access & WRITE_ACCESS_MASK) == 0 && access.layout == VK_IMAGE_LAYOUT_UNDEFINED)
+	{
+		throw std::runtime_error("Frame graph write declares no write access.");
+	}
+
+	addAccess(pass, resource, access);
+}
+
+void FrameGraph::setPassEnabled(uint32_t pass, bool enabled)
+{
+	m_passes[pass].enabled = enabled;
+}
+
+bool FrameGraph::isPassCulled(uint32_t pass) const
+{
+	return m_passes[pass].culled;
+}
+
+void FrameGraph::cullPasses()
+{
+	std::vector<char> needed(m_resources.size(), 0);
+
+	for (size_t resource = 0; resource < m_resources.size(); ++resource)
+	{
+		needed[resource] = m_resources[resource].output ? 1 : 0;
+	}
+
+	// Walking backwards, a pass survives if it writes something a later surviving pass or an
+	// output needs, and then everything it touches becomes needed in turn.
+	for (size_t i = m_passes.size(); i-- > 0;)
+	{
+		Pass& pass = m_passes[i];
+		pass.culled = true;
+
+		for (const PassAccess& passAccess : pass.accesses)
+		{
+			const bool writes = (passAccess.access.access & WRITE_ACCESS_MASK) != 0 ||
+				passAccess.access.layout != VK_IMAGE_LAYOUT_UNDEFINED;
+
+			if (writes && needed[passAccess.resource])
+			{
+				pass.culled = false;
+				break;
+			}
+		}
+
+		if (pass.culled)
+		{
+			continue;
+		}
+
+		for (const PassAccess& passAccess : pass.accesses)
+		{
+			needed[passAccess.resource] = 1;
+		}
+	}
+}
+
+void FrameGraph::computeLifetimes()
+{
+	for (uint32_t i = 0; i < m_passes.size(); ++i)
+	{
+		if (m_passes[i].culled)
+		{
+			continue;
+		}
+
+		for (const PassAccess& passAccess : m_passes[i].accesses)
+		{
+			Resource& resource = m_resources[passAccess.resource];
+			resource.firstPass = std::min(resource.firstPass, i);
+			resource.lastPass = resource.lastPass == UNUSED_PASS ? i : std::max(resource.lastPass, i);
+		}
+	}
+}
+
+void FrameGraph::allocateTransientImages()
+{
+	std::vector<uint32_t> transients;
+
+	for (uint32_t i = 0; i < m_resources.size(); ++i)
+	{
+		Resource& resource = m_resources[i];
+
+		if (!resource.transient || resource.firstPass == UNUSED_PASS)
+		{
+			continue;
+		}
+
+		VkResult result = vkCreateImage(m_vkDevice, &resource.imageInfo, m_vkAllocator, &resource.vkImage);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create transient image.");
+		}
+
+		vkGetImageMemoryRequirements(m_vkDevice, resource.vkImage, &resource.memoryRequirements);
+		transients.push_back(i);
+	}
+
+	if (transients.empty())
+	{
+		return;
+	}
+
+	std::sort(transients.begin(), transients.end(), [this](uint32_t left, uint32_t right)
+	{
+		return m_resources[left].memoryRequirements.size > m_resources[right].memoryRequirements.size;
+	});
+
+	// Largest first, each image takes the lowest offset that doesn't collide with an already
+	// placed image whose lifetime overlaps its own.
+	VkDeviceSize memorySize = 0;
+	uint32_t memoryTypeBits = ~0u;
+	std::vector<uint32_t> placed;
+
+	for (uint32_t index : transients)
+	{
+		Resource& resource = m_resources[index];
+		const VkDeviceSize alignment = resource.memoryRequirements.alignment;
+		VkDeviceSize offset = 0;
+		bool moved = true;
+
+		while (moved)
+		{
+			moved = false;
+
+			for (uint32_t other : placed)
+			{
+				const Resource& neighbour = m_resources[other];
+				const bool livesTogether = resource.firstPass <= neighbour.lastPass &&
+					neighbour.firstPass <= resource.lastPass;
+				const bool overlaps = offset < neighbour.memoryOffset + neighbour.memoryRequirements.size &&
+					neighbour.memoryOffset < offset + resource.memoryRequirements.size;
+
+				if (livesTogether && overlaps)
+				{
+					offset = neighbour.memoryOffset + neighbour.memoryRequirements.size;
+					offset = (offset + alignment - 1) / alignment * alignment;
+					moved = true;
+				}
+			}
+		}
+
+		resource.memoryOffset = offset;
+		memorySize = std::max(memorySize, offset + resource.memoryRequirements.size);
+		memoryTypeBits &= resource.memoryRequirements.memoryTypeBits;
+		placed.push_back(index);
+	}
+
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	vkGetPhysicalDeviceMemoryProperties(m_vkPhysicalDevice, &memoryProperties);
+
+	uint32_t memoryTypeIndex = VK_MAX_MEMORY_TYPES;
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
+	{
+		if ((memoryTypeBits & (1 << i)) &&
+			(memoryProperties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+		{
+			memoryTypeIndex = i;
+			break;
+		}
+	}
+
+	if (memoryTypeIndex == VK_MAX_MEMORY_TYPES)
+	{
+		throw std::runtime_error("Can't find memory type shared by transient images.");
+	}
+
+	VkMemoryAllocateInfo memoryAllocateInfo = {};
+	memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	memoryAllocateInfo.allocationSize = memorySize;
+	memoryAllocateInfo.memoryTypeIndex = memoryTypeIndex;
+
+	VkResult result = vkAllocateMemory(m_vkDevice, &memoryAllocateInfo, m_vkAllocator, &m_vkTransientMemory);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate transient image memory.");
+	}
+
+	m_memoryBudget->track(m_vkTransientMemory, memoryTypeIndex, memorySize);
+
+	for (uint32_t index : transients)
+	{
+		Resource& resource = m_resources[index];
+		vkBindImageMemory(m_vkDevice, resource.vkImage, m_vkTransientMemory, resource.memoryOffset);
+
+		VkImageViewCreateInfo viewInfo = {};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = resource.vkImage;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = resource.imageInfo.format;
+		viewInfo.subresourceRange.aspectMask = resource.aspect;
+		viewInfo.subresourceRange.levelCount = 1;
+		viewInfo.subresourceRange.layerCount = 1;
+
+		result = vkCreateImageView(m_vkDevice, &viewInfo, m_vkAllocator, &resource.view);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create transient image view.");
+		}
+	}
+}
+
+void FrameGraph::compile()
+{
+	cullPasses();
+	computeLifetimes();
+	allocateTransientImages();
+}
+
+void FrameGraph::bindBuffer(uint32_t resource, VkBuffer buffer)
+{
+	m_resources[resource].buffer = buffer;
+}
+
+void FrameGraph::bindImage(uint32_t resource, VkImage image, VkPipelineStageFlags waitStages)
+{
+	Resource& bound = m_resources[resource];
+	bound.vkImage = image;
+	bound.state = {};
+	bound.state.writeStages = waitStages;
+	bound.state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+}
+
+VkImageView FrameGraph::getImageView(uint32_t resource) const
+{
+	return m_resources[resource].view;
+}
+
+void FrameGraph::getAliasedState(uint32_t resource, VkPipelineStageFlags* outStages, VkAccessFlags* outAccess) const
+{
+	const Resource& aliased = m_resources[resource];
+	*outStages = 0;
+	*outAccess = 0;
+
+	// Any image sharing memory may have been the last to use it, in this frame or the previous one.
+	for (const Resource& other : m_resources)
+	{
+		if (other.transient && other.vkImage != VK_NULL_HANDLE &&
+			aliased.memoryOffset < other.memoryOffset + other.memoryRequirements.size &&
+			other.memoryOffset < aliased.memoryOffset + aliased.memoryRequirements.size)
+		{
+			*outStages |= other.state.writeStages | other.state.readStages;
+			*outAccess |= other.state.writeAccess;
+		}
+	}
+}
+
+void FrameGraph::execute(VkCommandBuffer commandBuffer)
+{
+	for (uint32_t i = 0; i < m_passes.size(); ++i)
+	{
+		const Pass& pass = m_passes[i];
+
+		if (pass.culled || !pass.enabled)
+		{
+			continue;
+		}
+
+		VkPipelineStageFlags sourceStages = 0;
+		VkPipelineStageFlags destinationStages = 0;
+		std::vector<VkMemoryBarrier> memoryBarriers;
+		std::vector<VkBufferMemoryBarrier> bufferBarriers;
+		std::vector<VkImageMemoryBarrier> imageBarriers;
+
+		for (const PassAccess& passAccess : pass.accesses)
+		{
+			Resource& resource = m_resources[passAccess.resource];
+			ResourceState& state = resource.state;
+			const FrameAccess& access = passAccess.access;
+
+			// Transient contents never survive a frame, their first use discards them.
+			const bool firstTransientUse = resource.transient && i == resource.firstPass;
+			const VkImageLayout oldLayout = firstTransientUse ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout;
+			const bool transition = resource.image && access.layout != oldLayout;
+			const bool writes = (access.access & WRITE_ACCESS_MASK) != 0 || transition;
+
+			VkPipelineStageFlags waitStages = state.writeStages;
+			VkAccessFlags waitAccess = state.writeAccess;
+
+			if (writes)
+			{
+				waitStages |= state.readStages;
+			}
+			else if ((access.stages & ~state.readStages) == 0 && (access.access & ~state.readAccess) == 0)
+			{
+				// Already made visible to these stages by an earlier barrier.
+				continue;
+			}
+
+			if (firstTransientUse)
+			{
+				VkPipelineStageFlags aliasedStages;
+				VkAccessFlags aliasedAccess;
+				getAliasedState(passAccess.resource, &aliasedStages, &aliasedAccess);
+				waitStages |= aliasedStages;
+				waitAccess |= aliasedAccess;
+			}
+
+			if (writes)
+			{
+				// Later readers need a barrier of their own to see what this pass wrote.
+				state.writeStages = access.stages;
+				state.writeAccess = access.access & WRITE_ACCESS_MASK;
+				state.readStages = 0;
+				state.readAccess = 0;
+				state.layout = resource.image ? access.layout : state.layout;
+			}
+			else
+			{
+				state.readStages |= access.stages;
+				state.readAccess |= access.access;
+			}
+
+			if (waitStages == 0)
+			{
+				continue;
+			}
+
+			sourceStages |= waitStages;
+			destinationStages |= access.stages;
+
+			if (resource.image)
+			{
+				VkImageMemoryBarrier barrier = {};
+				barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+				barrier.srcAccessMask = waitAccess;
+				barrier.dstAccessMask = access.access;
+				barrier.oldLayout = oldLayout;
+				barrier.newLayout = access.layout;
+				barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.image = resource.vkImage;
+				barrier.subresourceRange.aspectMask = resource.aspect;
+				barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+				barrier.subresourceRange.layerCount = 1;
+				imageBarriers.push_back(barrier);
+			}
+			else if (resource.buffer != VK_NULL_HANDLE)
+			{
+				VkBufferMemoryBarrier barrier = {};
+				barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+				barrier.srcAccessMask = waitAccess;
+				barrier.dstAccessMask = access.access;
+				barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.buffer = resource.buffer;
+				barrier.offset = 0;
+				barrier.size = VK_WHOLE_SIZE;
+				bufferBarriers.push_back(barrier);
+			}
+			else
+			{
+				VkMemoryBarrier barrier = {};
+				barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+				barrier.srcAccessMask = waitAccess;
+				barrier.dstAccessMask = access.access;
+				memoryBarriers.push_back(barrier);
+			}
+		}
+
+		if (sourceStages != 0)
+		{
+			vkCmdPipelineBarrier(commandBuffer, sourceStages, destinationStages, 0,
+				static_cast<uint32_t>(memoryBarriers.size()), memoryBarriers.data(),
+				static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+				static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+		}
+
+		if (pass.record)
+		{
+			pass.record(commandBuffer);
+		}
+	}
+}
+
+void FrameGraph::destroy()
+{
+	for (Resource& resource : m_resources)
+	{
+		if (!resource.transient || resource.vkImage == VK_NULL_HANDLE)
+		{
+			continue;
+		}
+
+		vkDestroyImageView(m_vkDevice, resource.view, m_vkAllocator);
+		vkDestroyImage(m_vkDevice, resource.vkImage, m_vkAllocator);
+	}
+
+	if (m_vkTransientMemory != VK_NULL_HANDLE)
+	{
+		m_memoryBudget->untrack(m_vkTransientMemory);
+		vkFreeMemory(m_vkDevice, m_vkTransientMemory, m_vkAllocator);
+	}
+
+	m_vkTransientMemory = VK_NULL_HANDLE;
+	m_resources.clear();
+	m_passes.clear();
+}
\ No newline at end of file
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <vulkan.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "MemoryBudget.h"
+
+// Declares how a pass touches a resource. Layout is only meaningful for images.
+struct FrameAccess
+{
+	VkPipelineStageFlags stages;
+	VkAccessFlags access;
+	VkImageLayout layout;
+};
+
+// Describes a frame as passes with declared resource accesses. Barriers and layout transitions
+// are derived from those declarations while executing, passes that contribute to no output are
+// culled, and transient images whose lifetimes don't overlap share one memory allocation.
+class FrameGraph
+{
+private:
+	struct ResourceState
+	{
+		VkPipelineStageFlags writeStages;
+		VkAccessFlags writeAccess;
+		VkPipelineStageFlags readStages;
+		VkAccessFlags readAccess;
+		VkImageLayout layout;
+	};
+
+	struct Resource
+	{
+		std::string name;
+		bool image;
+		bool transient;
+		bool output;
+		VkImageCreateInfo imageInfo;
+		VkImageAspectFlags aspect;
+		VkBuffer buffer;
+		VkImage vkImage;
+		VkImageView view;
+		VkMemoryRequirements memoryRequirements;
+		VkDeviceSize memoryOffset;
+		uint32_t firstPass;
+		uint32_t lastPass;
+		ResourceState state;
+	};
+
+	struct PassAccess
+	{
+		uint32_t resource;
+		FrameAccess access;
+	};
+
+	struct Pass
+	{
+		std::string name;
+		std::function<void(VkCommandBuffer)> record;
+		std::vector<PassAccess> accesses;
+		bool enabled;
+		bool culled;
+	};
+
+	VkDevice m_vkDevice;
+	VkPhysicalDevice m_vkPhysicalDevice;
+	const VkAllocationCallbacks* m_vkAllocator;
+	MemoryBudget* m_memoryBudget;
+	VkDeviceMemory m_vkTransientMemory;
+	std::vector<Resource> m_resources;
+	std::vector<Pass> m_passes;
+
+	uint32_t addResource(const char* name, bool image);
+	void addAccess(uint32_t pass, uint32_t resource, const FrameAccess& access);
+	void cullPasses();
+	void computeLifetimes();
+	void allocateTransientImages();
+	void getAliasedState(uint32_t resource, VkPipelineStageFlags* outStages, VkAccessFlags* outAccess) const;
+
+public:
+	FrameGraph();
+
+	void init(VkDevice device, VkPhysicalDevice physicalDevice, const VkAllocationCallbacks* allocator,
+		MemoryBudget* memoryBudget);
+
+	// Imported resources are owned elsewhere and bound to a handle before every execute.
+	// A buffer bound to VK_NULL_HANDLE stands for many buffers and is synchronized with global barriers.
+	uint32_t importBuffer(const char* name);
+	uint32_t importImage(const char* name, VkImageAspectFlags aspect);
+	uint32_t createTransientImage(const char* name, VkFormat format, VkExtent2D extent, VkImageUsageFlags usage,
+		VkImageAspectFlags aspect);
+	// Passes are kept only if they lead to a resource marked as output.
+	void markOutput(uint32_t resource);
+
+	uint32_t addPass(const char* name, std::function<void(VkCommandBuffer)> record);
+	void read(uint32_t pass, uint32_t resource, const FrameAccess& access);
+	void write(uint32_t pass, uint32_t resource, const FrameAccess& access);
+	void setPassEnabled(uint32_t pass, bool enabled);
+	bool isPassCulled(uint32_t pass) const;
+
+	void compile();
+
+	void bindBuffer(uint32_t resource, VkBuffer buffer);
+	// Resets the tracked layout, waitStages are the stages the image is acquired for.
+	void bindImage(uint32_t resource, VkImage image, VkPipelineStageFlags waitStages);
+	VkImageView getImageView(uint32_t resource) const;
+
+	void execute(VkCommandBuffer commandBuffer);
+	void destroy();
+};
\ No newline at end of file
@@ -0,0 +1,181 @@
+#include "FrustumCulling.h"
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+void BoundingSphereTable::resize(size_t count)
+{
+	centerX.resize(count);
+	centerY.resize(count);
+	centerZ.resize(count);
+	radius.resize(count);
+}
+
+void BoundingSphereTable::set(size_t index, const glm::vec4& sphere)
+{
+	centerX[index] = sphere.x;
+	centerY[index] = sphere.y;
+	centerZ[index] = sphere.z;
+	radius[index] = sphere.w;
+}
+
+glm::vec4 BoundingSphereTable::get(size_t index) const
+{
+	return glm::vec4(centerX[index], centerY[index], centerZ[index], radius[index]);
+}
+
+size_t BoundingSphereTable::size() const
+{
+	return radius.size();
+}
+
+bool isAvx2Supported()
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+	{
+		return false;
+	}
+
+	__cpuid(info, 1);
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool avx = (info[2] & (1 << 28)) != 0;
+
+	__cpuidex(info, 7, 0);
+	const bool avx2 = (info[1] & (1 << 5)) != 0;
+
+	return osxsave && avx && avx2 && (_xgetbv(0) & 0x6) == 0x6;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+CullingInstructionSet chooseCullingInstructionSet()
+{
+	return isAvx2Supported() ? CullingInstructionSet::Avx2 : CullingInstructionSet::Sse;
+}
+
+static size_t cullSpheresScalarRange(const BoundingSphereTable& table, const std::array<glm::vec4, 6>& planes,
+	size_t begin, uint32_t* outVisible)
+{
+	size_t visibleCount = 0;
+
+	for (size_t i = begin; i < table.size(); ++i)
+	{
+		bool visible = true;
+
+		for (const glm::vec4& plane : planes)
+		{
+			const float distance = plane.x * table.centerX[i] + plane.y * table.centerY[i] +
+				plane.z * table.centerZ[i] + plane.w;
+			visible = visible && distance >= -table.radius[i];
+		}
+
+		outVisible[visibleCount] = static_cast<uint32_t>(i);
+		visibleCount += visible ? 1 : 0;
+	}
+
+	return visibleCount;
+}
+
+size_t cullSpheresScalar(const BoundingSphereTable& table, const std::array<glm::vec4, 6>& planes,
+	uint32_t* outVisible)
+{
+	return cullSpheresScalarRange(table, planes, 0, outVisible);
+}
+
+size_t cullSpheresSse(const BoundingSphereTable& table, const std::array<glm::vec4, 6>& planes,
+	uint32_t* outVisible)
+{
+	const size_t count = table.size();
+	const size_t simdCount = count & ~static_cast<size_t>(3);
+	size_t visibleCount = 0;
+
+	for (size_t i = 0; i < simdCount; i += 4)
+	{
+		const __m128 x = _mm_loadu_ps(&table.centerX[i]);
+		const __m128 y = _mm_loadu_ps(&table.centerY[i]);
+		const __m128 z = _mm_loadu_ps(&table.centerZ[i]);
+		const __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&table.radius[i]));
+
+		__m128 visible = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+		for (const glm::vec4& plane : planes)
+		{
+			__m128 distance = _mm_mul_ps(x, _mm_set1_ps(plane.x));
+			distance = _mm_add_ps(distance, _mm_mul_ps(y, _mm_set1_ps(plane.y)));
+			distance = _mm_add_ps(distance, _mm_mul_ps(z, _mm_set1_ps(plane.z)));
+			distance = _mm_add_ps(distance, _mm_set1_ps(plane.w));
+			visible = _mm_and_ps(visible, _mm_cmpge_ps(distance, negativeRadius));
+		}
+
+		const int mask = _mm_movemask_ps(visible);
+
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			outVisible[visibleCount] = static_cast<uint32_t>(i + lane);
+			visibleCount += (mask >> lane) & 1;
+		}
+	}
+
+	return visibleCount + cullSpheresScalarRange(table, planes, simdCount, outVisible + visibleCount);
+}
+
+TARGET_AVX2
+size_t cullSpheresAvx2(const BoundingSphereTable& table, const std::array<glm::vec4, 6>& planes,
+	uint32_t* outVisible)
+{
+	const size_t count = table.size();
+	const size_t simdCount = count & ~static_cast<size_t>(7);
+	size_t visibleCount = 0;
+
+	for (size_t i = 0; i < simdCount; i += 8)
+	{
+		const __m256 x = _mm256_loadu_ps(&table.centerX[i]);
+		const __m256 y = _mm256_loadu_ps(&table.centerY[i]);
+		const __m256 z = _mm256_loadu_ps(&table.centerZ[i]);
+		const __m256 negativeRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&table.radius[i]));
+
+		__m256 visible = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+		for (const glm::vec4& plane : planes)
+		{
+			__m256 distance = _mm256_mul_ps(x, _mm256_set1_ps(plane.x));
+			distance = _mm256_add_ps(distance, _mm256_mul_ps(y, _mm256_set1_ps(plane.y)));
+			distance = _mm256_add_ps(distance, _mm256_mul_ps(z, _mm256_set1_ps(plane.z)));
+			distance = _mm256_add_ps(distance, _mm256_set1_ps(plane.w));
+			visible = _mm256_and_ps(visible, _mm256_cmp_ps(distance, negativeRadius, _CMP_GE_OQ));
+		}
+
+		const int mask = _mm256_movemask_ps(visible);
+
+		for (int lane = 0; lane < 8; ++lane)
+		{
+			outVisible[visibleCount] = static_cast<uint32_t>(i + lane);
+			visibleCount += (mask >> lane) & 1;
+		}
+	}
+
+	return visibleCount + cullSpheresScalarRange(table, planes, simdCount, outVisible + visibleCount);
+}
+
+size_t cullSpheres(CullingInstructionSet instructionSet, const BoundingSphereTable& table,
+	const std::array<glm::vec4, 6>& planes, uint32_t* outVisible)
+{
+	switch (instructionSet)
+	{
+	case CullingInstructionSet::Avx2:
+		return cullSpheresAvx2(table, planes, outVisible);
+	case CullingInstructionSet::Sse:
+		return cullSpheresSse(table, planes, outVisible);
+	default:
+		return cullSpheresScalar(table, planes, outVisible);
+	}
+}
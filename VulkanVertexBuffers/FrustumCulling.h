@@ -0,0 +1,41 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "glm/vec4.hpp"
+
+struct BoundingSphereTable
+{
+	std::vector<float> centerX;
+	std::vector<float> centerY;
+	std::vector<float> centerZ;
+	std::vector<float> radius;
+
+	void resize(size_t count);
+	void set(size_t index, const glm::vec4& sphere);
+	glm::vec4 get(size_t index) const;
+	size_t size() const;
+};
+
+enum class CullingInstructionSet
+{
+	Scalar,
+	Sse,
+	Avx2
+};
+
+bool isAvx2Supported();
+CullingInstructionSet chooseCullingInstructionSet();
+
+// Writes indices of spheres intersecting all six planes to outVisible, which must hold
+// table.size() entries, and returns how many were written.
+size_t cullSpheresScalar(const BoundingSphereTable& table, const std::array<glm::vec4, 6>& planes,
+	uint32_t* outVisible);
+size_t cullSpheresSse(const BoundingSphereTable& table, const std::array<glm::vec4, 6>& planes,
+	uint32_t* outVisible);
+size_t cullSpheresAvx2(const BoundingSphereTable& table, const std::array<glm::vec4, 6>& planes,
+	uint32_t* outVisible);
+size_t cullSpheres(CullingInstructionSet instructionSet, const BoundingSphereTable& table,
+	const std::array<glm::vec4, 6>& planes, uint32_t* outVisible);
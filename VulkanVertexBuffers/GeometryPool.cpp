@@ -0,0 +1,376 @@
+#include "GeometryPool.h"
+#include <algorithm>
+
+// Blocks filled above this ratio are not worth emptying.
+static const VkDeviceSize EVACUATION_OCCUPANCY_NUMERATOR = 1;
+static const VkDeviceSize EVACUATION_OCCUPANCY_DENOMINATOR = 2;
+static const uint32_t INVALID_BLOCK = 0xFFFFFFFF;
+
+GeometryPool::GeometryPool()
+	: m_alignment(1),
+	m_completedFrameCount(0),
+	m_evacuatedBlock(INVALID_BLOCK)
+{
+}
+
+void GeometryPool::init(VkDeviceSize alignment)
+{
+	m_alignment = std::max<VkDeviceSize>(alignment, 4);
+}
+
+void GeometryPool::addBlock(VkBuffer buffer, VkDeviceMemory memory, VkDeviceSize size, void* mappedMemory)
+{
+	Block block = {};
+	block.buffer = buffer;
+	block.memory = memory;
+	block.mappedMemory = mappedMemory;
+	block.size = size;
+	block.freeRanges.push_back({ 0, size });
+
+	for (Block& slot : m_blocks)
+	{
+		if (slot.buffer == VK_NULL_HANDLE)
+		{
+			slot = block;
+			return;
+		}
+	}
+
+	m_blocks.push_back(block);
+}
+
+bool GeometryPool::allocateRange(uint32_t block, VkDeviceSize size, VkDeviceSize* outOffset)
+{
+	std::vector<Range>& freeRanges = m_blocks[block].freeRanges;
+
+	for (size_t i = 0; i < freeRanges.size(); ++i)
+	{
+		if (freeRanges[i].size < size)
+		{
+			continue;
+		}
+
+		*outOffset = freeRanges[i].offset;
+		freeRanges[i].offset += size;
+		freeRanges[i].size -= size;
+
+		if (freeRanges[i].size == 0)
+		{
+			freeRanges.erase(freeRanges.begin() + i);
+		}
+
+		m_blocks[block].liveBytes += size;
+		return true;
+	}
+
+	return false;
+}
+
+void GeometryPool::releaseRange(uint32_t block, const Range& range, uint64_t lastUsedFrame)
+{
+	m_blocks[block].liveBytes -= range.size;
+
+	if (lastUsedFrame < m_completedFrameCount)
+	{
+		returnRange(block, range);
+		return;
+	}
+
+	m_blocks[block].pendingBytes += range.size;
+	m_pendingRanges.push_back({ lastUsedFrame, block, range });
+}
+
+void GeometryPool::returnRange(uint32_t block, const Range& range)
+{
+	std::vector<Range>& freeRanges = m_blocks[block].freeRanges;
+
+	auto position = std::lower_bound(freeRanges.begin(), freeRanges.end(), range,
+		[](const Range& left, const Range& right)
+	{
+		return left.offset < right.offset;
+	});
+
+	position = freeRanges.insert(position, range);
+
+	auto next = position + 1;
+	if (next != freeRanges.end() && position->offset + position->size == next->offset)
+	{
+		position->size += next->size;
+		freeRanges.erase(next);
+	}
+
+	if (position != freeRanges.begin())
+	{
+		auto previous = position - 1;
+		if (previous->offset + previous->size == position->offset)
+		{
+			previous->size += position->size;
+			freeRanges.erase(position);
+		}
+	}
+}
+
+uint32_t GeometryPool::allocate(VkDeviceSize size)
+{
+	const VkDeviceSize alignedSize = alignSize(size);
+
+	for (uint32_t block = 0; block < m_blocks.size(); ++block)
+	{
+		VkDeviceSize offset;
+
+		if (block == m_evacuatedBlock || m_blocks[block].buffer == VK_NULL_HANDLE ||
+			!allocateRange(block, alignedSize, &offset))
+		{
+			continue;
+		}
+
+		Allocation allocation = { block, offset, alignedSize, 0 };
+
+		if (m_freeAllocationSlots.empty())
+		{
+			m_allocations.push_back(allocation);
+			return static_cast<uint32_t>(m_allocations.size() - 1);
+		}
+
+		const uint32_t slot = m_freeAllocationSlots.back();
+		m_freeAllocationSlots.pop_back();
+		m_allocations[slot] = allocation;
+		return slot;
+	}
+
+	return INVALID_GEOMETRY_ALLOCATION;
+}
+
+void GeometryPool::free(uint32_t allocation, uint64_t lastUsedFrame)
+{
+	Allocation& freed = m_allocations[allocation];
+	releaseRange(freed.block, { freed.offset, freed.size }, std::max(lastUsedFrame, freed.movedFrame));
+
+	freed.block = INVALID_BLOCK;
+	m_freeAllocationSlots.push_back(allocation);
+}
+
+void GeometryPool::collect(uint64_t completedFrame)
+{
+	m_completedFrameCount = completedFrame + 1;
+
+	auto remaining = std::remove_if(m_pendingRanges.begin(), m_pendingRanges.end(),
+		[this, completedFrame](const PendingRange& pending)
+	{
+		if (pending.frame > completedFrame)
+		{
+			return false;
+		}
+
+		m_blocks[pending.block].pendingBytes -= pending.range.size;
+		returnRange(pending.block, pending.range);
+		return true;
+	});
+
+	m_pendingRanges.erase(remaining, m_pendingRanges.end());
+}
+
+size_t GeometryPool::getActiveBlockCount() const
+{
+	return std::count_if(m_blocks.begin(), m_blocks.end(), [](const Block& block)
+	{
+		return block.buffer != VK_NULL_HANDLE;
+	});
+}
+
+uint32_t GeometryPool::chooseEvacuatedBlock() const
+{
+	if (getActiveBlockCount() < 2)
+	{
+		return INVALID_BLOCK;
+	}
+
+	uint32_t emptiest = INVALID_BLOCK;
+	VkDeviceSize freeElsewhere = 0;
+
+	for (uint32_t block = 0; block < m_blocks.size(); ++block)
+	{
+		const Block& candidate = m_blocks[block];
+
+		// Empty blocks are about to be released, so they don't count as room.
+		if (candidate.buffer == VK_NULL_HANDLE || candidate.liveBytes == 0)
+		{
+			continue;
+		}
+
+		freeElsewhere += candidate.size - candidate.liveBytes - candidate.pendingBytes;
+
+		if (candidate.liveBytes > 0 &&
+			candidate.liveBytes * EVACUATION_OCCUPANCY_DENOMINATOR < candidate.size * EVACUATION_OCCUPANCY_NUMERATOR &&
+			(emptiest == INVALID_BLOCK || candidate.liveBytes < m_blocks[emptiest].liveBytes))
+		{
+			emptiest = block;
+		}
+	}
+
+	if (emptiest == INVALID_BLOCK)
+	{
+		return INVALID_BLOCK;
+	}
+
+	const Block& evacuated = m_blocks[emptiest];
+	freeElsewhere -= evacuated.size - evacuated.liveBytes - evacuated.pendingBytes;
+
+	return freeElsewhere >= evacuated.liveBytes ? emptiest : INVALID_BLOCK;
+}
+
+std::vector<GeometryMove> GeometryPool::defragment(VkDeviceSize maxBytes, uint64_t frame)
+{
+	std::vector<GeometryMove> moves;
+
+	if (m_evacuatedBlock == INVALID_BLOCK)
+	{
+		m_evacuatedBlock = chooseEvacuatedBlock();
+	}
+
+	if (m_evacuatedBlock == INVALID_BLOCK)
+	{
+		return moves;
+	}
+
+	// Fill the densest blocks first so the sparse ones drain.
+	std::vector<uint32_t> destinationOrder;
+	for (uint32_t block = 0; block < m_blocks.size(); ++block)
+	{
+		if (block != m_evacuatedBlock && m_blocks[block].buffer != VK_NULL_HANDLE && m_blocks[block].liveBytes > 0)
+		{
+			destinationOrder.push_back(block);
+		}
+	}
+
+	std::sort(destinationOrder.begin(), destinationOrder.end(), [this](uint32_t left, uint32_t right)
+	{
+		return m_blocks[left].liveBytes > m_blocks[right].liveBytes;
+	});
+
+	VkDeviceSize movedBytes = 0;
+
+	for (uint32_t id = 0; id < m_allocations.size() && m_evacuatedBlock != INVALID_BLOCK; ++id)
+	{
+		Allocation& allocation = m_allocations[id];
+
+		if (allocation.block != m_evacuatedBlock)
+		{
+			continue;
+		}
+
+		if (!moves.empty() && movedBytes + allocation.size > maxBytes)
+		{
+			break;
+		}
+
+		uint32_t destinationBlock = INVALID_BLOCK;
+		VkDeviceSize destinationOffset = 0;
+
+		for (uint32_t block : destinationOrder)
+		{
+			if (allocateRange(block, allocation.size, &destinationOffset))
+			{
+				destinationBlock = block;
+				break;
+			}
+		}
+
+		if (destinationBlock == INVALID_BLOCK)
+		{
+			// Free space is too fragmented to take this allocation, try another block later.
+			m_evacuatedBlock = INVALID_BLOCK;
+			break;
+		}
+
+		GeometryMove move = {};
+		move.allocation = id;
+		move.sourceBuffer = m_blocks[allocation.block].buffer;
+		move.sourceOffset = allocation.offset;
+		move.destinationBuffer = m_blocks[destinationBlock].buffer;
+		move.destinationOffset = destinationOffset;
+		move.size = allocation.size;
+		moves.push_back(move);
+
+		// Earlier frames and the copy itself still read the old range.
+		releaseRange(allocation.block, { allocation.offset, allocation.size }, frame);
+		allocation.block = destinationBlock;
+		allocation.offset = destinationOffset;
+		allocation.movedFrame = frame;
+		movedBytes += allocation.size;
+	}
+
+	if (m_evacuatedBlock != INVALID_BLOCK && m_blocks[m_evacuatedBlock].liveBytes == 0)
+	{
+		m_evacuatedBlock = INVALID_BLOCK;
+	}
+
+	return moves;
+}
+
+std::vector<GeometryBlockHandles> GeometryPool::releaseEmptyBlocks()
+{
+	std::vector<GeometryBlockHandles> released;
+
+	for (Block& block : m_blocks)
+	{
+		// Keep the last block around so steady-state uploads don't churn allocations.
+		if (block.buffer == VK_NULL_HANDLE || block.liveBytes > 0 || block.pendingBytes > 0 ||
+			getActiveBlockCount() < 2)
+		{
+			continue;
+		}
+
+		released.push_back({ block.buffer, block.memory });
+		block = Block();
+	}
+
+	return released;
+}
+
+std::vector<GeometryBlockHandles> GeometryPool::releaseAllBlocks()
+{
+	std::vector<GeometryBlockHandles> released;
+
+	for (Block& block : m_blocks)
+	{
+		if (block.buffer != VK_NULL_HANDLE)
+		{
+			released.push_back({ block.buffer, block.memory });
+		}
+	}
+
+	m_blocks.clear();
+	m_allocations.clear();
+	m_freeAllocationSlots.clear();
+	m_pendingRanges.clear();
+	m_evacuatedBlock = INVALID_BLOCK;
+	return released;
+}
+
+VkDeviceSize GeometryPool::alignSize(VkDeviceSize size) const
+{
+	return (size + m_alignment - 1) / m_alignment * m_alignment;
+}
+
+VkBuffer GeometryPool::getBuffer(uint32_t allocation) const
+{
+	return m_blocks[m_allocations[allocation].block].buffer;
+}
+
+VkDeviceSize GeometryPool::getOffset(uint32_t allocation) const
+{
+	return m_allocations[allocation].offset;
+}
+
+VkDeviceSize GeometryPool::getSize(uint32_t allocation) const
+{
+	return m_allocations[allocation].size;
+}
+
+void* GeometryPool::getMappedMemory(uint32_t allocation) const
+{
+	const Allocation& mapped = m_allocations[allocation];
+	char* blockMemory = static_cast<char*>(m_blocks[mapped.block].mappedMemory);
+	return blockMemory != nullptr ? blockMemory + mapped.offset : nullptr;
+}
\ No newline at end of file
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <vulkan.h>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+constexpr uint32_t INVALID_GEOMETRY_ALLOCATION = 0xFFFFFFFF;
+
+struct GeometryMove
+{
+	uint32_t allocation;
+	VkBuffer sourceBuffer;
+	VkDeviceSize sourceOffset;
+	VkBuffer destinationBuffer;
+	VkDeviceSize destinationOffset;
+	VkDeviceSize size;
+};
+
+struct GeometryBlockHandles
+{
+	VkBuffer buffer;
+	VkDeviceMemory memory;
+};
+
+// Sub-allocates geometry from a few large device buffers. Allocations are referenced by id,
+// so compaction can move them between blocks without invalidating the holders.
+class GeometryPool
+{
+private:
+	struct Range
+	{
+		VkDeviceSize offset;
+		VkDeviceSize size;
+	};
+
+	struct PendingRange
+	{
+		uint64_t frame;
+		uint32_t block;
+		Range range;
+	};
+
+	struct Block
+	{
+		VkBuffer buffer;
+		VkDeviceMemory memory;
+		void* mappedMemory;
+		VkDeviceSize size;
+		VkDeviceSize liveBytes;
+		VkDeviceSize pendingBytes;
+		std::vector<Range> freeRanges;
+	};
+
+	struct Allocation
+	{
+		uint32_t block;
+		VkDeviceSize offset;
+		VkDeviceSize size;
+		// Frame whose compaction copy last wrote the allocation.
+		uint64_t movedFrame;
+	};
+
+	VkDeviceSize m_alignment;
+	uint64_t m_completedFrameCount;
+	uint32_t m_evacuatedBlock;
+	std::vector<Block> m_blocks;
+	std::vector<Allocation> m_allocations;
+	std::vector<uint32_t> m_freeAllocationSlots;
+	std::vector<PendingRange> m_pendingRanges;
+
+	bool allocateRange(uint32_t block, VkDeviceSize size, VkDeviceSize* outOffset);
+	void releaseRange(uint32_t block, const Range& range, uint64_t lastUsedFrame);
+	void returnRange(uint32_t block, const Range& range);
+	uint32_t chooseEvacuatedBlock() const;
+	size_t getActiveBlockCount() const;
+
+public:
+	GeometryPool();
+
+	void init(VkDeviceSize alignment);
+	// mappedMemory is the persistent host mapping of a host-visible block, or nullptr.
+	void addBlock(VkBuffer buffer, VkDeviceMemory memory, VkDeviceSize size, void* mappedMemory);
+
+	// Returns INVALID_GEOMETRY_ALLOCATION when no block has room, the caller then adds one.
+	uint32_t allocate(VkDeviceSize size);
+	// The range becomes reusable once lastUsedFrame has completed.
+	void free(uint32_t allocation, uint64_t lastUsedFrame);
+	void collect(uint64_t completedFrame);
+
+	// Moves up to maxBytes out of the emptiest block so it can be released. The returned copies
+	// must execute in frame before anything reads the moved allocations.
+	std::vector<GeometryMove> defragment(VkDeviceSize maxBytes, uint64_t frame);
+	std::vector<GeometryBlockHandles> releaseEmptyBlocks();
+	std::vector<GeometryBlockHandles> releaseAllBlocks();
+
+	VkDeviceSize alignSize(VkDeviceSize size) const;
+	VkBuffer getBuffer(uint32_t allocation) const;
+	VkDeviceSize getOffset(uint32_t allocation) const;
+	VkDeviceSize getSize(uint32_t allocation) const;
+	void* getMappedMemory(uint32_t allocation) const;
+};
\ No newline at end of file
@@ -0,0 +1,389 @@
+#include "HostAllocator.h"
+#include <algorithm>
+#include <new>
+#include <cstring>
+
+static const uint32_t LARGE_SIZE_CLASS = 0xFFFFFFFF;
+static const uint32_t FRAME_SIZE_CLASS = 0xFFFFFFFE;
+static const std::align_val_t BLOCK_ALIGNMENT = std::align_val_t(16);
+static const char* ARENA_NAMES[] = { "object", "command", "frame" };
+
+// Precedes every pointer handed out, so frees and reallocations find their block and arena.
+struct BlockHeader
+{
+	uint32_t arena;
+	uint32_t sizeClass;
+	uint32_t offset;
+	uint32_t size;
+};
+
+static_assert(sizeof(BlockHeader) == 16, "Blocks are 16 byte aligned, so the header costs no padding below that.");
+
+HostAllocator::HostAllocator()
+	: m_arenas(),
+	m_frameCount(0)
+{
+	m_framePages.push_back({ 0, std::vector<FramePage>(), nullptr, nullptr });
+
+	for (size_t i = 0; i < ARENA_COUNT; ++i)
+	{
+		m_bindings[i].allocator = this;
+		m_bindings[i].arena = static_cast<HostArena>(i);
+
+		VkAllocationCallbacks& callbacks = m_callbacks[i];
+		callbacks.pUserData = &m_bindings[i];
+		callbacks.pfnAllocation = allocationCallback;
+		callbacks.pfnReallocation = reallocationCallback;
+		callbacks.pfnFree = freeCallback;
+		callbacks.pfnInternalAllocation = internalAllocationCallback;
+		callbacks.pfnInternalFree = internalFreeCallback;
+	}
+}
+
+HostAllocator::~HostAllocator()
+{
+	for (Arena& arena : m_arenas)
+	{
+		for (char* chunk : arena.chunks)
+		{
+			::operator delete(chunk, BLOCK_ALIGNMENT);
+		}
+	}
+
+	for (const FramePages& framePages : m_framePages)
+	{
+		for (const FramePage& page : framePages.pages)
+		{
+			::operator delete(page.memory, BLOCK_ALIGNMENT);
+		}
+	}
+
+	for (char* page : m_freeFramePages)
+	{
+		::operator delete(page, BLOCK_ALIGNMENT);
+	}
+}
+
+const VkAllocationCallbacks* HostAllocator::getCallbacks(HostArena arena) const
+{
+	return &m_callbacks[static_cast<size_t>(arena)];
+}
+
+char* HostAllocator::takeBlock(Arena& arena, size_t sizeClass)
+{
+	const size_t blockBytes = MIN_SIZE_CLASS_BYTES << sizeClass;
+
+	if (arena.freeLists[sizeClass] == nullptr)
+	{
+		char* chunk = static_cast<char*>(::operator new(CHUNK_BYTES, BLOCK_ALIGNMENT, std::nothrow));
+		if (chunk == nullptr)
+		{
+			return nullptr;
+		}
+
+		arena.chunks.push_back(chunk);
+		arena.statistics.reservedBytes += CHUNK_BYTES;
+
+		for (size_t offset = CHUNK_BYTES; offset >= blockBytes; offset -= blockBytes)
+		{
+			char* block = chunk + offset - blockBytes;
+			*reinterpret_cast<char**>(block) = arena.freeLists[sizeClass];
+			arena.freeLists[sizeClass] = block;
+		}
+	}
+
+	char* block = arena.freeLists[sizeClass];
+	arena.freeLists[sizeClass] = *reinterpret_cast<char**>(block);
+	return block;
+}
+
+char* HostAllocator::takeFrameBlock(Arena& arena, size_t blockBytes)
+{
+	FramePages& framePages = m_framePages.back();
+	// Keeps every block 16 byte aligned like the pooled ones.
+	const size_t alignedBytes = (blockBytes + MIN_SIZE_CLASS_BYTES - 1) & ~(MIN_SIZE_CLASS_BYTES - 1);
+
+	if (framePages.cursor != nullptr && alignedBytes <= static_cast<size_t>(framePages.limit - framePages.cursor))
+	{
+		char* block = framePages.cursor;
+		framePages.cursor += alignedBytes;
+		return block;
+	}
+
+	// Blocks larger than a page get one of their own, the current page keeps serving smaller ones.
+	const size_t pageBytes = alignedBytes > CHUNK_BYTES ? alignedBytes : CHUNK_BYTES;
+	char* page;
+
+	if (pageBytes == CHUNK_BYTES && !m_freeFramePages.empty())
+	{
+		page = m_freeFramePages.back();
+		m_freeFramePages.pop_back();
+	}
+	else
+	{
+		page = static_cast<char*>(::operator new(pageBytes, BLOCK_ALIGNMENT, std::nothrow));
+		if (page == nullptr)
+		{
+			return nullptr;
+		}
+
+		arena.statistics.reservedBytes += pageBytes;
+	}
+
+	framePages.pages.push_back({ page, pageBytes });
+
+	if (pageBytes == CHUNK_BYTES)
+	{
+		framePages.cursor = page + alignedBytes;
+		framePages.limit = page + CHUNK_BYTES;
+	}
+
+	return page;
+}
+
+void* HostAllocator::allocate(HostArena arenaId, size_t size, size_t alignment)
+{
+	if (size == 0 || size > UINT32_MAX)
+	{
+		return nullptr;
+	}
+
+	// Blocks start 16 byte aligned, stricter alignments may need padding before the header.
+	const size_t padding = alignment > sizeof(BlockHeader) ? alignment - sizeof(BlockHeader) : 0;
+	const size_t blockBytes = size + sizeof(BlockHeader) + padding;
+	Arena& arena = m_arenas[static_cast<size_t>(arenaId)];
+
+	uint32_t sizeClass = 0;
+	while (sizeClass < SIZE_CLASS_COUNT && (MIN_SIZE_CLASS_BYTES << sizeClass) < blockBytes)
+	{
+		++sizeClass;
+	}
+
+	char* block;
+
+	if (arenaId == HostArena::Frame)
+	{
+		sizeClass = FRAME_SIZE_CLASS;
+		block = takeFrameBlock(arena, blockBytes);
+	}
+	else if (sizeClass < SIZE_CLASS_COUNT)
+	{
+		block = takeBlock(arena, sizeClass);
+	}
+	else
+	{
+		sizeClass = LARGE_SIZE_CLASS;
+		block = static_cast<char*>(::operator new(blockBytes, BLOCK_ALIGNMENT, std::nothrow));
+	}
+
+	if (block == nullptr)
+	{
+		return nullptr;
+	}
+
+	const uintptr_t blockAddress = reinterpret_cast<uintptr_t>(block);
+	const uintptr_t address = (blockAddress + sizeof(BlockHeader) + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+
+	BlockHeader* header = reinterpret_cast<BlockHeader*>(address) - 1;
+	header->arena = static_cast<uint32_t>(arenaId);
+	header->sizeClass = sizeClass;
+	header->offset = static_cast<uint32_t>(address - blockAddress);
+	header->size = static_cast<uint32_t>(size);
+
+	HostArenaStatistics& statistics = arena.statistics;
+	++statistics.allocationCount;
+	statistics.liveBytes += size;
+	statistics.peakBytes = std::max(statistics.peakBytes, statistics.liveBytes);
+
+	if (sizeClass == LARGE_SIZE_CLASS)
+	{
+		statistics.reservedBytes += header->offset + size;
+	}
+
+	return reinterpret_cast<void*>(address);
+}
+
+void* HostAllocator::reallocate(HostArena arenaId, void* original, size_t size, size_t alignment)
+{
+	if (original == nullptr)
+	{
+		return allocate(arenaId, size, alignment);
+	}
+
+	if (size == 0)
+	{
+		free(original);
+		return nullptr;
+	}
+
+	BlockHeader* header = static_cast<BlockHeader*>(original) - 1;
+	const bool aligned = (reinterpret_cast<uintptr_t>(original) & (alignment - 1)) == 0;
+
+	if (header->sizeClass < SIZE_CLASS_COUNT && aligned &&
+		header->offset + size <= (MIN_SIZE_CLASS_BYTES << header->sizeClass))
+	{
+		// Still fits the block it already has.
+		HostArenaStatistics& statistics = m_arenas[header->arena].statistics;
+		statistics.liveBytes = statistics.liveBytes - header->size + size;
+		statistics.peakBytes = std::max(statistics.peakBytes, statistics.liveBytes);
+		header->size = static_cast<uint32_t>(size);
+		return original;
+	}
+
+	// On failure the original allocation has to stay valid.
+	void* memory = allocate(arenaId, size, alignment);
+	if (memory == nullptr)
+	{
+		return nullptr;
+	}
+
+	memcpy(memory, original, std::min<size_t>(header->size, size));
+	free(original);
+	return memory;
+}
+
+void HostAllocator::free(void* memory)
+{
+	if (memory == nullptr)
+	{
+		return;
+	}
+
+	const BlockHeader header = *(static_cast<BlockHeader*>(memory) - 1);
+	Arena& arena = m_arenas[header.arena];
+	char* block = static_cast<char*>(memory) - header.offset;
+
+	++arena.statistics.freeCount;
+	arena.statistics.liveBytes -= header.size;
+
+	if (header.sizeClass == LARGE_SIZE_CLASS)
+	{
+		arena.statistics.reservedBytes -= header.offset + header.size;
+		::operator delete(block, BLOCK_ALIGNMENT);
+		return;
+	}
+
+	// Frame blocks go back with their whole page.
+	if (header.sizeClass == FRAME_SIZE_CLASS)
+	{
+		return;
+	}
+
+	*reinterpret_cast<char**>(block) = arena.freeLists[header.sizeClass];
+	arena.freeLists[header.sizeClass] = block;
+}
+
+HostArena HostAllocator::chooseArena(void* userData, VkSystemAllocationScope scope)
+{
+	// Command scoped memory is released before the call returns, so it never mixes with longer lifetimes.
+	if (scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND)
+	{
+		return HostArena::Command;
+	}
+
+	return static_cast<ArenaBinding*>(userData)->arena;
+}
+
+void* VKAPI_CALL HostAllocator::allocationCallback(void* userData, size_t size, size_t alignment,
+	VkSystemAllocationScope scope)
+{
+	HostAllocator* allocator = static_cast<ArenaBinding*>(userData)->allocator;
+	std::lock_guard<std::mutex> lock(allocator->m_mutex);
+	return allocator->allocate(chooseArena(userData, scope), size, alignment);
+}
+
+void* VKAPI_CALL HostAllocator::reallocationCallback(void* userData, void* original, size_t size, size_t alignment,
+	VkSystemAllocationScope scope)
+{
+	HostAllocator* allocator = static_cast<ArenaBinding*>(userData)->allocator;
+	std::lock_guard<std::mutex> lock(allocator->m_mutex);
+	return allocator->reallocate(chooseArena(userData, scope), original, size, alignment);
+}
+
+void VKAPI_CALL HostAllocator::freeCallback(void* userData, void* memory)
+{
+	HostAllocator* allocator = static_cast<ArenaBinding*>(userData)->allocator;
+	std::lock_guard<std::mutex> lock(allocator->m_mutex);
+	allocator->free(memory);
+}
+
+void VKAPI_CALL HostAllocator::internalAllocationCallback(void* userData, size_t size,
+	VkInternalAllocationType allocationType, VkSystemAllocationScope scope)
+{
+	HostAllocator* allocator = static_cast<ArenaBinding*>(userData)->allocator;
+	std::lock_guard<std::mutex> lock(allocator->m_mutex);
+	allocator->m_arenas[static_cast<size_t>(chooseArena(userData, scope))].statistics.internalBytes += size;
+}
+
+void VKAPI_CALL HostAllocator::internalFreeCallback(void* userData, size_t size,
+	VkInternalAllocationType allocationType, VkSystemAllocationScope scope)
+{
+	HostAllocator* allocator = static_cast<ArenaBinding*>(userData)->allocator;
+	std::lock_guard<std::mutex> lock(allocator->m_mutex);
+	allocator->m_arenas[static_cast<size_t>(chooseArena(userData, scope))].statistics.internalBytes -= size;
+}
+
+void HostAllocator::beginFrame(uint64_t frame)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	++m_frameCount;
+
+	if (m_framePages.back().frame != frame)
+	{
+		m_framePages.push_back({ frame, std::vector<FramePage>(), nullptr, nullptr });
+	}
+}
+
+void HostAllocator::collect(uint64_t completedFrame)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	HostArenaStatistics& statistics = m_arenas[static_cast<size_t>(HostArena::Frame)].statistics;
+
+	// The current frame's pages stay, even when it is the one completing.
+	while (m_framePages.size() > 1 && m_framePages.front().frame <= completedFrame)
+	{
+		for (const FramePage& page : m_framePages.front().pages)
+		{
+			if (page.size == CHUNK_BYTES)
+			{
+				m_freeFramePages.push_back(page.memory);
+			}
+			else
+			{
+				statistics.reservedBytes -= page.size;
+				::operator delete(page.memory, BLOCK_ALIGNMENT);
+			}
+		}
+
+		m_framePages.pop_front();
+	}
+}
+
+HostArenaStatistics HostAllocator::getStatistics(HostArena arena)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_arenas[static_cast<size_t>(arena)].statistics;
+}
+
+void HostAllocator::report(std::ostream& out)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	out << "Vulkan host allocations over " << m_frameCount << " frames:" << std::endl;
+
+	for (size_t i = 0; i < ARENA_COUNT; ++i)
+	{
+		const HostArenaStatistics& statistics = m_arenas[i].statistics;
+
+		out << "  " << ARENA_NAMES[i] << ": " << statistics.allocationCount << " allocations";
+
+		if (m_frameCount > 0)
+		{
+			out << " (" << statistics.allocationCount / m_frameCount << " per frame)";
+		}
+
+		out << ", " << statistics.freeCount << " frees, " << statistics.liveBytes << " B live, " <<
+			statistics.peakBytes << " B peak, " << statistics.reservedBytes << " B reserved, " <<
+			statistics.internalBytes << " B driver internal" << std::endl;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <vulkan.h>
+#include <array>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#include <deque>
+#include <cstddef>
+#include <cstdint>
+
+enum class HostArena
+{
+	Object,
+	Command,
+	Frame
+};
+
+struct HostArenaStatistics
+{
+	uint64_t allocationCount;
+	uint64_t freeCount;
+	size_t liveBytes;
+	size_t peakBytes;
+	size_t reservedBytes;
+	size_t internalBytes;
+};
+
+// Serves the driver's host allocations from per-arena size-class pools instead of the general heap.
+// Command scoped allocations always go to the command arena. Everything else goes to the arena the
+// callbacks were taken from. The frame arena bumps through pages owned by the current frame and is
+// only for objects retired in that frame: freeing its blocks does nothing, the pages are recycled as
+// a whole once collect passes the frame. Every block records its arena, so callbacks of any arena can
+// free what another one allocated.
+class HostAllocator
+{
+private:
+	static const size_t ARENA_COUNT = 3;
+	static const size_t SIZE_CLASS_COUNT = 9;
+	static const size_t MIN_SIZE_CLASS_BYTES = 16;
+	static const size_t CHUNK_BYTES = 64 * 1024;
+
+	struct Arena
+	{
+		// Free blocks of each class are linked through their first bytes.
+		std::array<char*, SIZE_CLASS_COUNT> freeLists;
+		std::vector<char*> chunks;
+		HostArenaStatistics statistics;
+	};
+
+	struct FramePage
+	{
+		char* memory;
+		size_t size;
+	};
+
+	struct FramePages
+	{
+		uint64_t frame;
+		std::vector<FramePage> pages;
+		char* cursor;
+		char* limit;
+	};
+
+	struct ArenaBinding
+	{
+		HostAllocator* allocator;
+		HostArena arena;
+	};
+
+	std::mutex m_mutex;
+	std::array<Arena, ARENA_COUNT> m_arenas;
+	std::array<ArenaBinding, ARENA_COUNT> m_bindings;
+	std::array<VkAllocationCallbacks, ARENA_COUNT> m_callbacks;
+	uint64_t m_frameCount;
+	std::deque<FramePages> m_framePages;
+	std::vector<char*> m_freeFramePages;
+
+	void* allocate(HostArena arena, size_t size, size_t alignment);
+	void* reallocate(HostArena arena, void* original, size_t size, size_t alignment);
+	void free(void* memory);
+	char* takeBlock(Arena& arena, size_t sizeClass);
+	char* takeFrameBlock(Arena& arena, size_t blockBytes);
+
+	static HostArena chooseArena(void* userData, VkSystemAllocationScope scope);
+	static void* VKAPI_CALL allocationCallback(void* userData, size_t size, size_t alignment,
+		VkSystemAllocationScope scope);
+	static void* VKAPI_CALL reallocationCallback(void* userData, void* original, size_t size, size_t alignment,
+		VkSystemAllocationScope scope);
+	static void VKAPI_CALL freeCallback(void* userData, void* memory);
+	static void VKAPI_CALL internalAllocationCallback(void* userData, size_t size,
+		VkInternalAllocationType allocationType, VkSystemAllocationScope scope);
+	static void VKAPI_CALL internalFreeCallback(void* userData, size_t size,
+		VkInternalAllocationType allocationType, VkSystemAllocationScope scope);
+
+public:
+	HostAllocator();
+	~HostAllocator();
+
+	// The callbacks point back into this object.
+	HostAllocator(const HostAllocator&) = delete;
+	HostAllocator& operator=(const HostAllocator&) = delete;
+
+	const VkAllocationCallbacks* getCallbacks(HostArena arena) const;
+	// Frame arena allocations made from now on belong to frame.
+	void beginFrame(uint64_t frame);
+	// Recycles the frame arena pages of every frame up to completedFrame. Whatever was allocated
+	// from them must have been freed already.
+	void collect(uint64_t completedFrame);
+	HostArenaStatistics getStatistics(HostArena arena);
+	void report(std::ostream& out);
+};
\ No newline at end of file
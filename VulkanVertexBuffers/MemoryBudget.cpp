@@ -0,0 +1,115 @@
+#include "MemoryBudget.h"
+
+// Without driver numbers, leave room for other processes and driver-internal allocations.
+static const VkDeviceSize FALLBACK_BUDGET_NUMERATOR = 8;
+static const VkDeviceSize FALLBACK_BUDGET_DENOMINATOR = 10;
+
+MemoryBudget::MemoryBudget()
+	: m_memoryProperties(),
+	m_vkPhysicalDevice(VK_NULL_HANDLE),
+	m_vkGetPhysicalDeviceMemoryProperties2(nullptr),
+	m_allocatedBytes(),
+	m_allocatedBytesAtRefresh(),
+	m_reportedUsages(),
+	m_heapBudgets()
+{
+}
+
+void MemoryBudget::init(VkPhysicalDevice physicalDevice,
+	PFN_vkGetPhysicalDeviceMemoryProperties2KHR getPhysicalDeviceMemoryProperties2)
+{
+	m_vkPhysicalDevice = physicalDevice;
+	m_vkGetPhysicalDeviceMemoryProperties2 = getPhysicalDeviceMemoryProperties2;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &m_memoryProperties);
+
+	for (uint32_t heap = 0; heap < m_memoryProperties.memoryHeapCount; ++heap)
+	{
+		m_heapBudgets[heap] = m_memoryProperties.memoryHeaps[heap].size * FALLBACK_BUDGET_NUMERATOR /
+			FALLBACK_BUDGET_DENOMINATOR;
+	}
+
+	refresh();
+}
+
+void MemoryBudget::refresh()
+{
+	if (m_vkGetPhysicalDeviceMemoryProperties2 == nullptr)
+	{
+		return;
+	}
+
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+	budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+	VkPhysicalDeviceMemoryProperties2KHR memoryProperties = {};
+	memoryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+	memoryProperties.pNext = &budgetProperties;
+
+	m_vkGetPhysicalDeviceMemoryProperties2(m_vkPhysicalDevice, &memoryProperties);
+
+	for (uint32_t heap = 0; heap < m_memoryProperties.memoryHeapCount; ++heap)
+	{
+		m_heapBudgets[heap] = budgetProperties.heapBudget[heap];
+		m_reportedUsages[heap] = budgetProperties.heapUsage[heap];
+	}
+
+	m_allocatedBytesAtRefresh = m_allocatedBytes;
+}
+
+void MemoryBudget::track(VkDeviceMemory memory, uint32_t memoryTypeIndex, VkDeviceSize size)
+{
+	const uint32_t heapIndex = getHeapIndex(memoryTypeIndex);
+	m_allocations[memory] = { heapIndex, size };
+	m_allocatedBytes[heapIndex] += size;
+}
+
+void MemoryBudget::untrack(VkDeviceMemory memory)
+{
+	auto allocation = m_allocations.find(memory);
+	if (allocation == m_allocations.end())
+	{
+		return;
+	}
+
+	m_allocatedBytes[allocation->second.heapIndex] -= allocation->second.size;
+	m_allocations.erase(allocation);
+}
+
+bool MemoryBudget::fits(uint32_t memoryTypeIndex, VkDeviceSize size) const
+{
+	const uint32_t heapIndex = getHeapIndex(memoryTypeIndex);
+	return getUsage(heapIndex) + size <= getBudget(heapIndex);
+}
+
+uint32_t MemoryBudget::getHeapIndex(uint32_t memoryTypeIndex) const
+{
+	return m_memoryProperties.memoryTypes[memoryTypeIndex].heapIndex;
+}
+
+uint32_t MemoryBudget::getHeapCount() const
+{
+	return m_memoryProperties.memoryHeapCount;
+}
+
+VkDeviceSize MemoryBudget::getUsage(uint32_t heapIndex) const
+{
+	if (!isBudgetReported())
+	{
+		return m_allocatedBytes[heapIndex];
+	}
+
+	// The driver's figure is only as fresh as the last refresh, so add what changed since.
+	const VkDeviceSize usage = m_reportedUsages[heapIndex] + m_allocatedBytes[heapIndex];
+	const VkDeviceSize reportedAllocations = m_allocatedBytesAtRefresh[heapIndex];
+	return usage > reportedAllocations ? usage - reportedAllocations : 0;
+}
+
+VkDeviceSize MemoryBudget::getBudget(uint32_t heapIndex) const
+{
+	return m_heapBudgets[heapIndex];
+}
+
+bool MemoryBudget::isBudgetReported() const
+{
+	return m_vkGetPhysicalDeviceMemoryProperties2 != nullptr;
+}
\ No newline at end of file
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vulkan.h>
+#include <array>
+#include <unordered_map>
+#include <cstdint>
+
+// Per-heap accounting of device memory. Uses VK_EXT_memory_budget when the query function
+// is available and falls back to counting this process's own allocations otherwise.
+class MemoryBudget
+{
+private:
+	struct Allocation
+	{
+		uint32_t heapIndex;
+		VkDeviceSize size;
+	};
+
+	VkPhysicalDeviceMemoryProperties m_memoryProperties;
+	VkPhysicalDevice m_vkPhysicalDevice;
+	PFN_vkGetPhysicalDeviceMemoryProperties2KHR m_vkGetPhysicalDeviceMemoryProperties2;
+	std::array<VkDeviceSize, VK_MAX_MEMORY_HEAPS> m_allocatedBytes;
+	std::array<VkDeviceSize, VK_MAX_MEMORY_HEAPS> m_allocatedBytesAtRefresh;
+	std::array<VkDeviceSize, VK_MAX_MEMORY_HEAPS> m_reportedUsages;
+	std::array<VkDeviceSize, VK_MAX_MEMORY_HEAPS> m_heapBudgets;
+	std::unordered_map<VkDeviceMemory, Allocation> m_allocations;
+
+public:
+	MemoryBudget();
+
+	// Pass the query function only when VK_EXT_memory_budget is enabled on the device.
+	void init(VkPhysicalDevice physicalDevice,
+		PFN_vkGetPhysicalDeviceMemoryProperties2KHR getPhysicalDeviceMemoryProperties2);
+	void refresh();
+
+	void track(VkDeviceMemory memory, uint32_t memoryTypeIndex, VkDeviceSize size);
+	void untrack(VkDeviceMemory memory);
+
+	bool fits(uint32_t memoryTypeIndex, VkDeviceSize size) const;
+	uint32_t getHeapIndex(uint32_t memoryTypeIndex) const;
+	uint32_t getHeapCount() const;
+	VkDeviceSize getUsage(uint32_t heapIndex) const;
+	VkDeviceSize getBudget(uint32_t heapIndex) const;
+	bool isBudgetReported() const;
+};
\ No newline at end of file
@@ -0,0 +1,609 @@
+#include "Mesh.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <unordered_map>
+#include "glm/common.hpp"
+#include "glm/geometric.hpp"
+
+struct Quadric
+{
+	double aa, ab, ac, ad, bb, bc, bd, cc, cd, dd;
+
+	void addPlane(const glm::vec3& normal, float distance, float weight)
+	{
+		const double a = normal.x;
+		const double b = normal.y;
+		const double c = normal.z;
+		const double d = distance;
+
+		aa += weight * a * a;
+		ab += weight * a * b;
+		ac += weight * a * c;
+		ad += weight * a * d;
+		bb += weight * b * b;
+		bc += weight * b * c;
+		bd += weight * b * d;
+		cc += weight * c * c;
+		cd += weight * c * d;
+		dd += weight * d * d;
+	}
+
+	void add(const Quadric& other)
+	{
+		aa += other.aa;
+		ab += other.ab;
+		ac += other.ac;
+		ad += other.ad;
+		bb += other.bb;
+		bc += other.bc;
+		bd += other.bd;
+		cc += other.cc;
+		cd += other.cd;
+		dd += other.dd;
+	}
+
+	double evaluate(const glm::vec3& point) const
+	{
+		const double x = point.x;
+		const double y = point.y;
+		const double z = point.z;
+
+		return aa * x * x + 2.0 * ab * x * y + 2.0 * ac * x * z + 2.0 * ad * x +
+			bb * y * y + 2.0 * bc * y * z + 2.0 * bd * y +
+			cc * z * z + 2.0 * cd * z + dd;
+	}
+};
+
+struct Collapse
+{
+	uint32_t from;
+	uint32_t to;
+	double cost;
+};
+
+static uint64_t makeEdgeKey(uint32_t a, uint32_t b)
+{
+	return (static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+}
+
+static glm::vec3 computeTriangleNormal(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2)
+{
+	return glm::cross(p1 - p0, p2 - p0);
+}
+
+static std::vector<Quadric> computeQuadrics(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
+{
+	// Heavily weighted planes through boundary edges keep open borders from shrinking.
+	const float boundaryWeight = 10.0f;
+
+	std::vector<Quadric> quadrics(vertices.size(), Quadric());
+	std::unordered_map<uint64_t, uint32_t> edgeUseCounts;
+
+	for (size_t i = 0; i < indices.size(); i += 3)
+	{
+		for (size_t edge = 0; edge < 3; ++edge)
+		{
+			++edgeUseCounts[makeEdgeKey(indices[i + edge], indices[i + (edge + 1) % 3])];
+		}
+	}
+
+	for (size_t i = 0; i < indices.size(); i += 3)
+	{
+		const std::array<uint32_t, 3> triangle = { indices[i], indices[i + 1], indices[i + 2] };
+		const glm::vec3 normal = computeTriangleNormal(vertices[triangle[0]].position,
+			vertices[triangle[1]].position, vertices[triangle[2]].position);
+		const float doubleArea = glm::length(normal);
+
+		if (doubleArea == 0.0f)
+		{
+			continue;
+		}
+
+		const glm::vec3 unitNormal = normal / doubleArea;
+		const float distance = -glm::dot(unitNormal, vertices[triangle[0]].position);
+
+		for (uint32_t vertexIndex : triangle)
+		{
+			quadrics[vertexIndex].addPlane(unitNormal, distance, doubleArea * 0.5f);
+		}
+
+		for (size_t edge = 0; edge < 3; ++edge)
+		{
+			const uint32_t a = triangle[edge];
+			const uint32_t b = triangle[(edge + 1) % 3];
+
+			if (edgeUseCounts[makeEdgeKey(a, b)] != 1)
+			{
+				continue;
+			}
+
+			const glm::vec3 edgeVector = vertices[b].position - vertices[a].position;
+			const glm::vec3 boundaryNormal = glm::normalize(glm::cross(edgeVector, unitNormal));
+			const float boundaryDistance = -glm::dot(boundaryNormal, vertices[a].position);
+			const float weight = boundaryWeight * glm::dot(edgeVector, edgeVector);
+
+			quadrics[a].addPlane(boundaryNormal, boundaryDistance, weight);
+			quadrics[b].addPlane(boundaryNormal, boundaryDistance, weight);
+		}
+	}
+
+	return quadrics;
+}
+
+static bool isCollapseValid(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& triangles,
+	const std::vector<uint32_t>& adjacentTriangles, uint32_t from, uint32_t to)
+{
+	for (uint32_t triangle : adjacentTriangles)
+	{
+		const uint32_t* corners = &triangles[triangle * 3];
+
+		if (corners[0] == corners[1] || corners[1] == corners[2] || corners[0] == corners[2])
+		{
+			continue;
+		}
+
+		if (corners[0] == to || corners[1] == to || corners[2] == to)
+		{
+			continue;
+		}
+
+		std::array<glm::vec3, 3> positions;
+		for (size_t corner = 0; corner < 3; ++corner)
+		{
+			positions[corner] = vertices[corners[corner]].position;
+		}
+
+		const glm::vec3 oldNormal = computeTriangleNormal(positions[0], positions[1], positions[2]);
+
+		for (size_t corner = 0; corner < 3; ++corner)
+		{
+			if (corners[corner] == from)
+			{
+				positions[corner] = vertices[to].position;
+			}
+		}
+
+		const glm::vec3 newNormal = computeTriangleNormal(positions[0], positions[1], positions[2]);
+
+		if (glm::dot(oldNormal, newNormal) <= 0.0f)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+VertexFormat getVertexFormat()
+{
+	VertexFormat format = {};
+	format.stride = sizeof(Vertex) / sizeof(uint32_t);
+	format.positionOffset = offsetof(Vertex, position) / sizeof(uint32_t);
+	format.colorOffset = offsetof(Vertex, color) / sizeof(uint32_t);
+	return format;
+}
+
+void buildGridMesh(uint32_t gridSize, std::vector<Vertex>* outVertices, std::vector<uint32_t>* outIndices)
+{
+	const glm::vec3 cornerColors[] = {
+		{ 1.0f, 0.0f, 0.0f },
+		{ 0.0f, 1.0f, 0.0f },
+		{ 0.0f, 0.0f, 1.0f },
+		{ 1.0f, 0.0f, 1.0f }
+	};
+
+	outVertices->resize((gridSize + 1) * (gridSize + 1));
+
+	for (uint32_t y = 0; y <= gridSize; ++y)
+	{
+		for (uint32_t x = 0; x <= gridSize; ++x)
+		{
+			const float u = static_cast<float>(x) / gridSize;
+			const float v = static_cast<float>(y) / gridSize;
+
+			Vertex& vertex = (*outVertices)[y * (gridSize + 1) + x];
+			vertex.position = { u - 0.5f, v - 0.5f, 0.0f };
+			vertex.color = glm::mix(glm::mix(cornerColors[0], cornerColors[1], u),
+				glm::mix(cornerColors[3], cornerColors[2], u), v);
+		}
+	}
+
+	outIndices->clear();
+
+	for (uint32_t y = 0; y < gridSize; ++y)
+	{
+		for (uint32_t x = 0; x < gridSize; ++x)
+		{
+			const uint32_t topLeft = y * (gridSize + 1) + x;
+			const uint32_t topRight = topLeft + 1;
+			const uint32_t bottomLeft = topLeft + gridSize + 1;
+			const uint32_t bottomRight = bottomLeft + 1;
+
+			outIndices->insert(outIndices->end(), { topLeft, topRight, bottomRight, topLeft, bottomRight, bottomLeft });
+		}
+	}
+}
+
+std::vector<uint32_t> simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+	size_t targetIndexCount, float* outError)
+{
+	std::vector<uint32_t> triangles = indices;
+	std::vector<Quadric> quadrics = computeQuadrics(vertices, indices);
+	const size_t triangleCount = triangles.size() / 3;
+
+	float radius = 0.0f;
+	for (const Vertex& vertex : vertices)
+	{
+		radius = std::max(radius, glm::length(vertex.position));
+	}
+
+	// A full change of one color channel costs as much as moving the vertex by the radius.
+	const double colorWeight = static_cast<double>(radius) * radius;
+
+	size_t aliveIndexCount = triangles.size();
+	double maxCost = 0.0;
+
+	std::vector<std::vector<uint32_t>> adjacency(vertices.size());
+	std::vector<Collapse> collapses;
+	std::vector<char> locked(vertices.size());
+
+	while (aliveIndexCount > targetIndexCount)
+	{
+		for (std::vector<uint32_t>& adjacentTriangles : adjacency)
+		{
+			adjacentTriangles.clear();
+		}
+
+		collapses.clear();
+
+		for (size_t triangle = 0; triangle < triangleCount; ++triangle)
+		{
+			const uint32_t* corners = &triangles[triangle * 3];
+
+			if (corners[0] == corners[1] || corners[1] == corners[2] || corners[0] == corners[2])
+			{
+				continue;
+			}
+
+			for (size_t corner = 0; corner < 3; ++corner)
+			{
+				const uint32_t a = corners[corner];
+				const uint32_t b = corners[(corner + 1) % 3];
+				const glm::vec3 colorDelta = vertices[a].color - vertices[b].color;
+				const double colorCost = colorWeight * glm::dot(colorDelta, colorDelta);
+
+				adjacency[a].push_back(static_cast<uint32_t>(triangle));
+				collapses.push_back({ a, b, quadrics[a].evaluate(vertices[b].position) + colorCost });
+				collapses.push_back({ b, a, quadrics[b].evaluate(vertices[a].position) + colorCost });
+			}
+		}
+
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& left, const Collapse& right)
+		{
+			return left.cost < right.cost;
+		});
+
+		std::fill(locked.begin(), locked.end(), 0);
+		size_t appliedCount = 0;
+
+		for (const Collapse& collapse : collapses)
+		{
+			if (aliveIndexCount <= targetIndexCount)
+			{
+				break;
+			}
+
+			if (locked[collapse.from] || locked[collapse.to] ||
+				!isCollapseValid(vertices, triangles, adjacency[collapse.from], collapse.from, collapse.to))
+			{
+				continue;
+			}
+
+			for (uint32_t triangle : adjacency[collapse.from])
+			{
+				uint32_t* corners = &triangles[triangle * 3];
+				const bool wasDegenerate = corners[0] == corners[1] || corners[1] == corners[2] ||
+					corners[0] == corners[2];
+
+				std::replace(corners, corners + 3, collapse.from, collapse.to);
+
+				if (!wasDegenerate &&
+					(corners[0] == corners[1] || corners[1] == corners[2] || corners[0] == corners[2]))
+				{
+					aliveIndexCount -= 3;
+				}
+			}
+
+			quadrics[collapse.to].add(quadrics[collapse.from]);
+			maxCost = std::max(maxCost, collapse.cost);
+			locked[collapse.from] = 1;
+			locked[collapse.to] = 1;
+			++appliedCount;
+		}
+
+		if (appliedCount == 0)
+		{
+			break;
+		}
+	}
+
+	std::vector<uint32_t> result;
+	result.reserve(aliveIndexCount);
+
+	for (size_t triangle = 0; triangle < triangleCount; ++triangle)
+	{
+		const uint32_t* corners = &triangles[triangle * 3];
+
+		if (corners[0] != corners[1] && corners[1] != corners[2] && corners[0] != corners[2])
+		{
+			result.insert(result.end(), corners, corners + 3);
+		}
+	}
+
+	*outError = static_cast<float>(std::sqrt(std::max(maxCost, 0.0)));
+	return result;
+}
+
+Mesh buildMeshLods(const std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, uint32_t lodCount)
+{
+	Mesh mesh = {};
+	mesh.vertexOffset = 0;
+	mesh.boundingRadius = 0.0f;
+	mesh.vertexFormat = getVertexFormat();
+
+	for (const Vertex& vertex : vertices)
+	{
+		mesh.boundingRadius = std::max(mesh.boundingRadius, glm::length(vertex.position));
+	}
+
+	const std::vector<uint32_t> fullDetailIndices = indices;
+	mesh.lods.push_back({ 0, static_cast<uint32_t>(indices.size()), 0.0f, 0, 0 });
+
+	for (uint32_t level = 1; level < std::min(lodCount, MAX_LOD_COUNT); ++level)
+	{
+		const size_t targetIndexCount = std::max<size_t>(fullDetailIndices.size() >> (2 * level), 6);
+
+		float error;
+		const std::vector<uint32_t> lodIndices = simplifyMesh(vertices, fullDetailIndices, targetIndexCount, &error);
+
+		if (lodIndices.empty() || lodIndices.size() >= mesh.lods.back().indexCount)
+		{
+			break;
+		}
+
+		MeshLod lod = {};
+		lod.firstIndex = static_cast<uint32_t>(indices.size());
+		lod.indexCount = static_cast<uint32_t>(lodIndices.size());
+		lod.error = std::max(mesh.lods.back().error, error / mesh.boundingRadius);
+
+		indices.insert(indices.end(), lodIndices.begin(), lodIndices.end());
+		mesh.lods.push_back(lod);
+	}
+
+	return mesh;
+}
+
+static Meshlet computeMeshletBounds(const std::vector<Vertex>& vertices, const uint32_t* indices, uint32_t indexCount)
+{
+	glm::vec3 minimum = vertices[indices[0]].position;
+	glm::vec3 maximum = minimum;
+
+	for (uint32_t i = 1; i < indexCount; ++i)
+	{
+		minimum = glm::min(minimum, vertices[indices[i]].position);
+		maximum = glm::max(maximum, vertices[indices[i]].position);
+	}
+
+	const glm::vec3 center = (minimum + maximum) * 0.5f;
+	float radius = 0.0f;
+	glm::vec3 normalSum(0.0f);
+	std::vector<glm::vec3> normals;
+
+	for (uint32_t i = 0; i < indexCount; i += 3)
+	{
+		const glm::vec3& p0 = vertices[indices[i]].position;
+		const glm::vec3& p1 = vertices[indices[i + 1]].position;
+		const glm::vec3& p2 = vertices[indices[i + 2]].position;
+
+		radius = std::max(radius, std::max(glm::length(p0 - center), std::max(glm::length(p1 - center),
+			glm::length(p2 - center))));
+
+		const glm::vec3 normal = computeTriangleNormal(p0, p1, p2);
+		const float area = glm::length(normal);
+
+		if (area > 0.0f)
+		{
+			normals.push_back(normal / area);
+			normalSum = normalSum + normal / area;
+		}
+	}
+
+	Meshlet meshlet = {};
+	meshlet.boundingSphere = glm::vec4(center.x, center.y, center.z, radius);
+	meshlet.normalCone = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+	const float axisLength = glm::length(normalSum);
+
+	if (axisLength == 0.0f)
+	{
+		return meshlet;
+	}
+
+	const glm::vec3 axis = normalSum / axisLength;
+	float minimumDot = 1.0f;
+
+	for (const glm::vec3& normal : normals)
+	{
+		minimumDot = std::min(minimumDot, glm::dot(axis, normal));
+	}
+
+	// Cones wider than about 84 degrees would hardly ever pass the test, so they are not tested at all.
+	const float cutoff = minimumDot <= 0.1f ? 1.0f : std::sqrt(1.0f - minimumDot * minimumDot);
+	meshlet.normalCone = glm::vec4(axis.x, axis.y, axis.z, cutoff);
+	return meshlet;
+}
+
+void buildMeshlets(const std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, Mesh* mesh,
+	uint32_t maxVertices, uint32_t maxTriangles)
+{
+	const uint32_t NO_TRIANGLE = 0xFFFFFFFF;
+
+	mesh->meshlets.clear();
+
+	// Which cluster last took each vertex, so membership tests need no clearing between clusters.
+	std::vector<uint32_t> vertexClusters(vertices.size(), 0xFFFFFFFF);
+	uint32_t cluster = 0;
+
+	for (MeshLod& lod : mesh->lods)
+	{
+		lod.firstMeshlet = static_cast<uint32_t>(mesh->meshlets.size());
+
+		const std::vector<uint32_t> source(indices.begin() + lod.firstIndex,
+			indices.begin() + lod.firstIndex + lod.indexCount);
+		const uint32_t triangleCount = lod.indexCount / 3;
+
+		// Triangles around every vertex, the clusters grow across them.
+		std::vector<uint32_t> adjacencyOffsets(vertices.size() + 1, 0);
+		std::vector<uint32_t> adjacency(source.size());
+
+		for (uint32_t index : source)
+		{
+			++adjacencyOffsets[index + 1];
+		}
+
+		for (size_t i = 1; i < adjacencyOffsets.size(); ++i)
+		{
+			adjacencyOffsets[i] += adjacencyOffsets[i - 1];
+		}
+
+		std::vector<uint32_t> adjacencyFill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+
+		for (uint32_t i = 0; i < source.size(); ++i)
+		{
+			adjacency[adjacencyFill[source[i]]++] = i / 3;
+		}
+
+		auto countNewVertices = [&](uint32_t triangle)
+		{
+			const uint32_t a = source[triangle * 3];
+			const uint32_t b = source[triangle * 3 + 1];
+			const uint32_t c = source[triangle * 3 + 2];
+
+			return static_cast<uint32_t>(vertexClusters[a] != cluster) +
+				static_cast<uint32_t>(vertexClusters[b] != cluster && b != a) +
+				static_cast<uint32_t>(vertexClusters[c] != cluster && c != a && c != b);
+		};
+
+		std::vector<bool> emitted(triangleCount, false);
+		std::vector<uint32_t> clusterVertices;
+		std::vector<uint32_t> clusterTriangles;
+		uint32_t nextUnemitted = 0;
+		uint32_t writeIndex = lod.firstIndex;
+
+		auto finishCluster = [&]()
+		{
+			const uint32_t firstIndex = writeIndex;
+
+			for (uint32_t triangle : clusterTriangles)
+			{
+				for (uint32_t corner = 0; corner < 3; ++corner)
+				{
+					indices[writeIndex++] = source[triangle * 3 + corner];
+				}
+			}
+
+			Meshlet meshlet = computeMeshletBounds(vertices, &indices[firstIndex], writeIndex - firstIndex);
+			meshlet.firstIndex = firstIndex;
+			meshlet.indexCount = writeIndex - firstIndex;
+			mesh->meshlets.push_back(meshlet);
+
+			clusterVertices.clear();
+			clusterTriangles.clear();
+			++cluster;
+		};
+
+		for (uint32_t step = 0; step < triangleCount; ++step)
+		{
+			// The neighbour bringing the fewest new vertices keeps the cluster compact.
+			uint32_t best = NO_TRIANGLE;
+			uint32_t bestNewVertices = 4;
+
+			for (uint32_t vertex : clusterVertices)
+			{
+				for (uint32_t i = adjacencyOffsets[vertex]; i < adjacencyOffsets[vertex + 1]; ++i)
+				{
+					const uint32_t triangle = adjacency[i];
+
+					if (!emitted[triangle] && countNewVertices(triangle) < bestNewVertices)
+					{
+						best = triangle;
+						bestNewVertices = countNewVertices(triangle);
+					}
+				}
+			}
+
+			if (best == NO_TRIANGLE)
+			{
+				while (emitted[nextUnemitted])
+				{
+					++nextUnemitted;
+				}
+
+				best = nextUnemitted;
+				bestNewVertices = countNewVertices(best);
+			}
+
+			if (clusterVertices.size() + bestNewVertices > maxVertices || clusterTriangles.size() + 1 > maxTriangles)
+			{
+				finishCluster();
+			}
+
+			for (uint32_t corner = 0; corner < 3; ++corner)
+			{
+				const uint32_t vertex = source[best * 3 + corner];
+
+				if (vertexClusters[vertex] != cluster)
+				{
+					vertexClusters[vertex] = cluster;
+					clusterVertices.push_back(vertex);
+				}
+			}
+
+			emitted[best] = true;
+			clusterTriangles.push_back(best);
+		}
+
+		if (!clusterTriangles.empty())
+		{
+			finishCluster();
+		}
+
+		lod.meshletCount = static_cast<uint32_t>(mesh->meshlets.size()) - lod.firstMeshlet;
+	}
+}
+
+void refreshMeshletBounds(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, Mesh* mesh)
+{
+	for (Meshlet& meshlet : mesh->meshlets)
+	{
+		const Meshlet bounds = computeMeshletBounds(vertices, &indices[meshlet.firstIndex], meshlet.indexCount);
+		meshlet.boundingSphere = bounds.boundingSphere;
+		meshlet.normalCone = bounds.normalCone;
+	}
+}
+
+uint32_t selectLod(const Mesh& mesh, float projectedRadiusPixels, float errorThresholdPixels)
+{
+	uint32_t lod = 0;
+
+	for (uint32_t level = 1; level < mesh.lods.size(); ++level)
+	{
+		if (mesh.lods[level].error * projectedRadiusPixels <= errorThresholdPixels)
+		{
+			lod = level;
+		}
+	}
+
+	return lod;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "glm/vec3.hpp"
+#include "glm/vec4.hpp"
+
+constexpr uint32_t MAX_LOD_COUNT = 4;
+constexpr uint32_t VERTEX_ATTRIBUTE_ABSENT = 0xFFFFFFFF;
+constexpr uint32_t MESHLET_MAX_VERTICES = 64;
+constexpr uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+struct Vertex
+{
+	glm::vec3 position;
+	glm::vec3 color;
+};
+
+// Describes a vertex layout in 32-bit words so shaders can decode it from a raw buffer.
+struct VertexFormat
+{
+	uint32_t stride;
+	uint32_t positionOffset;
+	uint32_t colorOffset;
+};
+
+struct MeshLod
+{
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	// Largest deviation introduced by the simplification, relative to the bounding radius.
+	float error;
+	uint32_t firstMeshlet;
+	uint32_t meshletCount;
+};
+
+// A cluster of triangles stored contiguously in the index buffer, laid out as the cull shader reads it.
+struct Meshlet
+{
+	// Center and radius.
+	glm::vec4 boundingSphere;
+	// Average normal and the sine of the angle that contains every triangle normal around it.
+	// A cutoff of 1 means the normals spread too far for the cluster to ever face away as a whole.
+	glm::vec4 normalCone;
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	uint32_t padding[2];
+};
+
+struct Mesh
+{
+	int32_t vertexOffset;
+	float boundingRadius;
+	VertexFormat vertexFormat;
+	std::vector<MeshLod> lods;
+	std::vector<Meshlet> meshlets;
+};
+
+VertexFormat getVertexFormat();
+
+// A flat square of gridSize by gridSize quads with colors blended between its corners.
+void buildGridMesh(uint32_t gridSize, std::vector<Vertex>* outVertices, std::vector<uint32_t>* outIndices);
+
+// Collapses edges onto existing vertices until at most targetIndexCount indices remain,
+// so every level keeps indexing the original vertex array.
+std::vector<uint32_t> simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+	size_t targetIndexCount, float* outError);
+
+// Treats indices as the full detail level, appends the simplified levels after it and
+// describes all of them in the returned mesh.
+Mesh buildMeshLods(const std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, uint32_t lodCount);
+
+// Reorders the triangles of every level into clusters of at most maxVertices vertices and maxTriangles
+// triangles, grown across shared vertices so they stay compact, and describes them in mesh.
+void buildMeshlets(const std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, Mesh* mesh,
+	uint32_t maxVertices, uint32_t maxTriangles);
+
+// Recomputes the bounds of every meshlet after vertices or indices were edited in place.
+void refreshMeshletBounds(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, Mesh* mesh);
+
+uint32_t selectLod(const Mesh& mesh, float projectedRadiusPixels, float errorThresholdPixels);
@@ -0,0 +1,413 @@
+#include "MeshCodec.h"
+#include "FrustumCulling.h"
+#include <immintrin.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TARGET_SSSE3
+#define TARGET_AVX2
+#else
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+static const size_t HEADER_SIZE = 2 * sizeof(uint32_t);
+static const uint32_t GROUP_SIZE = 4;
+// Decoders load 16 bytes after every control byte and the AVX2 decoder may read one group past the end.
+static const size_t STREAM_PADDING = 32;
+static const uint8_t CODE_LENGTHS[4] = { 0, 1, 2, 4 };
+
+struct GroupTables
+{
+	uint8_t lengths[256];
+	alignas(16) uint8_t shuffles[256][16];
+
+	GroupTables()
+	{
+		for (uint32_t control = 0; control < 256; ++control)
+		{
+			uint8_t offset = 0;
+
+			for (uint32_t value = 0; value < GROUP_SIZE; ++value)
+			{
+				const uint8_t length = CODE_LENGTHS[(control >> (value * 2)) & 0x3];
+
+				for (uint8_t byte = 0; byte < 4; ++byte)
+				{
+					shuffles[control][value * 4 + byte] = byte < length ? static_cast<uint8_t>(offset + byte) : 0x80;
+				}
+
+				offset += length;
+			}
+
+			lengths[control] = offset;
+		}
+	}
+};
+
+static const GroupTables GROUP_TABLES;
+
+static bool isSsse3Supported()
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 9)) != 0;
+#else
+	return __builtin_cpu_supports("ssse3");
+#endif
+}
+
+CodecInstructionSet chooseCodecInstructionSet()
+{
+	if (isAvx2Supported())
+	{
+		return CodecInstructionSet::Avx2;
+	}
+
+	return isSsse3Supported() ? CodecInstructionSet::Sse : CodecInstructionSet::Scalar;
+}
+
+static uint32_t zigzag(uint32_t delta)
+{
+	return (delta << 1) ^ static_cast<uint32_t>(static_cast<int32_t>(delta) >> 31);
+}
+
+static uint32_t unzigzag(uint32_t value)
+{
+	return (value >> 1) ^ (0u - (value & 1));
+}
+
+static uint32_t getLengthCode(uint32_t value)
+{
+	if (value == 0)
+	{
+		return 0;
+	}
+
+	if (value < 0x100)
+	{
+		return 1;
+	}
+
+	return value < 0x10000 ? 2 : 3;
+}
+
+std::vector<uint8_t> encodeWords(const uint32_t* words, size_t recordCount, uint32_t stride)
+{
+	if (stride == 0 || stride > MAX_CODEC_STRIDE || recordCount > UINT32_MAX)
+	{
+		throw std::runtime_error("Failed to encode words, unsupported stream layout.");
+	}
+
+	const uint32_t header[2] = { static_cast<uint32_t>(recordCount), stride };
+	std::vector<uint8_t> encoded(HEADER_SIZE);
+	memcpy(encoded.data(), header, HEADER_SIZE);
+
+	// Groups of four records store each column in turn, so decoding finishes whole records at a time.
+	for (size_t first = 0; first < recordCount; first += GROUP_SIZE)
+	{
+		for (uint32_t column = 0; column < stride; ++column)
+		{
+			uint32_t values[GROUP_SIZE] = {};
+			uint8_t control = 0;
+
+			for (uint32_t i = 0; i < GROUP_SIZE && first + i < recordCount; ++i)
+			{
+				const size_t record = first + i;
+				const uint32_t previous = record > 0 ? words[(record - 1) * stride + column] : 0;
+
+				values[i] = zigzag(words[record * stride + column] - previous);
+				control |= static_cast<uint8_t>(getLengthCode(values[i]) << (i * 2));
+			}
+
+			encoded.push_back(control);
+
+			for (uint32_t i = 0; i < GROUP_SIZE; ++i)
+			{
+				const uint8_t length = CODE_LENGTHS[(control >> (i * 2)) & 0x3];
+
+				for (uint8_t byte = 0; byte < length; ++byte)
+				{
+					encoded.push_back(static_cast<uint8_t>(values[i] >> (byte * 8)));
+				}
+			}
+		}
+	}
+
+	encoded.resize(encoded.size() + STREAM_PADDING, 0);
+	return encoded;
+}
+
+static void readHeader(const std::vector<uint8_t>& encoded, uint32_t* outRecordCount, uint32_t* outStride)
+{
+	if (encoded.size() < HEADER_SIZE + STREAM_PADDING)
+	{
+		throw std::runtime_error("Failed to decode words, stream is truncated.");
+	}
+
+	uint32_t header[2];
+	memcpy(header, encoded.data(), HEADER_SIZE);
+
+	if (header[1] == 0 || header[1] > MAX_CODEC_STRIDE)
+	{
+		throw std::runtime_error("Failed to decode words, unsupported record stride.");
+	}
+
+	*outRecordCount = header[0];
+	*outStride = header[1];
+}
+
+size_t getDecodedSize(const std::vector<uint8_t>& encoded)
+{
+	uint32_t recordCount;
+	uint32_t stride;
+	readHeader(encoded, &recordCount, &stride);
+
+	return static_cast<size_t>(recordCount) * stride * sizeof(uint32_t);
+}
+
+// Records are assembled in a small block first, so the output only ever sees sequential writes,
+// which is what write-combined mapped memory needs to stay fast.
+static void writeBlock(const uint32_t* block, uint32_t first, uint32_t recordCount, uint32_t stride,
+	uint32_t* outWords)
+{
+	const uint32_t records = std::min(GROUP_SIZE, recordCount - first);
+	memcpy(outWords + static_cast<size_t>(first) * stride, block, records * stride * sizeof(uint32_t));
+}
+
+static void scatterColumn(const uint32_t* values, uint32_t column, uint32_t stride, uint32_t* outBlock)
+{
+	for (uint32_t i = 0; i < GROUP_SIZE; ++i)
+	{
+		outBlock[i * stride + column] = values[i];
+	}
+}
+
+void decodeWordsScalar(const std::vector<uint8_t>& encoded, uint32_t* outWords)
+{
+	uint32_t recordCount;
+	uint32_t stride;
+	readHeader(encoded, &recordCount, &stride);
+
+	const uint8_t* input = encoded.data() + HEADER_SIZE;
+	uint32_t previous[MAX_CODEC_STRIDE] = {};
+	uint32_t block[GROUP_SIZE * MAX_CODEC_STRIDE];
+
+	for (uint32_t first = 0; first < recordCount; first += GROUP_SIZE)
+	{
+		for (uint32_t column = 0; column < stride; ++column)
+		{
+			const uint8_t control = *input++;
+
+			for (uint32_t i = 0; i < GROUP_SIZE; ++i)
+			{
+				const uint8_t length = CODE_LENGTHS[(control >> (i * 2)) & 0x3];
+				uint32_t value = 0;
+
+				for (uint8_t byte = 0; byte < length; ++byte)
+				{
+					value |= static_cast<uint32_t>(input[byte]) << (byte * 8);
+				}
+
+				input += length;
+				previous[column] += unzigzag(value);
+				block[i * stride + column] = previous[column];
+			}
+		}
+
+		writeBlock(block, first, recordCount, stride, outWords);
+	}
+}
+
+TARGET_SSSE3 static __m128i unzigzagSse(__m128i values)
+{
+	const __m128i sign = _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(values, _mm_set1_epi32(1)));
+	return _mm_xor_si128(_mm_srli_epi32(values, 1), sign);
+}
+
+// Expands the variable length values following a control byte into four lanes.
+TARGET_SSSE3 static __m128i decodeGroupSse(const uint8_t** input)
+{
+	const uint8_t* group = *input;
+	const uint8_t control = group[0];
+	*input = group + 1 + GROUP_TABLES.lengths[control];
+
+	const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group + 1));
+	const __m128i shuffle = _mm_load_si128(reinterpret_cast<const __m128i*>(GROUP_TABLES.shuffles[control]));
+	return unzigzagSse(_mm_shuffle_epi8(data, shuffle));
+}
+
+TARGET_SSSE3 static __m128i prefixSumSse(__m128i deltas)
+{
+	deltas = _mm_add_epi32(deltas, _mm_slli_si128(deltas, 4));
+	return _mm_add_epi32(deltas, _mm_slli_si128(deltas, 8));
+}
+
+TARGET_SSSE3 void decodeWordsSse(const std::vector<uint8_t>& encoded, uint32_t* outWords)
+{
+	uint32_t recordCount;
+	uint32_t stride;
+	readHeader(encoded, &recordCount, &stride);
+
+	const uint8_t* input = encoded.data() + HEADER_SIZE;
+	// Each column keeps its last decoded value broadcast to all lanes.
+	__m128i previous[MAX_CODEC_STRIDE];
+	alignas(16) uint32_t values[GROUP_SIZE];
+	alignas(16) uint32_t block[GROUP_SIZE * MAX_CODEC_STRIDE];
+
+	for (uint32_t column = 0; column < stride; ++column)
+	{
+		previous[column] = _mm_setzero_si128();
+	}
+
+	// A single column needs no interleaving, whole groups go straight to the output.
+	const uint32_t directCount = stride == 1 ? recordCount & ~(GROUP_SIZE - 1) : 0;
+
+	for (uint32_t first = 0; first < directCount; first += GROUP_SIZE)
+	{
+		const __m128i decoded = _mm_add_epi32(prefixSumSse(decodeGroupSse(&input)), previous[0]);
+		previous[0] = _mm_shuffle_epi32(decoded, _MM_SHUFFLE(3, 3, 3, 3));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(outWords + first), decoded);
+	}
+
+	for (uint32_t first = directCount; first < recordCount; first += GROUP_SIZE)
+	{
+		for (uint32_t column = 0; column < stride; ++column)
+		{
+			const __m128i decoded = _mm_add_epi32(prefixSumSse(decodeGroupSse(&input)), previous[column]);
+			previous[column] = _mm_shuffle_epi32(decoded, _MM_SHUFFLE(3, 3, 3, 3));
+
+			_mm_store_si128(reinterpret_cast<__m128i*>(values), decoded);
+			scatterColumn(values, column, stride, block);
+		}
+
+		writeBlock(block, first, recordCount, stride, outWords);
+	}
+}
+
+// Expands two consecutive groups, one per 128-bit lane.
+TARGET_AVX2 static __m256i decodeGroupPairAvx2(const uint8_t** input)
+{
+	const uint8_t* firstGroup = *input;
+	const uint8_t firstControl = firstGroup[0];
+	const uint8_t* secondGroup = firstGroup + 1 + GROUP_TABLES.lengths[firstControl];
+	const uint8_t secondControl = secondGroup[0];
+	*input = secondGroup + 1 + GROUP_TABLES.lengths[secondControl];
+
+	const __m256i data = _mm256_inserti128_si256(
+		_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(firstGroup + 1))),
+		_mm_loadu_si128(reinterpret_cast<const __m128i*>(secondGroup + 1)), 1);
+	const __m256i shuffle = _mm256_inserti128_si256(
+		_mm256_castsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(GROUP_TABLES.shuffles[firstControl]))),
+		_mm_load_si128(reinterpret_cast<const __m128i*>(GROUP_TABLES.shuffles[secondControl])), 1);
+
+	const __m256i values = _mm256_shuffle_epi8(data, shuffle);
+	const __m256i sign = _mm256_sub_epi32(_mm256_setzero_si256(), _mm256_and_si256(values, _mm256_set1_epi32(1)));
+	return _mm256_xor_si256(_mm256_srli_epi32(values, 1), sign);
+}
+
+// Prefix sums within each 128-bit lane.
+TARGET_AVX2 static __m256i prefixSumLanesAvx2(__m256i deltas)
+{
+	deltas = _mm256_add_epi32(deltas, _mm256_slli_si256(deltas, 4));
+	return _mm256_add_epi32(deltas, _mm256_slli_si256(deltas, 8));
+}
+
+// Index-like streams with a single column decode eight consecutive records per step.
+TARGET_AVX2 static void decodeSingleColumnAvx2(const uint8_t* input, uint32_t recordCount, uint32_t* outWords)
+{
+	const __m256i lastOfLowerLane = _mm256_set1_epi32(3);
+	const __m256i lastOfUpperLane = _mm256_set1_epi32(7);
+	__m256i previous = _mm256_setzero_si256();
+	alignas(32) uint32_t values[2 * GROUP_SIZE];
+
+	for (uint32_t first = 0; first < recordCount; first += 2 * GROUP_SIZE)
+	{
+		__m256i decoded = prefixSumLanesAvx2(decodeGroupPairAvx2(&input));
+		const __m256i carry = _mm256_permutevar8x32_epi32(decoded, lastOfLowerLane);
+		decoded = _mm256_add_epi32(decoded, _mm256_blend_epi32(previous, _mm256_add_epi32(previous, carry), 0xF0));
+		previous = _mm256_permutevar8x32_epi32(decoded, lastOfUpperLane);
+
+		if (recordCount - first >= 2 * GROUP_SIZE)
+		{
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(outWords + first), decoded);
+		}
+		else
+		{
+			_mm256_store_si256(reinterpret_cast<__m256i*>(values), decoded);
+			memcpy(outWords + first, values, (recordCount - first) * sizeof(uint32_t));
+		}
+	}
+}
+
+TARGET_AVX2 void decodeWordsAvx2(const std::vector<uint8_t>& encoded, uint32_t* outWords)
+{
+	uint32_t recordCount;
+	uint32_t stride;
+	readHeader(encoded, &recordCount, &stride);
+
+	const uint8_t* input = encoded.data() + HEADER_SIZE;
+
+	if (stride == 1)
+	{
+		decodeSingleColumnAvx2(input, recordCount, outWords);
+		return;
+	}
+
+	// Columns are decoded in pairs, each pair keeps its last values broadcast to the matching lane.
+	const uint32_t pairedColumns = stride & ~1u;
+	__m256i previousPairs[MAX_CODEC_STRIDE / 2];
+	__m128i previousLast = _mm_setzero_si128();
+	alignas(32) uint32_t values[2 * GROUP_SIZE];
+	alignas(16) uint32_t block[GROUP_SIZE * MAX_CODEC_STRIDE];
+
+	for (uint32_t pair = 0; pair < pairedColumns / 2; ++pair)
+	{
+		previousPairs[pair] = _mm256_setzero_si256();
+	}
+
+	for (uint32_t first = 0; first < recordCount; first += GROUP_SIZE)
+	{
+		for (uint32_t column = 0; column < pairedColumns; column += 2)
+		{
+			__m256i& previous = previousPairs[column / 2];
+			const __m256i decoded = _mm256_add_epi32(prefixSumLanesAvx2(decodeGroupPairAvx2(&input)), previous);
+			previous = _mm256_shuffle_epi32(decoded, _MM_SHUFFLE(3, 3, 3, 3));
+
+			_mm256_store_si256(reinterpret_cast<__m256i*>(values), decoded);
+			scatterColumn(values, column, stride, block);
+			scatterColumn(values + GROUP_SIZE, column + 1, stride, block);
+		}
+
+		if (pairedColumns != stride)
+		{
+			const __m128i decoded = _mm_add_epi32(prefixSumSse(decodeGroupSse(&input)), previousLast);
+			previousLast = _mm_shuffle_epi32(decoded, _MM_SHUFFLE(3, 3, 3, 3));
+
+			_mm_store_si128(reinterpret_cast<__m128i*>(values), decoded);
+			scatterColumn(values, pairedColumns, stride, block);
+		}
+
+		writeBlock(block, first, recordCount, stride, outWords);
+	}
+}
+
+void decodeWords(CodecInstructionSet instructionSet, const std::vector<uint8_t>& encoded, uint32_t* outWords)
+{
+	switch (instructionSet)
+	{
+	case CodecInstructionSet::Avx2:
+		decodeWordsAvx2(encoded, outWords);
+		break;
+	case CodecInstructionSet::Sse:
+		decodeWordsSse(encoded, outWords);
+		break;
+	default:
+		decodeWordsScalar(encoded, outWords);
+		break;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+constexpr uint32_t MAX_CODEC_STRIDE = 16;
+
+enum class CodecInstructionSet
+{
+	Scalar,
+	Sse,
+	Avx2
+};
+
+CodecInstructionSet chooseCodecInstructionSet();
+
+// Losslessly encodes recordCount records of stride 32-bit words. Every word is delta coded against the
+// same word of the previous record and zigzagged, so slowly changing attributes turn into small numbers,
+// which are stored four at a time behind a control byte holding their byte lengths.
+std::vector<uint8_t> encodeWords(const uint32_t* words, size_t recordCount, uint32_t stride);
+
+size_t getDecodedSize(const std::vector<uint8_t>& encoded);
+
+// Writes getDecodedSize bytes to outWords. Output is written front to back in whole records,
+// so it can point straight into mapped staging memory.
+void decodeWordsScalar(const std::vector<uint8_t>& encoded, uint32_t* outWords);
+void decodeWordsSse(const std::vector<uint8_t>& encoded, uint32_t* outWords);
+void decodeWordsAvx2(const std::vector<uint8_t>& encoded, uint32_t* outWords);
+void decodeWords(CodecInstructionSet instructionSet, const std::vector<uint8_t>& encoded, uint32_t* outWords);
\ No newline at end of file
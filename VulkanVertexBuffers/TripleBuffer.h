@@ -0,0 +1,60 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Hands the newest value from one writer thread to one reader thread without locks. Each side owns
+// a slot and swaps it with the shared middle slot in a single atomic exchange, so neither waits
+// for the other and the reader never sees a value that is still being written.
+template <typename T>
+class TripleBuffer
+{
+private:
+	static const uint8_t INDEX_MASK = 0x3;
+	static const uint8_t FRESH_BIT = 0x4;
+
+	std::array<T, 3> m_slots;
+	std::atomic<uint8_t> m_middle;
+	uint8_t m_writeIndex;
+	uint8_t m_readIndex;
+
+public:
+	TripleBuffer()
+		: m_middle(1),
+		m_writeIndex(0),
+		m_readIndex(2)
+	{
+	}
+
+	// Writer only. The slot may hold any older value and must be filled completely before publishing.
+	T& getWriteSlot()
+	{
+		return m_slots[m_writeIndex];
+	}
+
+	void publish()
+	{
+		const uint8_t previous = m_middle.exchange(m_writeIndex | FRESH_BIT, std::memory_order_acq_rel);
+		m_writeIndex = previous & INDEX_MASK;
+	}
+
+	// Reader only. Returns false if nothing was published since the last acquire, the read slot then
+	// keeps its value.
+	bool acquire()
+	{
+		if ((m_middle.load(std::memory_order_relaxed) & FRESH_BIT) == 0)
+		{
+			return false;
+		}
+
+		const uint8_t previous = m_middle.exchange(m_readIndex, std::memory_order_acq_rel);
+		m_readIndex = previous & INDEX_MASK;
+		return true;
+	}
+
+	const T& getReadSlot() const
+	{
+		return m_slots[m_readIndex];
+	}
+};
\ No newline at end of file
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <deque>
+#include <map>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+
+// Positions of a staging reservation. Begin and end grow forever and are only used to release the
+// range, offset is where its data starts in the staging buffer.
+struct StagingRange
+{
+	uint64_t begin;
+	uint64_t end;
+	uint64_t offset;
+};
+
+template <typename T>
+struct QueuedUpload
+{
+	StagingRange range;
+	uint64_t size;
+	T payload;
+};
+
+// Lets any number of producer threads stage uploads for the render thread without locks. Producers
+// reserve space in a persistently mapped staging buffer with a compare-and-swap on its head, write
+// their data straight into it and publish it in a bounded queue of cells. The render thread pops the
+// published uploads in order, copies them out and releases their staging once the GPU is done.
+template <typename T>
+class UploadQueue
+{
+private:
+	static const uint64_t RANGE_ALIGNMENT = 16;
+
+	struct Cell
+	{
+		std::atomic<uint64_t> sequence;
+		QueuedUpload<T> upload;
+	};
+
+	struct RetiredRange
+	{
+		uint64_t frame;
+		uint64_t begin;
+		uint64_t end;
+	};
+
+	char* m_mappedMemory;
+	uint64_t m_capacity;
+	std::unique_ptr<Cell[]> m_cells;
+	uint64_t m_cellMask;
+	// Producers claim cells and staging through these.
+	std::atomic<uint64_t> m_enqueuePosition;
+	std::atomic<uint64_t> m_stagingHead;
+	// Only the render thread writes these.
+	std::atomic<uint64_t> m_stagingTail;
+	uint64_t m_dequeuePosition;
+	std::deque<RetiredRange> m_retiredRanges;
+	// Ranges can complete out of order, the tail only moves past a contiguous run of them.
+	std::map<uint64_t, uint64_t> m_completedRanges;
+
+	bool claimCell(uint64_t* outPosition)
+	{
+		uint64_t position = m_enqueuePosition.load(std::memory_order_relaxed);
+
+		while (true)
+		{
+			const uint64_t sequence = m_cells[position & m_cellMask].sequence.load(std::memory_order_acquire);
+
+			// The render thread hasn't popped the upload that last used this cell yet.
+			if (sequence < position)
+			{
+				return false;
+			}
+
+			if (sequence == position &&
+				m_enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			{
+				*outPosition = position;
+				return true;
+			}
+
+			if (sequence > position)
+			{
+				position = m_enqueuePosition.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	bool reserveStaging(uint64_t size, StagingRange* outRange)
+	{
+		const uint64_t alignedSize = (size + RANGE_ALIGNMENT - 1) & ~(RANGE_ALIGNMENT - 1);
+		uint64_t head = m_stagingHead.load(std::memory_order_relaxed);
+
+		while (true)
+		{
+			// A range never wraps, the end of the buffer is skipped and released along with it.
+			const uint64_t offset = head % m_capacity;
+			const uint64_t padding = offset + alignedSize > m_capacity ? m_capacity - offset : 0;
+			const uint64_t end = head + padding + alignedSize;
+
+			if (end - m_stagingTail.load(std::memory_order_acquire) > m_capacity)
+			{
+				return false;
+			}
+
+			if (m_stagingHead.compare_exchange_weak(head, end, std::memory_order_relaxed))
+			{
+				*outRange = { head, end, (head + padding) % m_capacity };
+				return true;
+			}
+		}
+	}
+
+public:
+	UploadQueue()
+		: m_mappedMemory(nullptr),
+		m_capacity(0),
+		m_cellMask(0),
+		m_enqueuePosition(0),
+		m_stagingHead(0),
+		m_stagingTail(0),
+		m_dequeuePosition(0)
+	{
+	}
+
+	// Must be called before any producer starts. cellCount has to be a power of two.
+	void init(void* mappedMemory, uint64_t capacity, size_t cellCount)
+	{
+		m_mappedMemory = static_cast<char*>(mappedMemory);
+		m_capacity = capacity;
+		m_cells.reset(new Cell[cellCount]);
+		m_cellMask = cellCount - 1;
+
+		for (size_t i = 0; i < cellCount; ++i)
+		{
+			m_cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	// Any thread. Write fills the size bytes reserved for the upload. Returns false without calling it
+	// when the upload is empty, larger than the staging buffer, or the queue or the staging buffer is
+	// full until the render thread catches up.
+	bool push(uint64_t size, const std::function<void(void*)>& write, T&& payload)
+	{
+		uint64_t position;
+
+		if (!claimCell(&position))
+		{
+			return false;
+		}
+
+		Cell& cell = m_cells[position & m_cellMask];
+		StagingRange range = {};
+		const bool reserved = size > 0 && size <= m_capacity && reserveStaging(size, &range);
+
+		// A claimed cell is published either way, an empty range makes the render thread skip it.
+		if (reserved)
+		{
+			write(m_mappedMemory + range.offset);
+			cell.upload.range = range;
+			cell.upload.size = size;
+			cell.upload.payload = std::move(payload);
+		}
+		else
+		{
+			cell.upload.range = {};
+			cell.upload.size = 0;
+		}
+
+		cell.sequence.store(position + 1, std::memory_order_release);
+		return reserved;
+	}
+
+	// Render thread only. Stops at the first upload that is still being written.
+	bool pop(QueuedUpload<T>* outUpload)
+	{
+		while (true)
+		{
+			Cell& cell = m_cells[m_dequeuePosition & m_cellMask];
+
+			if (cell.sequence.load(std::memory_order_acquire) != m_dequeuePosition + 1)
+			{
+				return false;
+			}
+
+			const bool reserved = cell.upload.range.end != cell.upload.range.begin;
+
+			if (reserved)
+			{
+				*outUpload = std::move(cell.upload);
+			}
+
+			cell.sequence.store(m_dequeuePosition + m_cellMask + 1, std::memory_order_release);
+			++m_dequeuePosition;
+
+			if (reserved)
+			{
+				return true;
+			}
+		}
+	}
+
+	// Render thread only. The staging range is handed out again once collect passes frame.
+	void retire(uint64_t frame, const StagingRange& range)
+	{
+		m_retiredRanges.push_back({ frame, range.begin, range.end });
+	}
+
+	void collect(uint64_t completedFrame)
+	{
+		while (!m_retiredRanges.empty() && m_retiredRanges.front().frame <= completedFrame)
+		{
+			m_completedRanges[m_retiredRanges.front().begin] = m_retiredRanges.front().end;
+			m_retiredRanges.pop_front();
+		}
+
+		uint64_t tail = m_stagingTail.load(std::memory_order_relaxed);
+
+		for (auto completed = m_completedRanges.find(tail); completed != m_completedRanges.end();
+			completed = m_completedRanges.find(tail))
+		{
+			tail = completed->second;
+			m_completedRanges.erase(completed);
+		}
+
+		m_stagingTail.store(tail, std::memory_order_release);
+	}
+};
\ No newline at end of file
@@ -0,0 +1,109 @@
+#include "UploadStrategy.h"
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+
+static const VkDeviceSize STAGING_CHUNK_SIZES[] = { 0, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024 };
+
+std::vector<UploadStrategy> listStagedUploadStrategies(bool transferQueueAvailable)
+{
+	std::vector<UploadStrategy> strategies;
+
+	for (int transferQueue = 0; transferQueue < (transferQueueAvailable ? 2 : 1); ++transferQueue)
+	{
+		for (VkDeviceSize chunkSize : STAGING_CHUNK_SIZES)
+		{
+			strategies.push_back({ false, transferQueue != 0, chunkSize });
+		}
+	}
+
+	return strategies;
+}
+
+std::string makeDeviceKey(const VkPhysicalDeviceProperties& properties)
+{
+	char key[2 * 8 + 2 * VK_UUID_SIZE + 1];
+	int length = snprintf(key, sizeof(key), "%08x%08x", properties.vendorID, properties.deviceID);
+
+	// The pipeline cache UUID is the only identity Vulkan 1.0 offers, and it changes with the driver.
+	for (uint32_t i = 0; i < VK_UUID_SIZE; ++i)
+	{
+		length += snprintf(key + length, sizeof(key) - length, "%02x", properties.pipelineCacheUUID[i]);
+	}
+
+	return key;
+}
+
+bool loadUploadStrategy(const std::string& path, const std::string& deviceKey, UploadStrategy* outStrategy)
+{
+	std::ifstream file(path);
+	std::string line;
+
+	while (std::getline(file, line))
+	{
+		std::istringstream entry(line);
+		std::string key;
+		int directWrite = 0;
+		int transferQueue = 0;
+		VkDeviceSize stagingChunkSize = 0;
+
+		if (entry >> key >> directWrite >> transferQueue >> stagingChunkSize && key == deviceKey)
+		{
+			*outStrategy = { directWrite != 0, transferQueue != 0, stagingChunkSize };
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool saveUploadStrategy(const std::string& path, const std::string& deviceKey, const UploadStrategy& strategy)
+{
+	std::vector<std::string> lines;
+
+	{
+		std::ifstream file(path);
+		std::string line;
+
+		while (std::getline(file, line))
+		{
+			if (line.compare(0, deviceKey.size() + 1, deviceKey + " ") != 0)
+			{
+				lines.push_back(line);
+			}
+		}
+	}
+
+	std::ostringstream entry;
+	entry << deviceKey << " " << strategy.directWrite << " " << strategy.transferQueue << " " <<
+		strategy.stagingChunkSize;
+	lines.push_back(entry.str());
+
+	std::ofstream file(path);
+
+	for (const std::string& line : lines)
+	{
+		file << line << "\n";
+	}
+
+	return file.good();
+}
+
+void printUploadStrategy(std::ostream& out, const UploadStrategy& strategy)
+{
+	if (strategy.directWrite)
+	{
+		out << "direct writes, edits ";
+	}
+
+	if (strategy.stagingChunkSize == 0)
+	{
+		out << "staged one buffer per upload";
+	}
+	else
+	{
+		out << "staged through " << strategy.stagingChunkSize / 1024 << " KiB chunks";
+	}
+
+	out << " on the " << (strategy.transferQueue ? "transfer" : "graphics") << " queue";
+}
\ No newline at end of file
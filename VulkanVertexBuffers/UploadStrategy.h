@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vulkan.h>
+#include <string>
+#include <vector>
+#include <ostream>
+
+// How uploads reach device-local memory, picked per device by a probe at startup.
+struct UploadStrategy
+{
+	// Geometry is written straight into host-visible device-local memory, other uploads stay staged.
+	bool directWrite;
+	// Staged copies are submitted to a dedicated transfer queue instead of the graphics queue.
+	bool transferQueue;
+	// Small uploads share staging chunks of this size, zero gives every upload a buffer of its own.
+	VkDeviceSize stagingChunkSize;
+};
+
+struct UploadMeasurement
+{
+	UploadStrategy strategy;
+	double seconds;
+};
+
+// Every staged strategy worth probing, on the transfer queue too when there is one.
+std::vector<UploadStrategy> listStagedUploadStrategies(bool transferQueueAvailable);
+
+// Identifies the device together with its driver, so a driver update probes again.
+std::string makeDeviceKey(const VkPhysicalDeviceProperties& properties);
+
+// Returns false when the cache has no entry for deviceKey.
+bool loadUploadStrategy(const std::string& path, const std::string& deviceKey, UploadStrategy* outStrategy);
+// Replaces the entry of deviceKey and keeps those of other devices.
+bool saveUploadStrategy(const std::string& path, const std::string& deviceKey, const UploadStrategy& strategy);
+
+void printUploadStrategy(std::ostream& out, const UploadStrategy& strategy);
\ No newline at end of file
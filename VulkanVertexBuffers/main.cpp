@@ -1,9 +1,69 @@
 #include "SDL.h"
 #include "Engine.h"
+#include "Benchmark.h"
+#include "TripleBuffer.h"
 #include <iostream>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
 
 int main(int argc, char* args[]) {
 
+	bool gpuDrivenCulling = true;
+	bool occlusionCulling = false;
+	bool clusterCulling = true;
+	bool vertexPulling = false;
+	bool vertexDeformation = false;
+	bool onDemandRendering = false;
+	const char* captureDirectory = nullptr;
+	CaptureFormat captureFormat = CaptureFormat::Raw;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(args[i], "--benchmark-culling") == 0)
+		{
+			runCullingBenchmark(std::cout);
+			return 0;
+		}
+		else if (strcmp(args[i], "--benchmark-codec") == 0)
+		{
+			runCodecBenchmark(std::cout);
+			return 0;
+		}
+		else if (strcmp(args[i], "--cpu-culling") == 0)
+		{
+			gpuDrivenCulling = false;
+		}
+		else if (strcmp(args[i], "--occlusion-culling") == 0)
+		{
+			occlusionCulling = true;
+		}
+		else if (strcmp(args[i], "--no-cluster-culling") == 0)
+		{
+			clusterCulling = false;
+		}
+		else if (strcmp(args[i], "--vertex-pulling") == 0)
+		{
+			vertexPulling = true;
+		}
+		else if (strcmp(args[i], "--deform-vertices") == 0)
+		{
+			vertexDeformation = true;
+		}
+		else if (strcmp(args[i], "--on-demand") == 0)
+		{
+			onDemandRendering = true;
+		}
+		else if ((strcmp(args[i], "--capture-raw") == 0 || strcmp(args[i], "--capture-png") == 0) && i + 1 < argc)
+		{
+			captureFormat = strcmp(args[i], "--capture-png") == 0 ? CaptureFormat::Png : CaptureFormat::Raw;
+			captureDirectory = args[++i];
+		}
+	}
+
 	SDL_Init(SDL_INIT_VIDEO);
 
 	SDL_Window* window = SDL_CreateWindow(
@@ -22,14 +82,83 @@ int main(int argc, char* args[]) {
 	}
 
 	Engine engine;
+	engine.setGpuDrivenCulling(gpuDrivenCulling);
+	engine.setOcclusionCulling(occlusionCulling);
+	engine.setClusterCulling(clusterCulling);
+	engine.setVertexPulling(vertexPulling);
+	engine.setVertexDeformation(vertexDeformation);
+	engine.setOnDemandRendering(onDemandRendering);
+
+	if (captureDirectory)
+	{
+		engine.setFrameCapture(captureDirectory, captureFormat);
+	}
+
 	engine.init(window);
 
 	SDL_Event sdlEvent;
-	bool running = true;
+	std::atomic<bool> running(true);
+	uint32_t meshDetail = 2;
+	float ripplePhase = 0.0f;
+	bool idle = false;
+	TripleBuffer<FrameSnapshot> snapshots;
+
+	// The simulation steps at its own fixed rate and never waits for rendering, which in turn
+	// always draws the newest finished step.
+	std::thread simulationThread([&engine, &snapshots, &running, onDemandRendering]()
+	{
+		// On demand the scene is static and only changes through events.
+		if (onDemandRendering)
+		{
+			return;
+		}
+
+		const std::chrono::microseconds step(1000000 / 120);
+		std::chrono::steady_clock::time_point nextStep = std::chrono::steady_clock::now();
+
+		while (running)
+		{
+			engine.update(&snapshots.getWriteSlot());
+			snapshots.publish();
+
+			nextStep += step;
+			std::this_thread::sleep_until(nextStep);
+		}
+	});
+
+	// Builds the next detail level before it is asked for, so switching to it only swaps cached geometry.
+	std::atomic<uint32_t> prefetchGridSize(4u << ((meshDetail + 1) % 4));
+	std::thread assetThread([&engine, &running, &prefetchGridSize]()
+	{
+		uint32_t queuedGridSize = 0;
+
+		while (running)
+		{
+			const uint32_t gridSize = prefetchGridSize;
+
+			if (gridSize != queuedGridSize)
+			{
+				std::vector<Vertex> vertices;
+				std::vector<uint32_t> indices;
+				buildGridMesh(gridSize, &vertices, &indices);
+
+				// A full queue is simply tried again on the next pass.
+				if (engine.queueMesh(gridSize, std::move(vertices), std::move(indices)))
+				{
+					queuedGridSize = gridSize;
+				}
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+	});
 
 	while (running)
 	{
-		if (SDL_PollEvent(&sdlEvent))
+		// An idle engine sleeps until input arrives, the timeout keeps it responsive to anything else.
+		bool hasEvent = idle ? SDL_WaitEventTimeout(&sdlEvent, 100) != 0 : SDL_PollEvent(&sdlEvent) != 0;
+
+		for (; hasEvent; hasEvent = SDL_PollEvent(&sdlEvent) != 0)
 		{
 			if (sdlEvent.type == SDL_WINDOWEVENT)
 			{
@@ -38,15 +167,79 @@ int main(int argc, char* args[]) {
 				case SDL_WINDOWEVENT_CLOSE:
 					running = false;
 					break;
+				case SDL_WINDOWEVENT_EXPOSED:
+				case SDL_WINDOWEVENT_RESTORED:
+					engine.invalidateSwapchain();
+					break;
 				}
 			}
+			else if (sdlEvent.type == SDL_KEYDOWN)
+			{
+				switch (sdlEvent.key.keysym.sym)
+				{
+				case SDLK_m:
+					meshDetail = (meshDetail + 1) % 4;
+					engine.reloadMesh(4u << meshDetail);
+					prefetchGridSize = 4u << ((meshDetail + 1) % 4);
+					break;
+				case SDLK_p:
+					vertexPulling = !vertexPulling;
+					engine.setVertexPulling(vertexPulling);
+					break;
+				case SDLK_e:
+				{
+					// Ripples the rest pose and rotates the corners of every full detail triangle, which keeps
+					// each triangle and its winding. Both go through the partial geometry update path.
+					ripplePhase += 0.5f;
+					std::vector<Vertex> vertices = engine.getVertices();
+
+					for (Vertex& vertex : vertices)
+					{
+						vertex.position.z = 0.05f * std::sin(10.0f * vertex.position.x + ripplePhase);
+					}
+
+					engine.updateVertices(0, vertices.data(), static_cast<uint32_t>(vertices.size()));
+
+					std::vector<uint32_t> indices = engine.getFullDetailIndices();
+
+					for (size_t i = 0; i + 3 <= indices.size(); i += 3)
+					{
+						std::rotate(indices.begin() + i, indices.begin() + i + 1, indices.begin() + i + 3);
+					}
+
+					engine.updateIndices(0, indices.data(), static_cast<uint32_t>(indices.size()));
+					break;
+				}
+				}
+			}
+		}
+
+		if (snapshots.acquire())
+		{
+			engine.applySnapshot(snapshots.getReadSlot());
 		}
 
-		engine.update();
-		engine.render();
+		idle = !engine.render();
+	}
+
+	simulationThread.join();
+	assetThread.join();
+
+	if (onDemandRendering)
+	{
+		std::cout << "Skipped " << engine.getSkippedFrameCount() << " unchanged frames." << std::endl;
 	}
 
 	engine.cleanUp();
+	engine.reportHostAllocations(std::cout);
+	engine.reportUploadStrategy(std::cout);
+
+	if (captureDirectory)
+	{
+		std::cout << "Captured " << engine.getCapturedFrameCount() << " frames, dropped " <<
+			engine.getDroppedCaptureCount() << "." << std::endl;
+	}
+
 	SDL_DestroyWindow(window);
 
 	SDL_Quit();
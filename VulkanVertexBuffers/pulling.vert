@@ -0,0 +1,41 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+struct ObjectData {
+    mat4 transform;
+    vec4 color;
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer Objects {
+    ObjectData objects[];
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer Vertices {
+    float vertexWords[];
+};
+
+layout(push_constant) uniform FrameConstants {
+    mat4 viewProjection;
+    uint vertexStride;
+    uint positionOffset;
+    uint colorOffset;
+};
+
+layout(location = 2) in uint objectIndex;
+layout(location = 0) out vec3 fragColor;
+
+const uint ATTRIBUTE_ABSENT = 0xFFFFFFFFu;
+
+vec3 readVec3(uint offset) {
+    return vec3(vertexWords[offset], vertexWords[offset + 1], vertexWords[offset + 2]);
+}
+
+void main() {
+    uint vertexBase = uint(gl_VertexIndex) * vertexStride;
+    vec3 position = readVec3(vertexBase + positionOffset);
+    vec3 color = colorOffset == ATTRIBUTE_ABSENT ? vec3(1.0) : readVec3(vertexBase + colorOffset);
+
+    ObjectData object = objects[objectIndex];
+    gl_Position = viewProjection * object.transform * vec4(position, 1.0);
+    fragColor = color * object.color.rgb;
+}
\ No newline at end of file
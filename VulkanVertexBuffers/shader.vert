@@ -1,11 +1,26 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
+struct ObjectData {
+    mat4 transform;
+    vec4 color;
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer Objects {
+    ObjectData objects[];
+};
+
+layout(push_constant) uniform FrameConstants {
+    mat4 viewProjection;
+};
+
 layout(location = 0) in vec3 vertPosition;
 layout(location = 1) in vec3 vertColor;
+layout(location = 2) in uint objectIndex;
 layout(location = 0) out vec3 fragColor;
 
 void main() {
-    gl_Position = vec4(vertPosition, 1.0);
-    fragColor = vertColor;
+    ObjectData object = objects[objectIndex];
+    gl_Position = viewProjection * object.transform * vec4(vertPosition, 1.0);
+    fragColor = vertColor * object.color.rgb;
 }
\ No newline at end of file